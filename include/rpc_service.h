@@ -1,6 +1,7 @@
 #ifndef _RPC_SERVICE_H_
 #define _RPC_SERVER_H_
 
+#include "flathash.h"
 #include "hashlist.h"
 #include "log.h"
 #include "mem_pool.h"
@@ -0,0 +1,240 @@
+#include "../include/flathash.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FLATHASH_ALLOC(size) malloc(size)
+#define FLATHASH_FREE(ptr)   free(ptr)
+
+// keep load factor under 7/8, count tombstones as used
+#define FLATHASH_NEED_GROW(table, count) \
+    (((count) + (table)->tombstone_count) * 8 > (table)->capacity * 7)
+
+// murmur3 finalizer, mix all 64 bits of key
+static inline unsigned long flathash_mix(unsigned long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53UL;
+    key ^= key >> 33;
+    return key;
+}
+
+#define FLATHASH_H1(hash) ((hash) >> 7)
+#define FLATHASH_H2(hash) ((int8_t)((hash) & 0x7f))
+
+// return bit mask of control bytes in group equal to val
+static inline unsigned int flathash_group_match(const int8_t *group, const int8_t val)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(val)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < FLATHASH_GROUP_SIZE; i++) {
+        mask |= (unsigned int)(group[i] == val) << i;
+    }
+    return mask;
+#endif
+}
+
+// return bit mask of empty or deleted control bytes in group, both have high bit set
+static inline unsigned int flathash_group_match_free(const int8_t *group)
+{
+#ifdef __SSE2__
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < FLATHASH_GROUP_SIZE; i++) {
+        mask |= (unsigned int)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline unsigned long flathash_round_capacity(const unsigned long capacity)
+{
+    unsigned long real_capacity = FLATHASH_MIN_CAPACITY;
+    while (real_capacity < capacity) {
+        real_capacity <<= 1;
+    }
+    return real_capacity;
+}
+
+static inline int flathash_init(const unsigned long capacity, flathash_t *hashtable)
+{
+    int8_t          *ctrl = FLATHASH_ALLOC(capacity);
+    flathash_slot_t *slot = FLATHASH_ALLOC(capacity * sizeof(flathash_slot_t));
+    if (!ctrl || !slot) {
+        FLATHASH_FREE(ctrl);
+        FLATHASH_FREE(slot);
+        return -1;
+    }
+    memset(ctrl, FLATHASH_CTRL_EMPTY, capacity);
+    hashtable->capacity        = capacity;
+    hashtable->obj_count       = 0;
+    hashtable->tombstone_count = 0;
+    hashtable->ctrl            = ctrl;
+    hashtable->slot            = slot;
+    return 0;
+}
+
+// find slot index of key, return -1 if key not in table
+static inline long flathash_find(unsigned long key, flathash_t *hashtable)
+{
+    unsigned long hash       = flathash_mix(key);
+    unsigned long group_mask = (hashtable->capacity / FLATHASH_GROUP_SIZE) - 1;
+    unsigned long group_id   = FLATHASH_H1(hash) & group_mask;
+    int8_t        h2         = FLATHASH_H2(hash);
+    // triangular probing visits every group once when group count is power of 2
+    for (unsigned long probe = 0; probe <= group_mask; probe++) {
+        const int8_t *group = hashtable->ctrl + group_id * FLATHASH_GROUP_SIZE;
+        unsigned int  match = flathash_group_match(group, h2);
+        while (match) {
+            unsigned long index = group_id * FLATHASH_GROUP_SIZE + __builtin_ctz(match);
+            if (hashtable->slot[index].key == key) {
+                return (long)index;
+            }
+            match &= match - 1;
+        }
+        // empty slot ends probe chain
+        if (flathash_group_match(group, FLATHASH_CTRL_EMPTY)) {
+            return -1;
+        }
+        group_id = (group_id + probe + 1) & group_mask;
+    }
+    return -1;
+}
+
+// insert key which is known not in table, table must have free slot
+static inline void flathash_insert_unique(unsigned long key, void *val, flathash_t *hashtable)
+{
+    unsigned long hash       = flathash_mix(key);
+    unsigned long group_mask = (hashtable->capacity / FLATHASH_GROUP_SIZE) - 1;
+    unsigned long group_id   = FLATHASH_H1(hash) & group_mask;
+    for (unsigned long probe = 0;; probe++) {
+        unsigned int match = flathash_group_match_free(hashtable->ctrl + group_id * FLATHASH_GROUP_SIZE);
+        if (match) {
+            unsigned long index = group_id * FLATHASH_GROUP_SIZE + __builtin_ctz(match);
+            if (hashtable->ctrl[index] == FLATHASH_CTRL_DELETED) {
+                hashtable->tombstone_count--;
+            }
+            hashtable->ctrl[index]     = FLATHASH_H2(hash);
+            hashtable->slot[index].key = key;
+            hashtable->slot[index].val = val;
+            hashtable->obj_count++;
+            return;
+        }
+        group_id = (group_id + probe + 1) & group_mask;
+    }
+}
+
+static int flathash_rehash(const unsigned long capacity, flathash_t *hashtable)
+{
+    flathash_t old = *hashtable;
+    if (flathash_init(capacity, hashtable) != 0) {
+        *hashtable = old;
+        return -1;
+    }
+    LOG_DEBUG("FLATHASH rehash, capacity:%lu -> %lu, obj_count:%lu", old.capacity, capacity, old.obj_count);
+    for (unsigned long i = 0; i < old.capacity; i++) {
+        if (old.ctrl[i] >= 0) {
+            flathash_insert_unique(old.slot[i].key, old.slot[i].val, hashtable);
+        }
+    }
+    FLATHASH_FREE(old.ctrl);
+    FLATHASH_FREE(old.slot);
+    return 0;
+}
+
+flathash_t *flathash_create(const unsigned long capacity)
+{
+    if (!capacity) {
+        return NULL;
+    }
+    flathash_t *hashtable = FLATHASH_ALLOC(sizeof(flathash_t));
+    if (!hashtable) {
+        return NULL;
+    }
+    if (flathash_init(flathash_round_capacity(capacity), hashtable) != 0) {
+        FLATHASH_FREE(hashtable);
+        return NULL;
+    }
+    return hashtable;
+}
+
+void flathash_destroy(flathash_t *hashtable)
+{
+    if (!hashtable) {
+        return;
+    }
+    FLATHASH_FREE(hashtable->ctrl);
+    FLATHASH_FREE(hashtable->slot);
+    FLATHASH_FREE(hashtable);
+}
+
+int flathash_add(unsigned long key, void *val, flathash_t *table)
+{
+    if (!val || !table) {
+        return -1;
+    }
+    // key already exists, update val in place
+    long index = flathash_find(key, table);
+    if (index >= 0) {
+        table->slot[index].val = val;
+        return 0;
+    }
+    if (FLATHASH_NEED_GROW(table, table->obj_count + 1)) {
+        // only grow when live objects need it, otherwise just drop tombstones
+        unsigned long capacity = table->capacity;
+        if ((table->obj_count + 1) * 16 > capacity * 7) {
+            capacity <<= 1;
+        }
+        if (flathash_rehash(capacity, table) != 0) {
+            LOG_DEBUG("FLATHASH rehash failed, capacity:%lu", capacity);
+            return -1;
+        }
+    }
+    LOG_DEBUG("FLATHASH add, key:0x%lx, val:%p", key, val);
+    flathash_insert_unique(key, val, table);
+    return 0;
+}
+
+long flathash_get(unsigned long key, flathash_t *hashtable)
+{
+    if (!hashtable) {
+        return 0;
+    }
+    long index = flathash_find(key, hashtable);
+    if (index < 0) {
+        return 0;
+    }
+    return (long)(hashtable->slot[index].val);
+}
+
+long flathash_remove(unsigned long key, flathash_t *hashtable)
+{
+    if (!hashtable) {
+        return -1;
+    }
+    long index = flathash_find(key, hashtable);
+    if (index < 0) {
+        return -1;
+    }
+    // if group still has empty slot, no probe chain passes through this group,
+    // slot can be marked empty directly instead of leaving tombstone
+    const int8_t *group = hashtable->ctrl + (index & ~(long)(FLATHASH_GROUP_SIZE - 1));
+    if (flathash_group_match(group, FLATHASH_CTRL_EMPTY)) {
+        hashtable->ctrl[index] = FLATHASH_CTRL_EMPTY;
+    } else {
+        hashtable->ctrl[index] = FLATHASH_CTRL_DELETED;
+        hashtable->tombstone_count++;
+    }
+    hashtable->obj_count--;
+    LOG_DEBUG("FLATHASH remove, key:0x%lx, val:%p", key, hashtable->slot[index].val);
+    return (long)(hashtable->slot[index].val);
+}
@@ -1,70 +1,154 @@
 #include "../include/hashlist.h"
 #include "../include/log.h"
+#include <sched.h>
 #include <string.h>
 
-#define HASH_OBJ_ALLOC(size) malloc(size)
-#define HASH_OBJ_FREE(ptr)   free(ptr)
+#define HASH_OBJ_ALLOC(size)   malloc(size)
+#define HASH_OBJ_FREE(ptr)     free(ptr)
+// table holds cache line aligned lock stripes and reader slots
+#define HASH_TABLE_ALLOC(size) \
+    aligned_alloc(LINKHASH_CACHELINE_SIZE, ((size) + LINKHASH_CACHELINE_SIZE - 1) & ~(LINKHASH_CACHELINE_SIZE - 1))
+#define HASH_TABLE_FREE(ptr)   free(ptr)
 
-static inline void linkhash_init(const unsigned long bucket_count, linkhash_t *hashtable)
+#define HASH_LOAD_NEXT(node)       __atomic_load_n(&((node)->next), __ATOMIC_ACQUIRE)
+#define HASH_STORE_NEXT(node, val) __atomic_store_n(&((node)->next), (val), __ATOMIC_RELEASE)
+
+static atomic_t      linkhash_reader_slot_seq = {0};
+static __thread long linkhash_reader_slot     = -1;
+
+static inline hlist_bucket_lock_t *linkhash_bucket_lock(linkhash_t *hashtable, const unsigned int bucket_id)
 {
-    hashtable->bucket_count = bucket_count;
-    hashtable->bucket       = hashtable->_bucket;
-    atomic_store(&(hashtable->obj_count), 0);
-    INIT_LIST_HEAD(&(hashtable->hlist_head));
-    // don't init bucket head when create linkhash, init it when using
-    memset(hashtable->bucket, 0, bucket_count * sizeof(hlist_bucket_t));
-    for (int i = 0; i < bucket_count; i++) {
-        INIT_LIST_HEAD(&(hashtable->bucket[i].bucket_start));
+    return &(hashtable->stripe[bucket_id & (LINKHASH_LOCK_STRIPE_COUNT - 1)].lock);
+}
+
+// each thread sticks to one reader slot, so readers of different threads rarely share cache line
+static inline hlist_reader_slot_t *linkhash_reader_slot_get(linkhash_t *hashtable)
+{
+    if (linkhash_reader_slot < 0) {
+        linkhash_reader_slot = __sync_fetch_and_add(&(linkhash_reader_slot_seq.value), 1) & (LINKHASH_READER_SLOT_COUNT - 1);
+    }
+    return &(hashtable->reader[linkhash_reader_slot]);
+}
+
+static inline long linkhash_read_lock(linkhash_t *hashtable, hlist_reader_slot_t *slot)
+{
+    long phase = __atomic_load_n(&(hashtable->reader_phase), __ATOMIC_ACQUIRE) & 1;
+    __atomic_add_fetch(&(slot->count[phase]), 1, __ATOMIC_SEQ_CST);
+    return phase;
+}
+
+static inline void linkhash_read_unlock(hlist_reader_slot_t *slot, const long phase)
+{
+    __atomic_sub_fetch(&(slot->count[phase]), 1, __ATOMIC_RELEASE);
+}
+
+// wait until no reader can still hold object unlinked before this call
+static void linkhash_synchronize(linkhash_t *hashtable)
+{
+    pthread_mutex_lock(&(hashtable->sync_lock));
+    // flip twice, reader which loaded old phase but not yet counted is caught by second flip
+    for (int i = 0; i < 2; i++) {
+        long old_phase = __atomic_fetch_add(&(hashtable->reader_phase), 1, __ATOMIC_SEQ_CST) & 1;
+        for (int slot = 0; slot < LINKHASH_READER_SLOT_COUNT; slot++) {
+            while (__atomic_load_n(&(hashtable->reader[slot].count[old_phase]), __ATOMIC_ACQUIRE)) {
+                sched_yield();
+            }
+        }
     }
+    pthread_mutex_unlock(&(hashtable->sync_lock));
+}
+
+static inline unsigned int linkhash_bucket_id(linkhash_t *hashtable, const unsigned long key)
+{
+    unsigned long hash = hashtable->hash_func ? hashtable->hash_func(key) : hash_64bkey(key);
+    return (unsigned int)(hash & (hashtable->bucket_count - 1));
+}
+
+static inline int linkhash_key_equal(linkhash_t *hashtable, const unsigned long key1, const unsigned long key2)
+{
+    return hashtable->equal_func ? hashtable->equal_func(key1, key2) : key1 == key2;
+}
+
+int linkhash_str_equal(const unsigned long key1, const unsigned long key2)
+{
+    return !strcmp((const char *)key1, (const char *)key2);
 }
 
 static inline void linkhash_bucket_init(hlist_bucket_t *bucket)
 {
-    HASH_BUCKET_LOCK_INIT(&(bucket->bucket_lock));
     INIT_LIST_HEAD(&(bucket->bucket_start));
     atomic_set(&(bucket->refcount), 0);
 }
 
-linkhash_t *linkhash_create(const unsigned long bucket_count)
+static inline void linkhash_init(const unsigned long bucket_count, linkhash_hash_func_t hash_func, linkhash_equal_func_t equal_func, linkhash_t *hashtable)
+{
+    memset(hashtable, 0, sizeof(linkhash_t) + bucket_count * sizeof(hlist_bucket_t));
+    hashtable->bucket_count = bucket_count;
+    hashtable->hash_func    = hash_func;
+    hashtable->equal_func   = equal_func;
+    hashtable->bucket       = hashtable->_bucket;
+    hashtable->reader_phase = 0;
+    atomic_store(&(hashtable->obj_count), 0);
+    pthread_mutex_init(&(hashtable->sync_lock), NULL);
+    for (int i = 0; i < LINKHASH_LOCK_STRIPE_COUNT; i++) {
+        HASH_BUCKET_LOCK_INIT(&(hashtable->stripe[i].lock));
+    }
+    for (unsigned long i = 0; i < bucket_count; i++) {
+        linkhash_bucket_init(&(hashtable->bucket[i]));
+    }
+}
+
+linkhash_t *linkhash_create_custom(const unsigned long bucket_count, linkhash_hash_func_t hash_func, linkhash_equal_func_t equal_func)
 {
     if (!bucket_count || bucket_count > LINKHASH_MAX_BUCKET_COUNT) {
         return NULL;
     }
 
     //
-    linkhash_t *hashtable = HASH_OBJ_ALLOC(sizeof(linkhash_t) + sizeof(hlist_bucket_t) * bucket_count);
+    linkhash_t *hashtable = HASH_TABLE_ALLOC(sizeof(linkhash_t) + sizeof(hlist_bucket_t) * bucket_count);
     if (!hashtable) {
         return NULL;
     }
-    linkhash_init(bucket_count, hashtable);
+    linkhash_init(bucket_count, hash_func, equal_func, hashtable);
     return hashtable;
 }
 
+linkhash_t *linkhash_create(const unsigned long bucket_count)
+{
+    return linkhash_create_custom(bucket_count, NULL, NULL);
+}
+
 int linkhash_add(unsigned long key, void *val, linkhash_t *table)
 {
     if (!val || !table) {
         return -1;
     }
 
-    unsigned int hash      = hash_32bkey((unsigned int)key);
-    unsigned int bucket_id = hash & (table->bucket_count - 1);
-    LOG_DEBUG("HASHLIST add, key:0x%lx, val:%p, hash:%u, bucket:%u", key, val, hash, bucket_id);
+    unsigned int bucket_id = linkhash_bucket_id(table, key);
+    LOG_DEBUG("HASHLIST add, key:0x%lx, val:%p, bucket:%u", key, val, bucket_id);
     hlist_bucket_t *bucket = &(table->bucket[bucket_id]);
 
     // hash bucket itself doesn't store val, it only point to hash_obj list which stores val
-    hlist_t *new           = HASH_OBJ_ALLOC(sizeof(hlist_t));
+    hash_obj_t *new        = HASH_OBJ_ALLOC(sizeof(hash_obj_t));
     if (!new) {
         LOG_DEBUG("HASH_OBJ_ALLOC failed!");
         return -1;
     }
-    new->obj.val = val;
-    new->obj.key = key;
-    atomic_add(&(bucket->refcount), 1);
-    // insert in conflict solved chain
-    list_add(&(new->obj.chain), &(bucket->bucket_start));
-    // insert in table list
-    list_add(&(new->hlist), &(table->hlist_head));
-    atomic_add(&(table->obj_count), 1);
+    new->val = val;
+    new->key = key;
+
+    // insert in conflict solved chain, obj must be complete before readers can see it
+    hlist_bucket_lock_t *lock = linkhash_bucket_lock(table, bucket_id);
+    list_t              *head = &(bucket->bucket_start);
+    HASH_BUCKET_LOCK(lock);
+    list_t *first   = head->next;
+    new->chain.next = first;
+    new->chain.prev = head;
+    first->prev     = &(new->chain);
+    HASH_STORE_NEXT(head, &(new->chain));
+    HASH_BUCKET_UNLOCK(lock);
+    __atomic_add_fetch(&(bucket->refcount.value), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(table->obj_count.value), 1, __ATOMIC_RELAXED);
     return 0;
 }
 
@@ -73,14 +157,18 @@ void linkhash_destroy(linkhash_t *hashtable)
     if (!hashtable) {
         return;
     }
-    list_t *hashlist = &(hashtable->hlist_head);
-    while (hashlist->next != hashlist) {
-        hlist_t *tmp = container_of(hashlist->next, hlist_t, hlist);
-        LOG_DEBUG("HASHLIST destroy, obj:%p, key:0x%lx, val:%p", tmp, tmp->obj.key, tmp->obj.val);
-        list_del_init(&(tmp->hlist));
-        HASH_OBJ_FREE(tmp);
+    // caller must make sure no one else still using table
+    for (unsigned long i = 0; i < hashtable->bucket_count; i++) {
+        list_t *head = &(hashtable->bucket[i].bucket_start);
+        while (head->next != head) {
+            hash_obj_t *tmp = container_of(head->next, hash_obj_t, chain);
+            LOG_DEBUG("HASHLIST destroy, obj:%p, key:0x%lx, val:%p", tmp, tmp->key, tmp->val);
+            list_del_init(&(tmp->chain));
+            HASH_OBJ_FREE(tmp);
+        }
     }
-    HASH_OBJ_FREE(hashtable);
+    pthread_mutex_destroy(&(hashtable->sync_lock));
+    HASH_TABLE_FREE(hashtable);
 }
 
 long linkhash_get(unsigned long key, linkhash_t *hashtable)
@@ -88,18 +176,67 @@ long linkhash_get(unsigned long key, linkhash_t *hashtable)
     if (!hashtable) {
         return 0;
     }
-    unsigned int    hash      = hash_32bkey((unsigned int)key);
-    unsigned int    bucket_id = hash & (hashtable->bucket_count - 1);
-    hlist_bucket_t *bucket    = &(hashtable->bucket[bucket_id]);
-    hash_obj_t *chain = NULL;
-    list_for_each_entry(chain, &(bucket->bucket_start), hash_obj_t, chain)
-    {
+    unsigned int         bucket_id = linkhash_bucket_id(hashtable, key);
+    hlist_bucket_t      *bucket    = &(hashtable->bucket[bucket_id]);
+    list_t              *head      = &(bucket->bucket_start);
+    hlist_reader_slot_t *slot      = linkhash_reader_slot_get(hashtable);
+    long                 val       = 0;
+
+    // lock free, objects unlinked while walking are not freed until we leave
+    long phase = linkhash_read_lock(hashtable, slot);
+    for (list_t *pos = HASH_LOAD_NEXT(head); pos != head; pos = HASH_LOAD_NEXT(pos)) {
+        hash_obj_t *chain = container_of(pos, hash_obj_t, chain);
         LOG_DEBUG("HASHLIST GET, bucket:%d, obj:%p, key:0x%lx, val:%p", bucket_id, chain, chain->key, chain->val);
-        if (chain->key == key) {
-            return (unsigned long)(chain->val);
+        if (linkhash_key_equal(hashtable, chain->key, key)) {
+            val = (long)(chain->val);
+            break;
         }
     }
-    return 0;
+    linkhash_read_unlock(slot, phase);
+    return val;
+}
+
+// lookup n keys, vals[i] is 0 if keys[i] not found, return count of found keys
+int linkhash_get_many(const unsigned long *keys, const unsigned long n, long *vals, linkhash_t *hashtable)
+{
+    if (!hashtable || !keys || !vals) {
+        return -1;
+    }
+    hlist_reader_slot_t *slot  = linkhash_reader_slot_get(hashtable);
+    int                  found = 0;
+    list_t              *head[LINKHASH_GET_BATCH_SIZE];
+    list_t              *first[LINKHASH_GET_BATCH_SIZE];
+
+    long phase = linkhash_read_lock(hashtable, slot);
+    for (unsigned long start = 0; start < n; start += LINKHASH_GET_BATCH_SIZE) {
+        unsigned long count = n - start < LINKHASH_GET_BATCH_SIZE ? n - start : LINKHASH_GET_BATCH_SIZE;
+        // hash all keys of batch and prefetch their bucket heads
+        for (unsigned long i = 0; i < count; i++) {
+            head[i] = &(hashtable->bucket[linkhash_bucket_id(hashtable, keys[start + i])].bucket_start);
+            __builtin_prefetch(head[i], 0, 3);
+        }
+        // bucket heads arriving, prefetch first chain objects
+        for (unsigned long i = 0; i < count; i++) {
+            first[i] = HASH_LOAD_NEXT(head[i]);
+            __builtin_prefetch(first[i], 0, 3);
+        }
+        // walk chains
+        for (unsigned long i = 0; i < count; i++) {
+            long val = 0;
+            for (list_t *pos = first[i]; pos != head[i]; pos = HASH_LOAD_NEXT(pos)) {
+                hash_obj_t *chain = container_of(pos, hash_obj_t, chain);
+                if (linkhash_key_equal(hashtable, chain->key, keys[start + i])) {
+                    val = (long)(chain->val);
+                    found++;
+                    break;
+                }
+            }
+            vals[start + i] = val;
+        }
+    }
+    linkhash_read_unlock(slot, phase);
+    LOG_DEBUG("HASHLIST GET MANY, keys:%lu, found:%d", n, found);
+    return found;
 }
 
 long linkhash_remove(unsigned long key, linkhash_t *hashtable)
@@ -107,23 +244,31 @@ long linkhash_remove(unsigned long key, linkhash_t *hashtable)
     if (!hashtable) {
         return -1;
     }
-    unsigned int    hash      = hash_32bkey((unsigned int)key);
-    unsigned int    bucket_id = hash & (hashtable->bucket_count - 1);
-    hlist_bucket_t *bucket    = &(hashtable->bucket[bucket_id]);
-    hash_obj_t     *chain     = NULL;
+    unsigned int         bucket_id = linkhash_bucket_id(hashtable, key);
+    hlist_bucket_t      *bucket    = &(hashtable->bucket[bucket_id]);
+    hlist_bucket_lock_t *lock      = linkhash_bucket_lock(hashtable, bucket_id);
+    hash_obj_t          *chain     = NULL;
+    hash_obj_t          *found     = NULL;
+    HASH_BUCKET_LOCK(lock);
     list_for_each_entry(chain, &(bucket->bucket_start), hash_obj_t, chain)
     {
-        if (chain->key == key) {
-            // remove from conflict solved chain
-            list_del_init(&(chain->chain));
-            hlist_t *hashlist = container_of(chain, hlist_t, obj);
-            // remove from hash list
-            list_del_init(&(hashlist->hlist));
-            LOG_DEBUG("HASHLIST REMOVE, bucket:%d, hlist:%p, obj:%p, key:0x%lx, val:%p", bucket_id, hashlist, chain, chain->key, chain->val);
-            unsigned long val = (unsigned long)(chain->val);
-            HASH_OBJ_FREE(hashlist);
-            return val;
+        if (linkhash_key_equal(hashtable, chain->key, key)) {
+            // remove from conflict solved chain, keep chain.next valid for readers still on it
+            HASH_STORE_NEXT(chain->chain.prev, chain->chain.next);
+            chain->chain.next->prev = chain->chain.prev;
+            found                   = chain;
+            break;
         }
     }
-    return -1;
+    HASH_BUCKET_UNLOCK(lock);
+    if (!found) {
+        return -1;
+    }
+    __atomic_sub_fetch(&(bucket->refcount.value), 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&(hashtable->obj_count.value), 1, __ATOMIC_RELAXED);
+    LOG_DEBUG("HASHLIST REMOVE, bucket:%d, obj:%p, key:0x%lx, val:%p", bucket_id, found, found->key, found->val);
+    unsigned long val = (unsigned long)(found->val);
+    linkhash_synchronize(hashtable);
+    HASH_OBJ_FREE(found);
+    return val;
 }
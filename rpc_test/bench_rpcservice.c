@@ -0,0 +1,215 @@
+#include "include/rpc_service.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+
+// usage: rpcservice_bench [-c max_clients] [-s max_services] [-n requests per client] [-p] [-t]
+// -p pins worker of service k to cpu 2k+1 and client c to cpu 2c, modulo cpu count,
+// -t traces services and dumps stage histograms of each run to stderr,
+// one csv row per run on stdout
+#define BENCH_RPC_SERVICE_BASE  100
+#define BENCH_RPC_MAX_SERVICES  16
+#define BENCH_RPC_MAX_CLIENTS   64
+#define BENCH_RPC_WARMUP        1000
+#define BENCH_RPC_DEFAULT_COUNT 20000
+
+typedef struct bench_rpc_config {
+    unsigned int max_clients;
+    unsigned int max_services;
+    unsigned int count;
+    int          pinned;
+    int          trace;
+    long         cpu_count;
+} bench_rpc_config_t;
+
+typedef struct bench_rpc_client {
+    pthread_t          thread;
+    unsigned long      service_id;
+    int                cpu;
+    unsigned int       service_type;
+    unsigned int       count;
+    unsigned long     *sample;
+    pthread_barrier_t *start;
+    int                res;
+} bench_rpc_client_t;
+
+static bench_rpc_config_t bench_config = {
+    .max_clients  = 4,
+    .max_services = 2,
+    .count        = BENCH_RPC_DEFAULT_COUNT,
+    .pinned       = 0,
+    .trace        = 0,
+};
+
+// nothing to do, measures transport and handoff only
+void *bench_rpc_empty_handler(const void *arg)
+{
+    return NULL;
+}
+
+static int bench_rpc_cmp(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+    return x < y ? -1 : (x > y);
+}
+
+static unsigned long bench_rpc_percentile(const unsigned long *sample, const unsigned long total, const double p)
+{
+    return sample[(unsigned long)(p * (total - 1))];
+}
+
+static void *bench_rpc_client_thread(void *arg)
+{
+    bench_rpc_client_t *bench      = (bench_rpc_client_t *)arg;
+    rpc_client_t       *rpc_client = NULL;
+    if (bench->cpu >= 0) {
+        rpc_placement_pin_self(bench->cpu);
+    }
+    if (!(rpc_client = rpc_client_get_service(bench->service_id)) || !rpc_client_request_service(rpc_client, CLIENT_GET_SERVICE)) {
+        bench->res = -1;
+        pthread_barrier_wait(bench->start);
+        return NULL;
+    }
+    for (int i = 0; i < BENCH_RPC_WARMUP; i++) {
+        rpc_client_request_service(rpc_client, bench->service_type);
+    }
+    pthread_barrier_wait(bench->start);
+    for (unsigned int i = 0; i < bench->count; i++) {
+        unsigned long start = rpc_handoff_now_ns();
+        rpc_client_request_service(rpc_client, bench->service_type);
+        bench->sample[i] = rpc_handoff_now_ns() - start;
+    }
+    // requests without response are only queued, one with response behind them means all served
+    if (bench->service_type == CLIENT_REQ_SERVICE_WITHOUT_RSP) {
+        rpc_client_request_service(rpc_client, CLIENT_REQ_SERVICE_WITH_RSP);
+    }
+    rpc_client_request_service(rpc_client, CLIENT_STOP_SERVICE);
+    RPC_SERVICE_FREE(rpc_client);
+    bench->res = 0;
+    return NULL;
+}
+
+// clients spread over first services, all start together, wall time measured from main
+static int bench_rpc_run(const char *mode, const unsigned int services, const unsigned int clients, const unsigned int service_type)
+{
+    bench_rpc_client_t bench[BENCH_RPC_MAX_CLIENTS];
+    pthread_barrier_t  start;
+    unsigned long      total  = (unsigned long)clients * bench_config.count;
+    unsigned long     *sample = RPC_SERVICE_MALLOC(sizeof(unsigned long) * total);
+    if (!sample) {
+        LOG_ERROR("BENCH alloc %lu samples failed", total);
+        return -1;
+    }
+    pthread_barrier_init(&start, NULL, clients + 1);
+    for (unsigned int i = 0; i < clients; i++) {
+        bench[i].service_id   = BENCH_RPC_SERVICE_BASE + i % services;
+        bench[i].cpu          = bench_config.pinned ? (int)((2 * i) % bench_config.cpu_count) : -1;
+        bench[i].service_type = service_type;
+        bench[i].count        = bench_config.count;
+        bench[i].sample       = sample + (unsigned long)i * bench_config.count;
+        bench[i].start        = &start;
+        bench[i].res          = 0;
+        pthread_create(&(bench[i].thread), NULL, bench_rpc_client_thread, &(bench[i]));
+    }
+    pthread_barrier_wait(&start);
+    unsigned long begin = rpc_handoff_now_ns();
+    int           res   = 0;
+    for (unsigned int i = 0; i < clients; i++) {
+        pthread_join(bench[i].thread, NULL);
+        res |= bench[i].res;
+    }
+    unsigned long elapsed = rpc_handoff_now_ns() - begin;
+    pthread_barrier_destroy(&start);
+    // warmup is in histograms too, it is small against count
+    for (unsigned int i = 0; bench_config.trace && i < services; i++) {
+        cptr_t service_cap = rpc_client_security_check(BENCH_RPC_SERVICE_BASE + i);
+        fprintf(stderr, "# %s services:%u clients:%u service:%u\n", mode, services, clients, i);
+        rpc_service_trace_dump(service_cap, stderr);
+        rpc_service_trace_reset(service_cap);
+    }
+    if (res != 0) {
+        LOG_ERROR("BENCH %s, client failed to get service", mode);
+        RPC_SERVICE_FREE(sample);
+        return -1;
+    }
+
+    qsort(sample, total, sizeof(unsigned long), bench_rpc_cmp);
+    printf("%s,%u,%u,%d,%lu,%lu,%.0f,%lu,%lu,%lu,%lu,%lu\n", mode, services, clients, bench_config.pinned, total, elapsed,
+           total * 1e9 / elapsed, bench_rpc_percentile(sample, total, 0.5), bench_rpc_percentile(sample, total, 0.9),
+           bench_rpc_percentile(sample, total, 0.99), bench_rpc_percentile(sample, total, 0.999), sample[total - 1]);
+    fflush(stdout);
+    RPC_SERVICE_FREE(sample);
+    return 0;
+}
+
+static int bench_rpc_start_services(void)
+{
+    rpc_service_handlers_t handlers = {.handlers[CLIENT_REQ_SERVICE_WITH_RSP]    = bench_rpc_empty_handler,
+                                       .handlers[CLIENT_REQ_SERVICE_WITHOUT_RSP] = bench_rpc_empty_handler};
+    for (unsigned int i = 0; i < bench_config.max_services; i++) {
+        cptr_t service_cap = rpc_service_register(BENCH_RPC_SERVICE_BASE + i, syscall(SYS_gettid));
+        if (!service_cap) {
+            return -1;
+        }
+        if (bench_config.pinned) {
+            rpc_placement_t placement = {.policy = RPC_PLACE_CPUS, .client_cpu = RPC_PLACEMENT_CURRENT_CPU, .cpu_count = 1};
+            placement.cpu[0]          = (2 * i + 1) % bench_config.cpu_count;
+            rpc_service_set_placement(service_cap, &placement);
+        }
+        if (!rpc_service_start_pool(service_cap, &handlers, 1, RPC_SERVICE_ADAPTIVE_SPIN | (bench_config.trace ? RPC_SERVICE_TRACE : 0))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "c:s:n:pt")) != -1) {
+        switch (opt) {
+            case 'c':
+                bench_config.max_clients = atoi(optarg);
+                break;
+            case 's':
+                bench_config.max_services = atoi(optarg);
+                break;
+            case 'n':
+                bench_config.count = atoi(optarg);
+                break;
+            case 'p':
+                bench_config.pinned = 1;
+                break;
+            case 't':
+                bench_config.trace = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c max_clients] [-s max_services] [-n requests] [-p] [-t]\n", argv[0]);
+                return -1;
+        }
+    }
+    bench_config.cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!bench_config.max_clients || bench_config.max_clients > BENCH_RPC_MAX_CLIENTS ||
+        !bench_config.max_services || bench_config.max_services > BENCH_RPC_MAX_SERVICES || !bench_config.count) {
+        fprintf(stderr, "clients must be 1..%d, services 1..%d, requests > 0\n", BENCH_RPC_MAX_CLIENTS, BENCH_RPC_MAX_SERVICES);
+        return -1;
+    }
+    if (bench_rpc_start_services() != 0) {
+        LOG_ERROR("BENCH start services failed");
+        return -1;
+    }
+
+    // latency columns are per request round trip in ns, for without_rsp only cost seen by client
+    printf("mode,services,clients,pinned,requests,elapsed_ns,requests_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    int res  = bench_rpc_run("latency", 1, 1, CLIENT_REQ_SERVICE_WITH_RSP);
+    res     |= bench_rpc_run("throughput", 1, 1, CLIENT_REQ_SERVICE_WITHOUT_RSP);
+    for (unsigned int services = 1; services <= bench_config.max_services; services++) {
+        for (unsigned int clients = 1; clients <= bench_config.max_clients; clients++) {
+            res |= bench_rpc_run("scaling", services, clients, CLIENT_REQ_SERVICE_WITH_RSP);
+        }
+    }
+    return res ? -1 : 0;
+}
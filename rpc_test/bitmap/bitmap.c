@@ -1,25 +1,45 @@
 #include "../include/bitmap.h"
 #include "../include/log.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
-#define BITMAP_ALLOC(bytes)            malloc(bytes + sizeof(bitmap_t))
-#define BITMAP_FREE(ptr)               free(ptr)
+#define BITMAP_ALLOC(bytes)          malloc(BITMAP_STORAGE_BYTES((bytes) << 3) + sizeof(bitmap_t))
+#define BITMAP_FREE(ptr)             free(ptr)
 
-#define BITMAP_SET_POS(bitmap, val)    (bitmap[pos >> 3] |= (val << (pos & 7)))
-#define BITMAP_POS_ISNULL(bitmap, pos) (bitmap[pos >> 3] & (1 << (pos & 7)))
+#define BITMAP_WORD_IDX(pos)         ((pos) >> BITMAP_WORD_SHIFT)
+#define BITMAP_WORD_MASK(pos)        ((bitmap_word_t)1 << ((pos) & (BITMAP_WORD_BITS - 1)))
+#define BITMAP_SUMMARY(bm)           ((bm)->bitmap + (bm)->words)
+#define BITMAP_SUMMARY_WORDS(bm)     (((bm)->words + BITMAP_WORD_BITS - 1) >> BITMAP_WORD_SHIFT)
+#define BITMAP_RUN_HINT(bm)          ((bitmap_run_hint_t *)(BITMAP_SUMMARY(bm) + BITMAP_SUMMARY_WORDS(bm)))
 
-static inline void bitmap_init(bitmap_t *b, const unsigned int bytes)
+void bitmap_init(bitmap_t *b, const unsigned int bytes)
 {
-    b->bytes = bytes;
-    memset(b->bitmap, 0, bytes);
+    unsigned int bits = bytes << 3;
+    b->bytes          = bytes;
+    b->words          = BITMAP_WORD_COUNT(bits);
+    memset(b->bitmap, 0, BITMAP_STORAGE_BYTES(bits));
+    // bits after the end of last word are never free
+    if (bits & (BITMAP_WORD_BITS - 1)) {
+        b->bitmap[b->words - 1] = BITMAP_WORD_FULL << (bits & (BITMAP_WORD_BITS - 1));
+    }
+    bitmap_word_t *summary = BITMAP_SUMMARY(b);
+    for (unsigned int i = 0; i < b->words; i++) {
+        summary[BITMAP_WORD_IDX(i)] |= BITMAP_WORD_MASK(i);
+    }
+    for (unsigned int i = 0; i < BITMAP_SUMMARY_WORDS(b); i++) {
+        BITMAP_RUN_HINT(b)[i] = BITMAP_RUN_HINT_UNKNOWN;
+    }
     atomic_set(&(b->used_bits_count), 0);
     atomic_set(&(b->first_free_pos), 0);
 }
 
 bitmap_t *bitmap_create(const unsigned int bytes)
 {
-    if (bytes > BITMAP_MAX_BYTES) {
+    if (!bytes) {
         return NULL;
     }
     bitmap_t *bm = BITMAP_ALLOC(bytes);
@@ -36,41 +56,87 @@ void bitmap_destroy(bitmap_t *bitmap)
     }
 }
 
-static inline int bitmap_set_val(bitmap_t *bitmap, const unsigned int pos, const unsigned char val)
+// keep summary bit of word in step with whether word still has free bit
+static inline void bitmap_summary_update(bitmap_t *bitmap, const unsigned int word_idx)
 {
-    if (!bitmap) {
-        return -1;
+    bitmap_word_t *summary = BITMAP_SUMMARY(bitmap);
+    if (bitmap->bitmap[word_idx] == BITMAP_WORD_FULL) {
+        summary[BITMAP_WORD_IDX(word_idx)] &= ~BITMAP_WORD_MASK(word_idx);
+    } else {
+        summary[BITMAP_WORD_IDX(word_idx)] |= BITMAP_WORD_MASK(word_idx);
     }
-    if (pos > (bitmap->bytes << 3)) {
-        LOG_DEBUG("Bitmap position %u is out of range, max range:%u.", pos, bitmap->bytes << 3);
+}
+
+// bits were freed at pos, search hint must not stay above it,
+// compare unsigned so a negative hint is lowered too
+static inline void bitmap_lower_first_free(bitmap_t *bitmap, const unsigned int pos)
+{
+    if ((unsigned int)atomic_get(&(bitmap->first_free_pos)) > pos) {
+        atomic_set(&(bitmap->first_free_pos), pos);
+    }
+}
+
+int bitmap_test(bitmap_t *bitmap, const unsigned int pos)
+{
+    if (!bitmap || pos >= (bitmap->bytes << 3)) {
         return -1;
     }
-    bitmap->bitmap[pos >> 3] |= (val << (pos & 7));
-    LOG_DEBUG("set_val: bitmap_t at:%u set to:%u, res:%hhx", pos, val, bitmap->bitmap[pos >> 3]);
-    return 0;
+    return !!(bitmap->bitmap[BITMAP_WORD_IDX(pos)] & BITMAP_WORD_MASK(pos));
 }
 
 int bitmap_clear(bitmap_t *bitmap, const unsigned int pos)
 {
-    if (!(bitmap->bitmap[pos >> 3] |= (0 << (pos & 7)))) {
+    if (!bitmap || pos >= (bitmap->bytes << 3)) {
+        LOG_DEBUG("Bitmap position %u is out of range", pos);
+        return -1;
+    }
+    bitmap_word_t *word = &(bitmap->bitmap[BITMAP_WORD_IDX(pos)]);
+    if (!(*word & BITMAP_WORD_MASK(pos))) {
         LOG_DEBUG("bitmap:%p at pos:%u already clean", bitmap, pos);
         return -1;
     }
+    *word &= ~BITMAP_WORD_MASK(pos);
+    bitmap_summary_update(bitmap, BITMAP_WORD_IDX(pos));
+    BITMAP_RUN_HINT(bitmap)[BITMAP_WORD_IDX(BITMAP_WORD_IDX(pos))] = BITMAP_RUN_HINT_UNKNOWN;
     atomic_sub(&(bitmap->used_bits_count), 1);
-    if (atomic_get(&(bitmap->first_free_pos)) > pos) {
-        atomic_set(&(bitmap->first_free_pos), pos);
-    }
-    return bitmap_set_val(bitmap, pos, 0);
+    bitmap_lower_first_free(bitmap, pos);
+    return 0;
 }
 
 int bitmap_set(bitmap_t *bitmap, const unsigned int pos)
 {
-    if (!(bitmap->bitmap[pos >> 3] |= (1 << (pos & 7)))) {
+    if (!bitmap || pos >= (bitmap->bytes << 3)) {
+        LOG_DEBUG("Bitmap position %u is out of range", pos);
+        return -1;
+    }
+    bitmap_word_t *word = &(bitmap->bitmap[BITMAP_WORD_IDX(pos)]);
+    if (*word & BITMAP_WORD_MASK(pos)) {
         LOG_DEBUG("bitmap:%p at pos:%u already set", bitmap, pos);
         return -1;
     }
+    *word |= BITMAP_WORD_MASK(pos);
+    bitmap_summary_update(bitmap, BITMAP_WORD_IDX(pos));
     atomic_add(&(bitmap->used_bits_count), 1);
-    return bitmap_set_val(bitmap, pos, 1);
+    return 0;
+}
+
+// find first word with free bit at or after word start, walking summary 64 words a time
+static inline int bitmap_find_free_word(bitmap_t *bitmap, const unsigned int start)
+{
+    bitmap_word_t *summary   = BITMAP_SUMMARY(bitmap);
+    unsigned int   sum_count = BITMAP_SUMMARY_WORDS(bitmap);
+    unsigned int   sum_idx   = BITMAP_WORD_IDX(start);
+    if (sum_idx >= sum_count) {
+        return -1;
+    }
+    bitmap_word_t sum = summary[sum_idx] & (BITMAP_WORD_FULL << (start & (BITMAP_WORD_BITS - 1)));
+    while (!sum) {
+        if (++sum_idx >= sum_count) {
+            return -1;
+        }
+        sum = summary[sum_idx];
+    }
+    return (sum_idx << BITMAP_WORD_SHIFT) + __builtin_ctzll(sum);
 }
 
 int bitmap_get_first_free(bitmap_t *bitmap)
@@ -78,12 +144,488 @@ int bitmap_get_first_free(bitmap_t *bitmap)
     if (!bitmap) {
         return -1;
     }
-    int first_pos = atomic_get(&(bitmap->first_free_pos));
+    // no bit before first_free_pos is free, start search from its word
+    unsigned int hint     = atomic_get(&(bitmap->first_free_pos));
+    int          word_idx = bitmap_find_free_word(bitmap, BITMAP_WORD_IDX(hint));
+    if (word_idx < 0) {
+        LOG_DEBUG("bitmap:%p full", bitmap);
+        return -1;
+    }
+    int first_pos = (word_idx << BITMAP_WORD_SHIFT) + __builtin_ctzll(~bitmap->bitmap[word_idx]);
     bitmap_set(bitmap, first_pos);
-    int pos = first_pos + 1;
-    for (; pos < bitmap->bytes << 3, BITMAP_POS_ISNULL(bitmap->bitmap, pos); pos++);
-    LOG_DEBUG("bitmap_get_first_free:%d, current_first:%d", first_pos, pos);
-    if (pos < bitmap->bytes << 3)
-        atomic_set(&(bitmap->first_free_pos), pos);
+    atomic_set(&(bitmap->first_free_pos), first_pos + 1);
+    LOG_DEBUG("bitmap_get_first_free:%d", first_pos);
     return first_pos;
-}
\ No newline at end of file
+}
+
+// bulk kernels over word arrays, AVX2 picked at runtime, SSE2 is baseline on x86_64
+#ifdef __SSE2__
+static inline int bitmap_cpu_has_avx2(void)
+{
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has_avx2;
+}
+
+__attribute__((target("avx2"))) static unsigned long bitmap_popcount_avx2(const bitmap_word_t *words, const unsigned int count)
+{
+    // nibble lookup table, sum bytes of each lane with sad
+    const __m256i lut  = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low  = _mm256_set1_epi8(0x0f);
+    __m256i       acc  = _mm256_setzero_si256();
+    unsigned int  i    = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v   = _mm256_loadu_si256((const __m256i *)(words + i));
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                                      _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+        acc         = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    unsigned long total = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                          _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+    for (; i < count; i++) {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+static unsigned long bitmap_popcount_sse2(const bitmap_word_t *words, const unsigned int count)
+{
+    const __m128i m1  = _mm_set1_epi8(0x55);
+    const __m128i m2  = _mm_set1_epi8(0x33);
+    const __m128i m4  = _mm_set1_epi8(0x0f);
+    __m128i       acc = _mm_setzero_si128();
+    unsigned int  i   = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(words + i));
+        v         = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+        v         = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+        v         = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+        acc       = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+    unsigned long total = (unsigned long)_mm_cvtsi128_si64(acc) + (unsigned long)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+    for (; i < count; i++) {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+__attribute__((target("avx2"))) static void bitmap_words_op_avx2(bitmap_word_t *dst, const bitmap_word_t *src, const unsigned int count, const int op)
+{
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        d         = op == BITMAP_OP_AND ? _mm256_and_si256(d, s) : op == BITMAP_OP_OR ? _mm256_or_si256(d, s)
+                                                                                         : _mm256_andnot_si256(s, d);
+        _mm256_storeu_si256((__m256i *)(dst + i), d);
+    }
+    for (; i < count; i++) {
+        dst[i] = op == BITMAP_OP_AND ? dst[i] & src[i] : op == BITMAP_OP_OR ? dst[i] | src[i] : dst[i] & ~src[i];
+    }
+}
+
+static void bitmap_words_op_sse2(bitmap_word_t *dst, const bitmap_word_t *src, const unsigned int count, const int op)
+{
+    unsigned int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        d         = op == BITMAP_OP_AND ? _mm_and_si128(d, s) : op == BITMAP_OP_OR ? _mm_or_si128(d, s)
+                                                                                   : _mm_andnot_si128(s, d);
+        _mm_storeu_si128((__m128i *)(dst + i), d);
+    }
+    for (; i < count; i++) {
+        dst[i] = op == BITMAP_OP_AND ? dst[i] & src[i] : op == BITMAP_OP_OR ? dst[i] | src[i] : dst[i] & ~src[i];
+    }
+}
+#endif
+
+static unsigned long bitmap_words_popcount(const bitmap_word_t *words, const unsigned int count)
+{
+#ifdef __SSE2__
+    return bitmap_cpu_has_avx2() ? bitmap_popcount_avx2(words, count) : bitmap_popcount_sse2(words, count);
+#else
+    unsigned long total = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+#endif
+}
+
+static void bitmap_words_op(bitmap_word_t *dst, const bitmap_word_t *src, const unsigned int count, const int op)
+{
+#ifdef __SSE2__
+    if (bitmap_cpu_has_avx2()) {
+        bitmap_words_op_avx2(dst, src, count, op);
+    } else {
+        bitmap_words_op_sse2(dst, src, count, op);
+    }
+#else
+    for (unsigned int i = 0; i < count; i++) {
+        dst[i] = op == BITMAP_OP_AND ? dst[i] & src[i] : op == BITMAP_OP_OR ? dst[i] | src[i] : dst[i] & ~src[i];
+    }
+#endif
+}
+
+// bits [lo, lo + len) of one word, len in 1~64
+static inline bitmap_word_t bitmap_word_range_mask(const unsigned int lo, const unsigned int len)
+{
+    bitmap_word_t mask = len >= BITMAP_WORD_BITS ? BITMAP_WORD_FULL : (((bitmap_word_t)1 << len) - 1);
+    return mask << lo;
+}
+
+// first bit where n (<= 64) consecutive bits of free mask start, -1 if none
+static inline int bitmap_word_find_run(bitmap_word_t free, const unsigned int n)
+{
+    // after loop, bit i set means bits i ~ i + n - 1 are all free
+    for (unsigned int k = 1; k < n && free;) {
+        unsigned int shift  = k < n - k ? k : n - k;
+        free               &= free >> shift;
+        k                  += shift;
+    }
+    return free ? __builtin_ctzll(free) : -1;
+}
+
+// count free bits at head or tail of summary group, stop at first used bit
+static inline unsigned int bitmap_group_head_free(bitmap_t *bitmap, const unsigned int first, const unsigned int last)
+{
+    unsigned int count = 0;
+    for (unsigned int i = first; i < last; i++) {
+        if (bitmap->bitmap[i]) {
+            return count + __builtin_ctzll(bitmap->bitmap[i]);
+        }
+        count += BITMAP_WORD_BITS;
+    }
+    return count;
+}
+
+static inline unsigned int bitmap_group_tail_free(bitmap_t *bitmap, const unsigned int first, const unsigned int last)
+{
+    unsigned int count = 0;
+    for (unsigned int i = last; i > first; i--) {
+        if (bitmap->bitmap[i - 1]) {
+            return count + __builtin_clzll(bitmap->bitmap[i - 1]);
+        }
+        count += BITMAP_WORD_BITS;
+    }
+    return count;
+}
+
+// set or clear summary bits of words [first, first + count)
+static void bitmap_summary_range(bitmap_t *bitmap, const unsigned int first, const unsigned int count, const int has_free)
+{
+    bitmap_word_t *summary = BITMAP_SUMMARY(bitmap);
+    unsigned int   pos     = first;
+    unsigned int   end     = first + count;
+    while (pos < end) {
+        unsigned int  lo   = pos & (BITMAP_WORD_BITS - 1);
+        unsigned int  len  = end - pos < BITMAP_WORD_BITS - lo ? end - pos : BITMAP_WORD_BITS - lo;
+        bitmap_word_t mask = bitmap_word_range_mask(lo, len);
+        if (has_free) {
+            summary[BITMAP_WORD_IDX(pos)] |= mask;
+        } else {
+            summary[BITMAP_WORD_IDX(pos)] &= ~mask;
+        }
+        pos += len;
+    }
+}
+
+// set or clear bits of one word under mask, return count of bits whose value changed
+static inline unsigned int bitmap_word_update(bitmap_t *bitmap, const unsigned int word_idx, const bitmap_word_t mask, const int set)
+{
+    bitmap_word_t old = bitmap->bitmap[word_idx];
+    bitmap->bitmap[word_idx] = set ? old | mask : old & ~mask;
+    bitmap_summary_update(bitmap, word_idx);
+    return __builtin_popcountll((set ? ~old : old) & mask);
+}
+
+// set or clear bits [start, start + n), return count of bits whose value changed,
+// whole words in the middle are counted and filled in bulk
+static unsigned int bitmap_range_update(bitmap_t *bitmap, const unsigned int start, const unsigned int n, const int set)
+{
+    unsigned int end   = start + n;
+    unsigned int first = BITMAP_WORD_IDX(start);
+    unsigned int last  = BITMAP_WORD_IDX(end - 1);
+    unsigned int head  = start & (BITMAP_WORD_BITS - 1);
+    if (!set) {
+        for (unsigned int group = BITMAP_WORD_IDX(first); group <= BITMAP_WORD_IDX(last); group++) {
+            BITMAP_RUN_HINT(bitmap)[group] = BITMAP_RUN_HINT_UNKNOWN;
+        }
+    }
+    if (first == last) {
+        return bitmap_word_update(bitmap, first, bitmap_word_range_mask(head, n), set);
+    }
+    unsigned int changed = bitmap_word_update(bitmap, first, bitmap_word_range_mask(head, BITMAP_WORD_BITS - head), set);
+    changed             += bitmap_word_update(bitmap, last, bitmap_word_range_mask(0, ((end - 1) & (BITMAP_WORD_BITS - 1)) + 1), set);
+    unsigned int middle  = last - first - 1;
+    if (middle) {
+        unsigned long used  = bitmap_words_popcount(&(bitmap->bitmap[first + 1]), middle);
+        changed            += set ? (middle << BITMAP_WORD_SHIFT) - used : used;
+        memset(&(bitmap->bitmap[first + 1]), set ? 0xff : 0, middle * sizeof(bitmap_word_t));
+        bitmap_summary_range(bitmap, first + 1, middle, !set);
+    }
+    return changed;
+}
+
+int bitmap_alloc_range(bitmap_t *bitmap, const unsigned int n, unsigned int *start)
+{
+    if (!bitmap || !start || !n || n > (bitmap->bytes << 3)) {
+        return -1;
+    }
+    bitmap_word_t     *summary   = BITMAP_SUMMARY(bitmap);
+    bitmap_run_hint_t *run_hint  = BITMAP_RUN_HINT(bitmap);
+    unsigned int       sum_count = BITMAP_SUMMARY_WORDS(bitmap);
+    // free run which reaches current position, may come from previous words or groups
+    unsigned int       run       = 0;
+    unsigned int       run_start = 0;
+    long               found     = -1;
+
+    for (unsigned int group = 0; group < sum_count && found < 0; group++) {
+        unsigned int first = group << BITMAP_WORD_SHIFT;
+        unsigned int last  = first + BITMAP_WORD_BITS < bitmap->words ? first + BITMAP_WORD_BITS : bitmap->words;
+        unsigned int bits  = (last - first) << BITMAP_WORD_SHIFT;
+        // group has no run long enough inside, only its head and tail can join runs across groups
+        if (!summary[group] || run_hint[group] < n) {
+            unsigned int head = summary[group] ? bitmap_group_head_free(bitmap, first, last) : 0;
+            if (run + head >= n) {
+                found = run_start;
+                break;
+            }
+            if (head == bits) {
+                run += bits;
+                continue;
+            }
+            unsigned int tail = summary[group] ? bitmap_group_tail_free(bitmap, first, last) : 0;
+            run               = tail;
+            run_start         = (last << BITMAP_WORD_SHIFT) - tail;
+            continue;
+        }
+        for (unsigned int i = first; i < last; i++) {
+            bitmap_word_t word = bitmap->bitmap[i];
+            if (!word) {
+                run_start  = run ? run_start : i << BITMAP_WORD_SHIFT;
+                run       += BITMAP_WORD_BITS;
+                if (run >= n) {
+                    found = run_start;
+                    break;
+                }
+                continue;
+            }
+            if (run + __builtin_ctzll(word) >= n) {
+                found = run_start;
+                break;
+            }
+            int in_word = n <= BITMAP_WORD_BITS ? bitmap_word_find_run(~word, n) : -1;
+            if (in_word >= 0) {
+                found = (i << BITMAP_WORD_SHIFT) + in_word;
+                break;
+            }
+            run       = __builtin_clzll(word);
+            run_start = ((i + 1) << BITMAP_WORD_SHIFT) - run;
+        }
+        // whole group scanned without success, no run inside it reaches n
+        if (found < 0) {
+            run_hint[group] = n - 1;
+        }
+    }
+    if (found < 0) {
+        LOG_DEBUG("bitmap:%p no free run of %u bits", bitmap, n);
+        return -1;
+    }
+    bitmap_range_update(bitmap, found, n, 1);
+    atomic_add(&(bitmap->used_bits_count), n);
+    if (atomic_get(&(bitmap->first_free_pos)) == found) {
+        atomic_set(&(bitmap->first_free_pos), found + n);
+    }
+    *start = found;
+    LOG_DEBUG("bitmap_alloc_range, start:%ld, n:%u", found, n);
+    return 0;
+}
+
+int bitmap_free_range(bitmap_t *bitmap, const unsigned int start, const unsigned int n)
+{
+    if (!bitmap || !n || start >= (bitmap->bytes << 3) || n > (bitmap->bytes << 3) - start) {
+        return -1;
+    }
+    unsigned int freed = bitmap_range_update(bitmap, start, n, 0);
+    atomic_sub(&(bitmap->used_bits_count), freed);
+    bitmap_lower_first_free(bitmap, start);
+    return freed == n ? 0 : -1;
+}
+
+int bitmap_set_range(bitmap_t *bitmap, const unsigned int start, const unsigned int n)
+{
+    if (!bitmap || !n || start >= (bitmap->bytes << 3) || n > (bitmap->bytes << 3) - start) {
+        return -1;
+    }
+    atomic_add(&(bitmap->used_bits_count), bitmap_range_update(bitmap, start, n, 1));
+    return 0;
+}
+
+int bitmap_clear_range(bitmap_t *bitmap, const unsigned int start, const unsigned int n)
+{
+    if (!bitmap || !n || start >= (bitmap->bytes << 3) || n > (bitmap->bytes << 3) - start) {
+        return -1;
+    }
+    atomic_sub(&(bitmap->used_bits_count), bitmap_range_update(bitmap, start, n, 0));
+    bitmap_lower_first_free(bitmap, start);
+    return 0;
+}
+
+// recount used bits from words, don't trust used_bits_count
+int bitmap_count_used(bitmap_t *bitmap)
+{
+    if (!bitmap) {
+        return -1;
+    }
+    unsigned int bits    = bitmap->bytes << 3;
+    unsigned int padding = (bitmap->words << BITMAP_WORD_SHIFT) - bits;
+    return (int)(bitmap_words_popcount(bitmap->bitmap, bitmap->words) - padding);
+}
+
+int bitmap_count_free(bitmap_t *bitmap, const unsigned int start, const unsigned int n)
+{
+    if (!bitmap || !n || start >= (bitmap->bytes << 3) || n > (bitmap->bytes << 3) - start) {
+        return -1;
+    }
+    unsigned int end   = start + n;
+    unsigned int first = BITMAP_WORD_IDX(start);
+    unsigned int last  = BITMAP_WORD_IDX(end - 1);
+    unsigned int head  = start & (BITMAP_WORD_BITS - 1);
+    if (first == last) {
+        return n - __builtin_popcountll(bitmap->bitmap[first] & bitmap_word_range_mask(head, n));
+    }
+    unsigned long used  = __builtin_popcountll(bitmap->bitmap[first] & bitmap_word_range_mask(head, BITMAP_WORD_BITS - head));
+    used               += __builtin_popcountll(bitmap->bitmap[last] & bitmap_word_range_mask(0, ((end - 1) & (BITMAP_WORD_BITS - 1)) + 1));
+    used               += bitmap_words_popcount(&(bitmap->bitmap[first + 1]), last - first - 1);
+    return (int)(n - used);
+}
+
+// words changed in bulk, rebuild padding, summary, hints and counters from words
+static void bitmap_rebuild(bitmap_t *bitmap)
+{
+    unsigned int   bits    = bitmap->bytes << 3;
+    bitmap_word_t *summary = BITMAP_SUMMARY(bitmap);
+    if (bits & (BITMAP_WORD_BITS - 1)) {
+        bitmap->bitmap[bitmap->words - 1] |= BITMAP_WORD_FULL << (bits & (BITMAP_WORD_BITS - 1));
+    }
+    memset(summary, 0, BITMAP_SUMMARY_WORDS(bitmap) * sizeof(bitmap_word_t));
+    for (unsigned int i = 0; i < bitmap->words; i++) {
+        if (bitmap->bitmap[i] != BITMAP_WORD_FULL) {
+            summary[BITMAP_WORD_IDX(i)] |= BITMAP_WORD_MASK(i);
+        }
+    }
+    for (unsigned int i = 0; i < BITMAP_SUMMARY_WORDS(bitmap); i++) {
+        BITMAP_RUN_HINT(bitmap)[i] = BITMAP_RUN_HINT_UNKNOWN;
+    }
+    atomic_set(&(bitmap->used_bits_count), bitmap_count_used(bitmap));
+    atomic_set(&(bitmap->first_free_pos), 0);
+}
+
+// dst = dst op src, both bitmaps must have same size
+int bitmap_bulk_op(bitmap_t *dst, bitmap_t *src, const int op)
+{
+    if (!dst || !src || dst->bytes != src->bytes || op < BITMAP_OP_AND || op > BITMAP_OP_ANDNOT) {
+        return -1;
+    }
+    bitmap_words_op(dst->bitmap, src->bitmap, dst->words, op);
+    bitmap_rebuild(dst);
+    return 0;
+}
+
+// atomic variant, bits are claimed by fetch_or on whole word so concurrent allocators never get same bit,
+// summary is only a hint here, word is always checked again after claiming
+#define BITMAP_ATOMIC_LOAD(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define BITMAP_ATOMIC_OR(ptr, mask)   __atomic_fetch_or(ptr, mask, __ATOMIC_SEQ_CST)
+#define BITMAP_ATOMIC_AND(ptr, mask)  __atomic_fetch_and(ptr, mask, __ATOMIC_SEQ_CST)
+
+static __thread unsigned int bitmap_thread_seed = 0;
+
+// spread threads over summary words so they don't all fight for first free word
+static inline unsigned int bitmap_atomic_start_word(bitmap_t *bitmap)
+{
+    if (!bitmap_thread_seed) {
+        unsigned long self = (unsigned long)pthread_self();
+        self               = (self ^ (self >> 33)) * 0xff51afd7ed558ccdUL;
+        bitmap_thread_seed = (unsigned int)(self ^ (self >> 33)) | 1;
+    }
+    return bitmap_thread_seed % bitmap->words;
+}
+
+static inline void bitmap_atomic_word_full(bitmap_t *bitmap, const unsigned int word_idx)
+{
+    bitmap_word_t *summary = BITMAP_SUMMARY(bitmap);
+    BITMAP_ATOMIC_AND(&summary[BITMAP_WORD_IDX(word_idx)], ~BITMAP_WORD_MASK(word_idx));
+    // someone may free bit between our claim and summary clear, don't hide that bit
+    if (BITMAP_ATOMIC_LOAD(&(bitmap->bitmap[word_idx])) != BITMAP_WORD_FULL) {
+        BITMAP_ATOMIC_OR(&summary[BITMAP_WORD_IDX(word_idx)], BITMAP_WORD_MASK(word_idx));
+    }
+}
+
+// try to claim one free bit of word, return bit pos or -1 if word filled up meanwhile
+static inline int bitmap_atomic_claim_word(bitmap_t *bitmap, const unsigned int word_idx)
+{
+    bitmap_word_t *word = &(bitmap->bitmap[word_idx]);
+    bitmap_word_t  old  = BITMAP_ATOMIC_LOAD(word);
+    while (old != BITMAP_WORD_FULL) {
+        bitmap_word_t mask = ~old & (old + 1);
+        old                = BITMAP_ATOMIC_OR(word, mask);
+        if (!(old & mask)) {
+            if ((old | mask) == BITMAP_WORD_FULL) {
+                bitmap_atomic_word_full(bitmap, word_idx);
+            }
+            __atomic_add_fetch(&(bitmap->used_bits_count.value), 1, __ATOMIC_RELAXED);
+            return (word_idx << BITMAP_WORD_SHIFT) + __builtin_ctzll(mask);
+        }
+    }
+    return -1;
+}
+
+int bitmap_atomic_alloc(bitmap_t *bitmap)
+{
+    if (!bitmap) {
+        return -1;
+    }
+    bitmap_word_t *summary   = BITMAP_SUMMARY(bitmap);
+    unsigned int   sum_count = BITMAP_SUMMARY_WORDS(bitmap);
+    unsigned int   start     = bitmap_atomic_start_word(bitmap);
+    // visit every summary word once starting from our own, first one is visited again for words before start
+    for (unsigned int i = 0; i <= sum_count; i++) {
+        unsigned int  sum_idx = (BITMAP_WORD_IDX(start) + i) % sum_count;
+        bitmap_word_t sum     = BITMAP_ATOMIC_LOAD(&summary[sum_idx]);
+        if (i == 0) {
+            sum &= BITMAP_WORD_FULL << (start & (BITMAP_WORD_BITS - 1));
+        }
+        while (sum) {
+            unsigned int word_idx = (sum_idx << BITMAP_WORD_SHIFT) + __builtin_ctzll(sum);
+            int          pos      = bitmap_atomic_claim_word(bitmap, word_idx);
+            if (pos >= 0) {
+                return pos;
+            }
+            sum &= sum - 1;
+        }
+    }
+    return -1;
+}
+
+int bitmap_atomic_free(bitmap_t *bitmap, const unsigned int pos)
+{
+    if (!bitmap || pos >= (bitmap->bytes << 3)) {
+        return -1;
+    }
+    unsigned int  word_idx = BITMAP_WORD_IDX(pos);
+    bitmap_word_t old      = BITMAP_ATOMIC_AND(&(bitmap->bitmap[word_idx]), ~BITMAP_WORD_MASK(pos));
+    if (!(old & BITMAP_WORD_MASK(pos))) {
+        return -1;
+    }
+    // word has free bit now, publish after bit is really clear
+    BITMAP_ATOMIC_OR(&(BITMAP_SUMMARY(bitmap)[BITMAP_WORD_IDX(word_idx)]), BITMAP_WORD_MASK(word_idx));
+    __atomic_store_n(&(BITMAP_RUN_HINT(bitmap)[BITMAP_WORD_IDX(word_idx)]), BITMAP_RUN_HINT_UNKNOWN, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&(bitmap->used_bits_count.value), 1, __ATOMIC_RELAXED);
+    return 0;
+}
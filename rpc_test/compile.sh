@@ -1,4 +1,8 @@
 gcc \
-test_rpcservice.c rpc_server/rpc_sever.c rpc_client/rpc_client.c rpc_daemon/rpc_service.c mem_pool/mem_pool.c hashlist/hashlist.c \
+test_rpcservice.c rpc_server/rpc_sever.c rpc_server/rpc_placement.c rpc_client/rpc_client.c rpc_daemon/rpc_service.c mem_pool/mem_pool.c hashlist/hashlist.c flathash/flathash.c rpc_ipc/rpc_ipc.c \
 -lpthread \
 -o rpcservice_test
+gcc -O2 -DLOG_LEVEL=1 \
+bench_rpcservice.c rpc_server/rpc_sever.c rpc_server/rpc_placement.c rpc_client/rpc_client.c rpc_daemon/rpc_service.c mem_pool/mem_pool.c hashlist/hashlist.c flathash/flathash.c rpc_ipc/rpc_ipc.c \
+-lpthread \
+-o rpcservice_bench
@@ -1,22 +1,62 @@
 #ifndef _BITMAP_H_
 #define _BITMAP_H_
 #include "atomic.h"
+#include <stdint.h>
 
-#define BITMAP_MAX_BYTES 256
+typedef uint64_t bitmap_word_t;
+
+#define BITMAP_WORD_BITS             64
+#define BITMAP_WORD_SHIFT            6
+#define BITMAP_WORD_FULL             (~(bitmap_word_t)0)
+#define BITMAP_WORD_COUNT(bits)      (((bits) + BITMAP_WORD_BITS - 1) >> BITMAP_WORD_SHIFT)
+// second level, bit i set means word i of bitmap still has free bit
+#define BITMAP_SUMMARY_WORD_COUNT(bits) \
+    ((BITMAP_WORD_COUNT(bits) + BITMAP_WORD_BITS - 1) >> BITMAP_WORD_SHIFT)
+// per summary word, upper bound of longest free run inside its 64 words
+typedef uint32_t bitmap_run_hint_t;
+#define BITMAP_RUN_HINT_UNKNOWN ((bitmap_run_hint_t)-1)
+#define BITMAP_RUN_HINT_WORD_COUNT(bits) \
+    ((BITMAP_SUMMARY_WORD_COUNT(bits) * sizeof(bitmap_run_hint_t) + sizeof(bitmap_word_t) - 1) / sizeof(bitmap_word_t))
+// bytes must be reserved after bitmap_t when it is embedded in other struct
+#define BITMAP_STORAGE_BYTES(bits)                                                                   \
+    ((BITMAP_WORD_COUNT(bits) + BITMAP_SUMMARY_WORD_COUNT(bits) + BITMAP_RUN_HINT_WORD_COUNT(bits)) * \
+     sizeof(bitmap_word_t))
+
+enum bitmap_bulk_op_type {
+    BITMAP_OP_AND,
+    BITMAP_OP_OR,
+    BITMAP_OP_ANDNOT,
+};
 
 typedef struct bitmap {
-    unsigned int bytes;
-    atomic_t     used_bits_count;
-    atomic_t     first_free_pos;
-    char         bitmap[0];
+    uint32_t      bytes;
+    atomic_t      used_bits_count;
+    atomic_t      first_free_pos;
+    uint32_t      words;
+    // words of bits, followed by summary words and run hints
+    bitmap_word_t bitmap[0];
 } bitmap_t;
 
 // ctrl
 bitmap_t *bitmap_create(const unsigned int bytes);
 void      bitmap_destroy(bitmap_t *bitmap);
+void      bitmap_init(bitmap_t *b, const unsigned int bytes);
 // ops
 int       bitmap_set(bitmap_t *bitmap, const unsigned int pos);
 int       bitmap_clear(bitmap_t *bitmap, const unsigned int pos);
+int       bitmap_test(bitmap_t *bitmap, const unsigned int pos);
 int       bitmap_get_first_free(bitmap_t *bitmap);
+// n consecutive bits
+int       bitmap_alloc_range(bitmap_t *bitmap, const unsigned int n, unsigned int *start);
+int       bitmap_free_range(bitmap_t *bitmap, const unsigned int start, const unsigned int n);
+// bulk, SIMD when cpu supports
+int       bitmap_set_range(bitmap_t *bitmap, const unsigned int start, const unsigned int n);
+int       bitmap_clear_range(bitmap_t *bitmap, const unsigned int start, const unsigned int n);
+int       bitmap_count_used(bitmap_t *bitmap);
+int       bitmap_count_free(bitmap_t *bitmap, const unsigned int start, const unsigned int n);
+int       bitmap_bulk_op(bitmap_t *dst, bitmap_t *src, const int op);
+// lock free ops, safe for concurrent allocators, don't mix with ops above on same bitmap
+int       bitmap_atomic_alloc(bitmap_t *bitmap);
+int       bitmap_atomic_free(bitmap_t *bitmap, const unsigned int pos);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,36 @@
+#ifndef _FLATHASH_H_
+#define _FLATHASH_H_
+
+#include "atomic.h"
+#include <stdint.h>
+
+// open addressing hash table, swiss table style:
+// each slot has one control byte, control bytes are probed in groups of 16
+#define FLATHASH_GROUP_SIZE   16
+#define FLATHASH_MIN_CAPACITY FLATHASH_GROUP_SIZE
+
+// control byte values, full slot stores low 7 bits of hash (0x00~0x7f)
+#define FLATHASH_CTRL_EMPTY   ((int8_t)0x80)
+#define FLATHASH_CTRL_DELETED ((int8_t)0xfe)
+
+typedef struct flathash_slot {
+    unsigned long key;
+    void         *val;
+} flathash_slot_t;
+
+typedef struct flathash {
+    unsigned long    capacity;
+    unsigned long    obj_count;
+    // deleted slots still break probe chain, count them for growing
+    unsigned long    tombstone_count;
+    int8_t          *ctrl;
+    flathash_slot_t *slot;
+} flathash_t;
+
+flathash_t *flathash_create(const unsigned long capacity);
+void        flathash_destroy(flathash_t *hashtable);
+int         flathash_add(unsigned long key, void *val, flathash_t *table);
+long        flathash_get(unsigned long key, flathash_t *hashtable);
+long        flathash_remove(unsigned long key, flathash_t *hashtable);
+
+#endif
@@ -6,48 +6,62 @@
 #include <pthread.h>
 
 #define LINKHASH_MAX_BUCKET_COUNT   128
-#define ENABLE_LINKHASH_BUCKET_LOCK 0
+#define ENABLE_LINKHASH_BUCKET_LOCK 1
+// writers lock stripes instead of whole table, bucket i uses stripe i % stripe count
+#define LINKHASH_LOCK_STRIPE_COUNT  16
+// readers announce themselves in one of these slots, spread to avoid sharing cache line
+#define LINKHASH_READER_SLOT_COUNT  64
+#define LINKHASH_CACHELINE_SIZE     64
+// linkhash_get_many resolves keys in groups of this size, prefetching each group first
+#define LINKHASH_GET_BATCH_SIZE     16
 
 #if ENABLE_LINKHASH_BUCKET_LOCK == 1
-#define HASH_BUCKET_LOCK_INIT(lock) atomic_set(lock, 0)
-#define HASH_BUCKET_LOCK(lock) \
-    do {                       \
-        atomic_set(lock, 0);   \
-    } while (!atomic_get(lock))
-#define HASH_BUCKET_UNLOCK(lock) atomic_set(lock, 1)
+#define HASH_BUCKET_LOCK_INIT(lock) pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE)
+#define HASH_BUCKET_LOCK(lock)      pthread_spin_lock(lock)
+#define HASH_BUCKET_UNLOCK(lock)    pthread_spin_unlock(lock)
 #else
 #define HASH_BUCKET_LOCK_INIT(lock)
 #define HASH_BUCKET_LOCK(lock)
 #define HASH_BUCKET_UNLOCK(lock)
 #endif
 
-typedef atomic_t hlist_bucket_lock_t;
+typedef pthread_spinlock_t hlist_bucket_lock_t;
+// key can be integer or pointer to user key (e.g. string) when hash and equal callbacks are given
+typedef unsigned long (*linkhash_hash_func_t)(const unsigned long key);
+typedef int (*linkhash_equal_func_t)(const unsigned long key1, const unsigned long key2);
 
+// chain is only walked forward by readers, writers publish next pointer last
 typedef struct hash_object {
     list_t        chain;
     unsigned long key;
     void         *val;
 } hash_obj_t;
 
-typedef struct hashlist_object {
-    list_t     hlist;
-    hash_obj_t obj;
-} hlist_t;
-
 typedef struct hashlist_bucket {
     atomic_t refcount;
     list_t   bucket_start;
-#if ENABLE_LINKHASH_BUCKET_LOCK == 1
-    hlist_bucket_lock_t bucket_lock;
-#endif
 } hlist_bucket_t;
 
+typedef struct hashlist_lock_stripe {
+    hlist_bucket_lock_t lock;
+} __attribute__((aligned(LINKHASH_CACHELINE_SIZE))) hlist_lock_stripe_t;
+
+// readers count in one of two phases, remover flips phase and waits old phase drained
+typedef struct hashlist_reader_slot {
+    volatile long count[2];
+} __attribute__((aligned(LINKHASH_CACHELINE_SIZE))) hlist_reader_slot_t;
+
 typedef struct linkhash {
-    unsigned long   bucket_count;
-    atomic_t        obj_count;
-    list_t          hlist_head;
-    hlist_bucket_t *bucket;
-    hlist_bucket_t  _bucket[0];
+    unsigned long          bucket_count;
+    atomic_t               obj_count;
+    linkhash_hash_func_t   hash_func;
+    linkhash_equal_func_t  equal_func;
+    volatile unsigned long reader_phase;
+    pthread_mutex_t        sync_lock;
+    hlist_lock_stripe_t    stripe[LINKHASH_LOCK_STRIPE_COUNT];
+    hlist_reader_slot_t    reader[LINKHASH_READER_SLOT_COUNT];
+    hlist_bucket_t        *bucket;
+    hlist_bucket_t         _bucket[0];
 } linkhash_t;
 
 static inline unsigned int hash_32bkey(const unsigned int key)
@@ -62,10 +76,36 @@ static inline unsigned int hash_32bkey(const unsigned int key)
     return hash_key;
 }
 
+// murmur3 finalizer, every bit of 64-bit key affects low bits used as bucket id
+static inline unsigned long hash_64bkey(const unsigned long key)
+{
+    unsigned long hash_key = key;
+    hash_key               = hash_key ^ (hash_key >> 33);
+    hash_key               = hash_key * 0xff51afd7ed558ccdUL;
+    hash_key               = hash_key ^ (hash_key >> 33);
+    hash_key               = hash_key * 0xc4ceb9fe1a85ec53UL;
+    hash_key               = hash_key ^ (hash_key >> 33);
+    return hash_key;
+}
+
+// FNV-1a over string then mixed, key is (unsigned long)(const char *)
+static inline unsigned long hash_strkey(const unsigned long key)
+{
+    unsigned long hash_key = 0xcbf29ce484222325UL;
+    for (const unsigned char *str = (const unsigned char *)key; *str; str++) {
+        hash_key = (hash_key ^ *str) * 0x100000001b3UL;
+    }
+    return hash_64bkey(hash_key);
+}
+
+int         linkhash_str_equal(const unsigned long key1, const unsigned long key2);
+
 linkhash_t *linkhash_create(const unsigned long bucket_count);
+linkhash_t *linkhash_create_custom(const unsigned long bucket_count, linkhash_hash_func_t hash_func, linkhash_equal_func_t equal_func);
 void        linkhash_destroy(linkhash_t *hashtable);
 int         linkhash_add(unsigned long key, void *val, linkhash_t *table);
 long        linkhash_get(unsigned long key, linkhash_t *hashtable);
+int         linkhash_get_many(const unsigned long *keys, const unsigned long n, long *vals, linkhash_t *hashtable);
 long        linkhash_remove(unsigned long key, linkhash_t *hashtable);
 
 #endif
\ No newline at end of file
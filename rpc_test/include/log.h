@@ -7,7 +7,10 @@
 #define LOG_LEVEL_DEBUG   2
 #define LOG_LEVEL_INFO    3
 
+// build may set its own, e.g. -DLOG_LEVEL=1 keeps only errors
+#ifndef LOG_LEVEL
 #define LOG_LEVEL         (LOG_LEVEL_DEBUG + 1)
+#endif
 
 #if LOG_LEVEL > LOG_LEVEL_ERROR
 #define LOG_ERROR(fmt, ...) printf("[%s:%d] " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__)
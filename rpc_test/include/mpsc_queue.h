@@ -0,0 +1,76 @@
+// intrusive lock free multi producer single consumer queue, Vyukov style
+#ifndef ____MPSC_QUEUE_H__
+#define ____MPSC_QUEUE_H__
+#include <stddef.h>
+
+typedef struct mpsc_node {
+    struct mpsc_node *next;
+} mpsc_node_t;
+
+typedef struct mpsc_queue {
+    // producers swap themselves into head, consumer pops from tail
+    mpsc_node_t *head;
+    mpsc_node_t *tail;
+    mpsc_node_t  stub;
+} mpsc_queue_t;
+
+static inline void mpsc_queue_init(mpsc_queue_t *queue)
+{
+    queue->stub.next = NULL;
+    queue->head      = &(queue->stub);
+    queue->tail      = &(queue->stub);
+}
+
+// push nodes already linked from first to last with one xchg,
+// safe for any number of producers, wait free
+static inline void mpsc_queue_push_chain(mpsc_queue_t *queue, mpsc_node_t *first, mpsc_node_t *last)
+{
+    __atomic_store_n(&(last->next), NULL, __ATOMIC_RELAXED);
+    mpsc_node_t *prev = __atomic_exchange_n(&(queue->head), last, __ATOMIC_SEQ_CST);
+    // between xchg and this store, nodes are not reachable from tail yet
+    __atomic_store_n(&(prev->next), first, __ATOMIC_RELEASE);
+}
+
+static inline void mpsc_queue_push(mpsc_queue_t *queue, mpsc_node_t *node)
+{
+    mpsc_queue_push_chain(queue, node, node);
+}
+
+// consumer only, return NULL if queue empty or producer still linking its node
+static inline mpsc_node_t *mpsc_queue_pop(mpsc_queue_t *queue)
+{
+    mpsc_node_t *tail = queue->tail;
+    mpsc_node_t *next = __atomic_load_n(&(tail->next), __ATOMIC_ACQUIRE);
+    if (tail == &(queue->stub)) {
+        if (!next) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail        = next;
+        next        = __atomic_load_n(&(next->next), __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    // tail is last node, push stub behind it so tail can be detached
+    mpsc_queue_push(queue, &(queue->stub));
+    next = __atomic_load_n(&(tail->next), __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// consumer only, pop returning NULL on non empty queue means producer is mid push
+static inline int mpsc_queue_empty(mpsc_queue_t *queue)
+{
+    return queue->tail == &(queue->stub) &&
+           __atomic_load_n(&(queue->head), __ATOMIC_SEQ_CST) == &(queue->stub);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef _RPC_FRAME_H_
+#define _RPC_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// framing inside one client shm block: header, then args written in place by client,
+// then results written in place by handler, nothing is copied on the way.
+// in-process block is PAGE_SIZE unless rpc_service_set_shm_block_size picked another size
+// (up to MAX_RPC_SHM_BLOCK_SIZE), client learns size from get service response,
+// ipc block is RPC_IPC_DATA_SIZE
+#define RPC_FRAME_MAGIC       0x52464d31
+#define RPC_FRAME_ALIGN       8
+#define RPC_FRAME_ALIGN_UP(n) (((n) + RPC_FRAME_ALIGN - 1) & ~(size_t)(RPC_FRAME_ALIGN - 1))
+
+enum rpc_frame_flag {
+    // handler filled result area
+    RPC_FRAME_HAS_RESULT = 1 << 0,
+};
+
+typedef struct rpc_frame {
+    uint32_t magic;
+    uint32_t method;
+    uint32_t flags;
+    int32_t  status;
+    // bytes usable after header, arg area starts at data[0]
+    uint32_t capacity;
+    uint32_t arg_len;
+    // result area starts at data[result_offset], right after args
+    uint32_t result_offset;
+    uint32_t result_len;
+    uint8_t  data[0];
+} rpc_frame_t;
+
+// read position in arg area, or in result area on client side,
+// handler side also keeps own copy of bounds checked by rpc_frame_get,
+// peer can still write header after check, so it is never read again
+typedef struct rpc_frame_cursor {
+    uint32_t offset;
+    uint32_t capacity;
+    uint32_t arg_len;
+    uint32_t result_offset;
+    uint32_t result_len;
+} rpc_frame_cursor_t;
+
+// client, start new request frame at head of shm block
+static inline rpc_frame_t *rpc_frame_init(void *shm, const size_t shm_size, const uint32_t method)
+{
+    if (!shm || shm_size <= sizeof(rpc_frame_t)) {
+        return NULL;
+    }
+    rpc_frame_t *frame   = (rpc_frame_t *)shm;
+    frame->magic         = RPC_FRAME_MAGIC;
+    frame->method        = method;
+    frame->flags         = 0;
+    frame->status        = 0;
+    frame->capacity      = shm_size - sizeof(rpc_frame_t);
+    frame->arg_len       = 0;
+    frame->result_offset = 0;
+    frame->result_len    = 0;
+    return frame;
+}
+
+// handler, frame lives in memory peer can write, header is read once into cursor
+// and checked against real shm size there, later accesses are bound by cursor only
+static inline rpc_frame_t *rpc_frame_get(void *shm, const size_t shm_size, rpc_frame_cursor_t *cursor)
+{
+    volatile rpc_frame_t *frame = (volatile rpc_frame_t *)shm;
+    if (!shm || shm_size <= sizeof(rpc_frame_t) || frame->magic != RPC_FRAME_MAGIC) {
+        return NULL;
+    }
+    uint32_t capacity = frame->capacity;
+    uint32_t arg_len  = frame->arg_len;
+    if (capacity > shm_size - sizeof(rpc_frame_t) || arg_len > capacity) {
+        return NULL;
+    }
+    cursor->offset        = 0;
+    cursor->capacity      = capacity;
+    cursor->arg_len       = arg_len;
+    // result area is decided here, client can't move it
+    cursor->result_offset = RPC_FRAME_ALIGN_UP(arg_len);
+    cursor->result_len    = 0;
+    frame->result_offset  = cursor->result_offset;
+    frame->result_len     = 0;
+    return (rpc_frame_t *)shm;
+}
+
+// client, reserve next len bytes of arg area and return them for writing in place
+static inline void *rpc_frame_arg_reserve(rpc_frame_t *frame, const size_t len)
+{
+    size_t offset = RPC_FRAME_ALIGN_UP(frame->arg_len);
+    if (offset > frame->capacity || len > frame->capacity - offset) {
+        return NULL;
+    }
+    frame->arg_len = offset + len;
+    return frame->data + offset;
+}
+
+// handler, return next len bytes of arg area, NULL if client wrote less
+static inline void *rpc_frame_arg_next(rpc_frame_t *frame, rpc_frame_cursor_t *cursor, const size_t len)
+{
+    size_t offset = RPC_FRAME_ALIGN_UP((size_t)cursor->offset);
+    if (offset > cursor->arg_len || len > cursor->arg_len - offset) {
+        return NULL;
+    }
+    cursor->offset = offset + len;
+    return frame->data + offset;
+}
+
+// handler, reserve next len bytes of result area for writing in place
+static inline void *rpc_frame_result_reserve(rpc_frame_t *frame, rpc_frame_cursor_t *cursor, const size_t len)
+{
+    size_t offset = (size_t)cursor->result_offset + RPC_FRAME_ALIGN_UP((size_t)cursor->result_len);
+    if (offset > cursor->capacity || len > cursor->capacity - offset) {
+        return NULL;
+    }
+    cursor->result_len  = offset + len - cursor->result_offset;
+    frame->result_len   = cursor->result_len;
+    frame->flags       |= RPC_FRAME_HAS_RESULT;
+    return frame->data + offset;
+}
+
+// client, return next len bytes of result area
+static inline void *rpc_frame_result_next(rpc_frame_t *frame, rpc_frame_cursor_t *cursor, const size_t len)
+{
+    size_t offset = RPC_FRAME_ALIGN_UP(cursor->offset);
+    if (!(frame->flags & RPC_FRAME_HAS_RESULT) || offset > frame->result_len || len > frame->result_len - offset) {
+        return NULL;
+    }
+    cursor->offset = offset + len;
+    return frame->data + frame->result_offset + offset;
+}
+
+// typed accessors, e.g. *RPC_FRAME_ARG_PUT(frame, uint64_t) = val
+#define RPC_FRAME_ARG_PUT(frame, type)            ((type *)rpc_frame_arg_reserve(frame, sizeof(type)))
+#define RPC_FRAME_ARG_GET(frame, cursor, type)    ((type *)rpc_frame_arg_next(frame, cursor, sizeof(type)))
+#define RPC_FRAME_RESULT_PUT(frame, cursor, type) ((type *)rpc_frame_result_reserve(frame, cursor, sizeof(type)))
+#define RPC_FRAME_RESULT_GET(frame, cursor, type) ((type *)rpc_frame_result_next(frame, cursor, sizeof(type)))
+
+#endif
@@ -0,0 +1,72 @@
+// spin then block handoff between rpc client and server
+#ifndef ____RPC_HANDOFF_H__
+#define ____RPC_HANDOFF_H__
+#include <time.h>
+#include <unistd.h>
+
+// never spin longer than a few wakeups cost
+#define RPC_HANDOFF_MAX_SPIN_NS   20000UL
+// check clock once per this many polls
+#define RPC_HANDOFF_POLL_BATCH    64
+// ewma weight of new sample is 1 / (1 << shift)
+#define RPC_HANDOFF_EWMA_SHIFT    3
+// ewma before first sample, so first waits spin a while instead of blocking at once
+#define RPC_HANDOFF_SEED_NS       (RPC_HANDOFF_MAX_SPIN_NS / 4)
+
+static inline unsigned long rpc_handoff_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline void rpc_handoff_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void rpc_handoff_update(unsigned long *ewma_ns, const unsigned long sample_ns)
+{
+    long diff  = (long)sample_ns - (long)*ewma_ns;
+    *ewma_ns  += diff / (1 << RPC_HANDOFF_EWMA_SHIFT);
+}
+
+// spin about twice the usual wait, don't spin at all if waits are usually longer than max,
+// or if there is only one cpu, the other side can't run while we spin
+static inline unsigned long rpc_handoff_budget(const unsigned long ewma_ns)
+{
+    static long cpu_count = 0;
+    if (!cpu_count) {
+        cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (cpu_count <= 1 || ewma_ns > RPC_HANDOFF_MAX_SPIN_NS) {
+        return 0;
+    }
+    return ewma_ns * 2 > RPC_HANDOFF_MAX_SPIN_NS ? RPC_HANDOFF_MAX_SPIN_NS : ewma_ns * 2;
+}
+
+// poll flag until it is non zero or budget runs out, return 1 if flag set
+static inline int rpc_handoff_spin(int *flag, const unsigned long budget_ns)
+{
+    if (!budget_ns) {
+        return __atomic_load_n(flag, __ATOMIC_ACQUIRE) != 0;
+    }
+    unsigned long deadline = rpc_handoff_now_ns() + budget_ns;
+    while (1) {
+        for (int i = 0; i < RPC_HANDOFF_POLL_BATCH; i++) {
+            if (__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+                return 1;
+            }
+            rpc_handoff_cpu_relax();
+        }
+        if (rpc_handoff_now_ns() >= deadline) {
+            return __atomic_load_n(flag, __ATOMIC_ACQUIRE) != 0;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _RPC_IPC_H_
+#define _RPC_IPC_H_
+
+#include "rpc_service.h"
+#include <stdint.h>
+
+// cross process transport, each client gets one memfd mapping passed over unix socket,
+// holding request/response rings and shm data area, wakeups by futex on ring head
+#define RPC_IPC_MAGIC          0x52504349
+#define RPC_IPC_RING_SIZE      64
+#define RPC_IPC_DATA_OFFSET    PAGE_SIZE
+#define RPC_IPC_DATA_SIZE      (32 * PAGE_SIZE)
+#define RPC_IPC_MAP_SIZE       (RPC_IPC_DATA_OFFSET + RPC_IPC_DATA_SIZE)
+#define RPC_IPC_BACKLOG        16
+// how often server checks whether a silent client is gone
+#define RPC_IPC_IDLE_CHECK_MS  100
+
+typedef struct rpc_ipc_entry {
+    uint32_t req_type;
+    uint32_t seq;
+    // method id for CLIENT_CALL_METHOD
+    uint32_t method;
+    // response only, low 32 bits of server clock when answered, client gets its wait
+    // by unsigned difference with its own submit stamp, both are CLOCK_MONOTONIC
+    uint32_t complete_ns;
+    uint64_t param;
+} rpc_ipc_entry_t;
+
+// single producer single consumer, head and tail only grow
+typedef struct rpc_ipc_ring {
+    uint32_t        head;
+    // consumer sets it before sleeping on head, producer wakes only when set
+    uint32_t        waiting;
+    uint32_t        tail;
+    uint32_t        reserved;
+    rpc_ipc_entry_t entry[RPC_IPC_RING_SIZE];
+} rpc_ipc_ring_t;
+
+typedef struct rpc_ipc_shm {
+    uint32_t       magic;
+    uint32_t       data_size;
+    rpc_ipc_ring_t req_ring;
+    rpc_ipc_ring_t rsp_ring;
+} rpc_ipc_shm_t;
+
+typedef struct rpc_ipc_client {
+    int            sock;
+    uint32_t       seq;
+    rpc_ipc_shm_t *shm;
+    // ewma of submit to server answer time, feeds spin budget
+    unsigned long  service_ns;
+} rpc_ipc_client_t;
+
+// for server, serve clients of started service on sock_path
+int               rpc_ipc_server_start(const cptr_t service_cap, const char *sock_path);
+// for client, one thread per rpc_ipc_client_t
+rpc_ipc_client_t *rpc_ipc_client_connect(const char *sock_path);
+void              rpc_ipc_client_close(rpc_ipc_client_t *client);
+void             *rpc_ipc_client_shm(rpc_ipc_client_t *client);
+// return value handler returned, 0 for request without response, -1UL if server is gone
+unsigned long     rpc_ipc_client_request(rpc_ipc_client_t *client, const unsigned int service_type, const unsigned long param);
+// client can't see method table of server process, so every method call is answered,
+// return value handler returned, -1UL if method not registered or server is gone
+unsigned long     rpc_ipc_client_call_method(rpc_ipc_client_t *client, const unsigned int method, const unsigned long param);
+
+#endif
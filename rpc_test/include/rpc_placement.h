@@ -0,0 +1,40 @@
+// where rpc server workers and main client run
+#ifndef ____RPC_PLACEMENT_H__
+#define ____RPC_PLACEMENT_H__
+#include <pthread.h>
+
+#define MAX_RPC_PLACEMENT_CPU_COUNT 64
+// client_cpu value meaning cpu of thread starting service
+#define RPC_PLACEMENT_CURRENT_CPU   -1
+
+enum rpc_placement_policy {
+    // threads float, scheduler decides
+    RPC_PLACE_FLOAT,
+    // worker i pinned to cpu[i % cpu_count]
+    RPC_PLACE_CPUS,
+    // workers pinned to hyperthread siblings of client_cpu, so handoff stays in one core,
+    // same llc if core has no sibling
+    RPC_PLACE_SMT_SIBLING,
+    // workers spread over other cpus sharing last level cache with client_cpu
+    RPC_PLACE_SAME_LLC,
+};
+
+typedef struct rpc_placement {
+    unsigned int policy;
+    // cpu main client runs on, rpc_client_migrate moves caller there
+    int          client_cpu;
+    unsigned int cpu_count;
+    int          cpu[MAX_RPC_PLACEMENT_CPU_COUNT];
+} rpc_placement_t;
+
+// fill worker_cpu[i] for each worker, -1 if worker floats, resolve client_cpu in place,
+// return count of pinned workers
+int rpc_placement_resolve(rpc_placement_t *placement, int *worker_cpu, const unsigned int worker_count);
+// pin thread created with attr to cpu, nothing if cpu < 0
+int rpc_placement_attr_set(pthread_attr_t *attr, const int cpu);
+// pin calling thread to cpu
+int rpc_placement_pin_self(const int cpu);
+// cpu calling thread runs on now
+int rpc_placement_current_cpu(void);
+
+#endif
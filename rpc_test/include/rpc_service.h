@@ -1,11 +1,18 @@
 #ifndef _RPC_SERVICE_H_
-#define _RPC_SERVER_H_
+#define _RPC_SERVICE_H_
 
+#include "flathash.h"
 #include "hashlist.h"
 #include "log.h"
 #include "mem_pool.h"
+#include "mpsc_queue.h"
+#include "rpc_frame.h"
+#include "rpc_handoff.h"
+#include "rpc_placement.h"
+#include "rpc_trace.h"
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
 
 #define RPC_SERVICE_MALLOC(size)     malloc(size)
 #define RPC_SERVICE_FREE(ptr)        free(ptr)
@@ -13,11 +20,21 @@
 #define MAX_RPC_SERVICE_BUCKET_COUNT 128
 #define MAX_RPC_SHM_BLOCK_COUNT      256
 #define MAX_RPC_PARAMS_COUNT         2
+#define MAX_RPC_SERVICE_WORKER_COUNT 64
+#define MAX_RPC_BATCH_COUNT          64
+// requests a worker takes from queue at once
+#define RPC_SERVICE_DRAIN_COUNT      16
+// method ids of one service, dispatch table is indexed by id directly
+#define MAX_RPC_METHOD_COUNT         4096
 
 #define PAGE_SIZE                    4096
+// shm block each in-process client gets, PAGE_SIZE unless service sets its own
+#define MAX_RPC_SHM_BLOCK_SIZE       (256 * PAGE_SIZE)
 
 typedef pthread_t rpc_server_thread_t;
 typedef unsigned long cptr_t;
+// handle of request in flight, 0 is invalid
+typedef unsigned long rpc_token_t;
 typedef void* (*rpc_srv_handler_t)(const void* arg);
 
 // for service control
@@ -35,35 +52,158 @@ enum rpc_client_req_type {
     // ctrl type
     CLIENT_GET_SERVICE = RPC_CLIENT_REQ_TYPE_COUNT,
     CLIENT_STOP_SERVICE,
+    // call method registered on service, method id in rpc_params.method
+    CLIENT_CALL_METHOD,
     // count
     RPC_CLIENT_REQ_TOTAL_TYPE_COUNT,
     RPC_CLIENT_CTRL_TYPE_COUNT = RPC_CLIENT_REQ_TOTAL_TYPE_COUNT - RPC_CLIENT_REQ_TYPE_COUNT,
 };
 
+// flags for rpc_service_start_pool
+enum rpc_service_pool_flag {
+    // each worker owns one request queue, client always routed to same worker,
+    // so per client shm state and request order stay on one worker
+    RPC_SERVICE_CLIENT_AFFINITY = 1 << 0,
+    // waiting side spins for a while before sleeping on semaphore,
+    // spin budget follows recently observed service and idle times
+    RPC_SERVICE_ADAPTIVE_SPIN   = 1 << 1,
+    // stamp requests at submit, dequeue, handler start and end, and client wakeup,
+    // stage durations go to histograms of service and of each called method
+    RPC_SERVICE_TRACE           = 1 << 2,
+};
+
 typedef struct rpc_service_handlers {
     rpc_srv_handler_t handlers[RPC_CLIENT_REQ_TYPE_COUNT];
 } rpc_service_handlers_t;
 
+// flags for rpc_service_register_method, decide how worker schedules each call
+enum rpc_method_flag {
+    // client waits until handler returns and gets its return value,
+    // otherwise client is released when worker dequeues call
+    RPC_METHOD_NEED_RSP   = 1 << 0,
+    // response may wait until rest of drained batch is handled,
+    // otherwise client is woken right after its handler
+    RPC_METHOD_BATCH      = 1 << 1,
+    // handler may run on several workers at once, otherwise calls are serialized
+    RPC_METHOD_CONCURRENT = 1 << 2,
+};
+
+typedef struct rpc_method {
+    rpc_srv_handler_t handler;
+    unsigned int      flags;
+    // serialize handler when RPC_METHOD_CONCURRENT not set
+    pthread_mutex_t   lock;
+    // allocated at first traced call
+    rpc_trace_t      *trace;
+} rpc_method_t;
+
+// session handle is generation << 32 | slot index, 0 is invalid
+#define RPC_SESSION_MAKE(gen, idx) (((unsigned long)(gen) << 32) | (idx))
+#define RPC_SESSION_GEN(session)   ((uint32_t)((session) >> 32))
+#define RPC_SESSION_INDEX(session) ((uint32_t)(session))
+
+// per client state opened at get service, generation changes on open and close
+typedef struct rpc_session_slot {
+    uint32_t         generation;
+    cptr_t           client_id;
+    mempool_block_t *shm;
+    // requests holding shm, taken at dequeue, dropped after handler
+    uint32_t         inflight;
+    // closed while held, last holder frees shm and slot
+    uint32_t         closing;
+} rpc_session_slot_t;
+
+struct rpc_service;
+
+// request queue and client shm state, shared by workers of this shard
+typedef struct rpc_service_shard {
+    mpsc_queue_t        req_queue;
+    // workers sleeping on server_sem, clients post only when it is not 0
+    int                 sleepers;
+    sem_t               server_sem;
+    // ewma of time workers wait for next request
+    unsigned long       idle_ns;
+    // serialize consumers when more than one worker serves shard
+    pthread_spinlock_t  lock;
+    // guard shm pool, hash and session open/close when more than one worker serves shard
+    pthread_mutex_t     shm_lock;
+    mempool_t          *shm_pool;
+    // client_id to session slot, only used when client has no valid session
+    flathash_t         *shm_hash;
+    rpc_session_slot_t *session;
+    uint32_t           *session_free;
+    uint32_t            session_count;
+    uint32_t            session_free_count;
+    struct rpc_service *service;
+} rpc_service_shard_t;
+
+typedef struct rpc_service_worker_stat {
+    // cpu worker is pinned to, -1 if it floats
+    int           pinned_cpu;
+    // cpu worker last got requests on, and how often that changed
+    int           last_cpu;
+    unsigned long migrations;
+    unsigned long requests;
+} rpc_service_worker_stat_t;
+
+typedef struct rpc_service_worker {
+    rpc_server_thread_t       thread;
+    rpc_service_shard_t      *shard;
+    rpc_service_worker_stat_t stat;
+} rpc_service_worker_t;
+
+typedef struct rpc_service_stat {
+    rpc_placement_t           placement;
+    unsigned int              shard_count;
+    unsigned int              worker_count;
+    rpc_service_worker_stat_t worker[MAX_RPC_SERVICE_WORKER_COUNT];
+} rpc_service_stat_t;
+
 typedef struct rpc_service {
     cptr_t                 server_id;
-    sem_t                  server_sem;
-    list_t                 req_list;
-    list_t                 rsp_list;
-    pthread_spinlock_t     lock;
+    unsigned int           shard_count;
+    unsigned int           worker_count;
+    unsigned int           flags;
+    // where workers run, client_cpu resolved when service starts
+    rpc_placement_t        placement;
+    // bytes of shm block of each client session, multiple of PAGE_SIZE
+    unsigned long          shm_block_size;
+    rpc_service_shard_t   *shard;
+    rpc_service_worker_t  *worker;
     rpc_service_handlers_t srv_handlers;
+    // MAX_RPC_METHOD_COUNT entries, allocated by first method registered
+    rpc_method_t          *method;
+    // NULL unless started with RPC_SERVICE_TRACE
+    rpc_trace_t           *trace;
 } rpc_service_t;
 
 typedef struct rpc_service_params {
     cptr_t        client_id;
     unsigned long req_type;
     void         *rpc_shm_vaddr;
+    // set by server for handlers, bound for rpc_frame_get
+    unsigned long rpc_shm_size;
+    // handle server returned at get service, resolves client state without hashing
+    unsigned long session;
+    // method id for CLIENT_CALL_METHOD
+    unsigned long method;
     unsigned long param;
 } rpc_srv_params_t;
 
 typedef struct rpc_client {
-    list_t           service_hook;
+    mpsc_node_t      service_hook;
     cptr_t           service_cap;
+    // set by server when request done, client sleeps on client_sem only if rsp_waiting set
+    int              rsp_done;
+    int              rsp_waiting;
     sem_t            client_sem;
+    // semaphore server posts, client_sem or one shared by rpc_client_wait_any
+    sem_t           *wake_sem;
+    // ewma of submit to completion time, and start of request in flight
+    unsigned long    service_ns;
+    unsigned long    submit_ns;
+    // when worker completed request, only stamped when service spins adaptively or traces
+    unsigned long    complete_ns;
     rpc_srv_params_t rpc_params;
 } rpc_client_t;
 
@@ -71,10 +211,44 @@ void         *rpc_get_capobj_bycptr(const cptr_t service_cap);
 // for server
 cptr_t        rpc_service_register(const unsigned long service_id, const cptr_t server_id);
 void          rpc_service_unregister(const unsigned long service_id);
+// register or replace handler of method id, may be called before or after service starts
+int           rpc_service_register_method(const cptr_t service_cap, const unsigned int method, rpc_srv_handler_t handler, const unsigned int flags);
 cptr_t        rpc_service_start(const cptr_t service_cap, rpc_service_handlers_t *service_handlers);
+cptr_t        rpc_service_start_pool(const cptr_t service_cap, rpc_service_handlers_t *service_handlers,
+                                     const unsigned int worker_count, const unsigned int flags);
+// set before service starts, workers float by default
+int           rpc_service_set_placement(const cptr_t service_cap, const rpc_placement_t *placement);
+// set before service starts, size rounds up to PAGE_SIZE, at most MAX_RPC_SHM_BLOCK_SIZE
+int           rpc_service_set_shm_block_size(const cptr_t service_cap, const unsigned long size);
+int           rpc_service_get_stat(const cptr_t service_cap, rpc_service_stat_t *stat);
+// csv rows of stage histograms of service and its methods, header first
+int           rpc_service_trace_dump(const cptr_t service_cap, FILE *out);
+void          rpc_service_trace_reset(const cptr_t service_cap);
+// route client to its shard, NULL if service not started
+rpc_service_shard_t *rpc_service_get_shard(rpc_service_t *service, const cptr_t client_id);
+void                 rpc_service_notify(rpc_service_shard_t *shard);
+void                 rpc_service_complete(rpc_client_t *client);
+// trace of method, allocated on first use, NULL if service doesn't trace
+rpc_trace_t         *rpc_service_method_trace(rpc_service_t *service, rpc_method_t *method);
+// registered method of id, NULL if none
+rpc_method_t        *rpc_service_get_method(rpc_service_t *service, const unsigned long method);
+// run method handler under its scheduling flags, return what handler returned
+void                *rpc_service_call_method(rpc_method_t *method, rpc_srv_params_t *params);
 // for client
 rpc_client_t *rpc_client_get_service(const unsigned long service_id);
 void         *rpc_client_request_service(rpc_client_t *rpc_client, const unsigned int service_type);
+// async, each rpc_client_t holds one request in flight, get more contexts for more
+rpc_token_t   rpc_client_submit(rpc_client_t *rpc_client, const unsigned int service_type);
+// return 1 if done, 0 if still in flight
+int           rpc_client_poll(const rpc_token_t token);
+// block until one of tokens done, return its index
+long          rpc_client_wait_any(const rpc_token_t *tokens, const unsigned int count);
+// call method with param, return what handler returned if method has response, 0 if not, -1UL on failure
+unsigned long rpc_client_call_method(rpc_client_t *rpc_client, const unsigned int method, const unsigned long param);
+// queue requests of contexts of one service with one wakeup per shard, wait until all done
+int           rpc_client_request_batch(rpc_client_t **rpc_clients, const unsigned int *service_types, const unsigned int count);
+// pin calling thread to client cpu of service placement, nothing if workers float
+int           rpc_client_migrate(rpc_client_t *rpc_client);
 void          rpc_client_stop_service(const unsigned long service_id);
 cptr_t        rpc_client_security_check(const unsigned long service_id);
 
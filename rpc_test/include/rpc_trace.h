@@ -0,0 +1,131 @@
+// per request stage durations in log linear histograms, hdr style, lock free
+#ifndef ____RPC_TRACE_H__
+#define ____RPC_TRACE_H__
+#include <stdio.h>
+
+// each power of two range is split in 1 << SUB_BITS buckets, about 6% precision
+#define RPC_TRACE_SUB_BITS     4
+#define RPC_TRACE_SUB_COUNT    (1 << RPC_TRACE_SUB_BITS)
+// values up to 2^40 ns, about 18 minutes, larger go to last bucket
+#define RPC_TRACE_MAX_BITS     40
+#define RPC_TRACE_BUCKET_COUNT ((RPC_TRACE_MAX_BITS - RPC_TRACE_SUB_BITS + 1) * RPC_TRACE_SUB_COUNT)
+
+enum rpc_trace_stage {
+    // submit to worker dequeue
+    RPC_TRACE_QUEUE,
+    // dequeue to handler start, time behind other requests of drained batch
+    RPC_TRACE_DISPATCH,
+    // handler start to end
+    RPC_TRACE_HANDLER,
+    // worker completes request to client sees it
+    RPC_TRACE_WAKEUP,
+    // submit to client sees completion
+    RPC_TRACE_TOTAL,
+    RPC_TRACE_STAGE_COUNT,
+};
+
+typedef struct rpc_trace_hist {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+    unsigned long bucket[RPC_TRACE_BUCKET_COUNT];
+} rpc_trace_hist_t;
+
+typedef struct rpc_trace {
+    rpc_trace_hist_t stage[RPC_TRACE_STAGE_COUNT];
+} rpc_trace_t;
+
+// timestamps worker takes for one request
+typedef struct rpc_trace_stamp {
+    unsigned long submit;
+    unsigned long dequeue;
+    unsigned long start;
+    unsigned long end;
+} rpc_trace_stamp_t;
+
+static inline unsigned int rpc_trace_bucket(const unsigned long value)
+{
+    if (value < 2 * RPC_TRACE_SUB_COUNT) {
+        return value;
+    }
+    unsigned int bits = 63 - __builtin_clzl(value);
+    if (bits >= RPC_TRACE_MAX_BITS) {
+        return RPC_TRACE_BUCKET_COUNT - 1;
+    }
+    unsigned int shift = bits - RPC_TRACE_SUB_BITS;
+    return shift * RPC_TRACE_SUB_COUNT + (value >> shift);
+}
+
+// lowest value falling in bucket
+static inline unsigned long rpc_trace_bucket_value(const unsigned int bucket)
+{
+    if (bucket < 2 * RPC_TRACE_SUB_COUNT) {
+        return bucket;
+    }
+    unsigned int shift = bucket / RPC_TRACE_SUB_COUNT - 1;
+    return (unsigned long)(bucket % RPC_TRACE_SUB_COUNT + RPC_TRACE_SUB_COUNT) << shift;
+}
+
+static inline void rpc_trace_hist_record(rpc_trace_hist_t *hist, const unsigned long value)
+{
+    __atomic_fetch_add(&(hist->bucket[rpc_trace_bucket(value)]), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->sum), value, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&(hist->max), __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&(hist->max), &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static inline void rpc_trace_record(rpc_trace_t *trace, const unsigned int stage, const unsigned long start, const unsigned long end)
+{
+    if (trace && start && end >= start) {
+        rpc_trace_hist_record(&(trace->stage[stage]), end - start);
+    }
+}
+
+// value below which fraction p of samples fall, p in [0, 1]
+static inline unsigned long rpc_trace_hist_percentile(const rpc_trace_hist_t *hist, const double p)
+{
+    unsigned long count = __atomic_load_n(&(hist->count), __ATOMIC_RELAXED);
+    unsigned long want  = (unsigned long)(p * count + 0.5);
+    unsigned long seen  = 0;
+    for (unsigned int i = 0; i < RPC_TRACE_BUCKET_COUNT; i++) {
+        seen += __atomic_load_n(&(hist->bucket[i]), __ATOMIC_RELAXED);
+        if (seen && seen >= want) {
+            return rpc_trace_bucket_value(i);
+        }
+    }
+    return __atomic_load_n(&(hist->max), __ATOMIC_RELAXED);
+}
+
+// records racing with reset may survive it, counters stay consistent enough for monitoring
+static inline void rpc_trace_reset(rpc_trace_t *trace)
+{
+    for (unsigned int stage = 0; stage < RPC_TRACE_STAGE_COUNT; stage++) {
+        rpc_trace_hist_t *hist = &(trace->stage[stage]);
+        for (unsigned int i = 0; i < RPC_TRACE_BUCKET_COUNT; i++) {
+            __atomic_store_n(&(hist->bucket[i]), 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&(hist->count), 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&(hist->sum), 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&(hist->max), 0, __ATOMIC_RELAXED);
+    }
+}
+
+// one csv row per stage with samples, name tells service or method
+static inline void rpc_trace_dump(const rpc_trace_t *trace, const char *name, FILE *out)
+{
+    static const char *stage_name[RPC_TRACE_STAGE_COUNT] = {"queue", "dispatch", "handler", "wakeup", "total"};
+    for (unsigned int stage = 0; stage < RPC_TRACE_STAGE_COUNT; stage++) {
+        const rpc_trace_hist_t *hist  = &(trace->stage[stage]);
+        unsigned long           count = __atomic_load_n(&(hist->count), __ATOMIC_RELAXED);
+        if (!count) {
+            continue;
+        }
+        fprintf(out, "%s,%s,%lu,%lu,%lu,%lu,%lu,%lu\n", name, stage_name[stage], count, __atomic_load_n(&(hist->sum), __ATOMIC_RELAXED) / count,
+                rpc_trace_hist_percentile(hist, 0.5), rpc_trace_hist_percentile(hist, 0.9), rpc_trace_hist_percentile(hist, 0.99),
+                __atomic_load_n(&(hist->max), __ATOMIC_RELAXED));
+    }
+}
+
+#endif
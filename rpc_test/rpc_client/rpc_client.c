@@ -11,14 +11,24 @@ static unsigned long gettid()
     return syscall(SYS_gettid);
 }
 
+// every context of one thread gets its own client_id, so each has its own shm block,
+// low 32 bits stay tid
+static __thread unsigned long rpc_client_seq = 0;
+
 static inline void *rpc_client_init(const cptr_t service_cap)
 {
     rpc_client_t *rpc_client = (rpc_client_t *)RPC_SERVICE_MALLOC(sizeof(rpc_client_t));
     if (rpc_client) {
-        INIT_LIST_HEAD(&(rpc_client->service_hook));
+        rpc_client->service_hook.next = NULL;
+        rpc_client->rsp_done          = 1;
+        rpc_client->rsp_waiting       = 0;
+        rpc_client->wake_sem          = &(rpc_client->client_sem);
+        rpc_client->service_ns        = RPC_HANDOFF_SEED_NS;
+        rpc_client->submit_ns         = 0;
+        rpc_client->complete_ns       = 0;
         sem_init(&(rpc_client->client_sem), 0, 0);
         rpc_client->service_cap          = service_cap;
-        rpc_client->rpc_params.client_id = gettid();
+        rpc_client->rpc_params.client_id = (rpc_client_seq++ << 32) | gettid();
     }
     return rpc_client;
 }
@@ -44,6 +54,25 @@ rpc_client_t *rpc_client_get_service(const unsigned long service_id)
     return rpc_client;
 }
 
+int rpc_client_migrate(rpc_client_t *rpc_client)
+{
+    rpc_service_t *service = rpc_client ? (rpc_service_t *)rpc_get_capobj_bycptr(rpc_client->service_cap) : NULL;
+    if (!service || !__atomic_load_n(&(service->shard_count), __ATOMIC_ACQUIRE)) {
+        LOG_ERROR("Client migrate, service not started");
+        return -1;
+    }
+    // workers were placed around client_cpu, follow them there
+    if (service->placement.policy == RPC_PLACE_FLOAT) {
+        return 0;
+    }
+    if (rpc_placement_pin_self(service->placement.client_cpu) != 0) {
+        LOG_ERROR("Client migrate to cpu:%d failed", service->placement.client_cpu);
+        return -1;
+    }
+    LOG_DEBUG("Client:0x%lx migrated to cpu:%d", rpc_client->rpc_params.client_id, service->placement.client_cpu);
+    return 0;
+}
+
 void rpc_client_stop_service(const unsigned long service_id)
 {
     return;
@@ -54,39 +83,121 @@ static inline void rpc_client_package_params(rpc_client_t *rpc_client, const int
     rpc_client->rpc_params.req_type = service_type;
 }
 
-static inline void rpc_client_send_request(rpc_service_t *service, rpc_client_t *rpc_client)
+// client side stages of traced request, worker recorded the rest
+static inline void rpc_client_trace(rpc_service_t *service, rpc_client_t *rpc_client, const unsigned long now)
 {
-    pthread_spin_lock(&(service->lock));
-    // insert current client in service client list
-    list_add_tail(&(rpc_client->service_hook), &(service->req_list));
-    pthread_spin_unlock(&(service->lock));
-    // change context from client to server
-    sem_post(&(service->server_sem));
-    LOG_DEBUG("RPC CLIENT send request, server_id:0x%lx, client_id:0x%lx, service_type:%ld\n", service->server_id, rpc_client->rpc_params.client_id, rpc_client->rpc_params.req_type);
-    sem_wait(&(rpc_client->client_sem));
+    unsigned long req_type = rpc_client->rpc_params.req_type;
+    rpc_trace_t  *trace    = NULL;
+    if (req_type >= RPC_CLIENT_REQ_TYPE_COUNT && req_type != CLIENT_CALL_METHOD) {
+        return;
+    }
+    rpc_trace_record(service->trace, RPC_TRACE_WAKEUP, rpc_client->complete_ns, now);
+    rpc_trace_record(service->trace, RPC_TRACE_TOTAL, rpc_client->submit_ns, now);
+    if (req_type == CLIENT_CALL_METHOD &&
+        (trace = rpc_service_method_trace(service, rpc_service_get_method(service, rpc_client->rpc_params.method)))) {
+        rpc_trace_record(trace, RPC_TRACE_WAKEUP, rpc_client->complete_ns, now);
+        rpc_trace_record(trace, RPC_TRACE_TOTAL, rpc_client->submit_ns, now);
+    }
 }
 
-void *rpc_client_request_service(rpc_client_t *rpc_client, const unsigned int service_type)
+// record service time of finished request once, feeds spin budget, measured up to
+// completion stamp of worker, so time client spent asleep doesn't push budget up
+static inline void rpc_client_reap(rpc_service_t *service, rpc_client_t *rpc_client)
 {
-    if (!rpc_client) {
-        return NULL;
+    if (rpc_client->submit_ns) {
+        unsigned long now  = rpc_handoff_now_ns();
+        unsigned long done = rpc_client->complete_ns >= rpc_client->submit_ns ? rpc_client->complete_ns : now;
+        rpc_handoff_update(&(rpc_client->service_ns), done - rpc_client->submit_ns);
+        if (service->trace) {
+            rpc_client_trace(service, rpc_client, now);
+        }
+        rpc_client->submit_ns = 0;
     }
+}
+
+// withdraw rsp_waiting set before sleep, return 1 if server took it, then its post is on the way
+static inline int rpc_client_cancel_waiting(rpc_client_t *rpc_client)
+{
+    return !__atomic_exchange_n(&(rpc_client->rsp_waiting), 0, __ATOMIC_SEQ_CST);
+}
+
+// spin on rsp_done while it pays off, then sleep on client_sem
+static inline void rpc_client_wait_response(rpc_service_t *service, rpc_client_t *rpc_client)
+{
+    unsigned long budget = (service->flags & RPC_SERVICE_ADAPTIVE_SPIN) ? rpc_handoff_budget(rpc_client->service_ns) : 0;
+    if (rpc_handoff_spin(&(rpc_client->rsp_done), budget)) {
+        return;
+    }
+    while (1) {
+        // announce sleeping before last check, so server completing now will post
+        rpc_client->wake_sem = &(rpc_client->client_sem);
+        __atomic_store_n(&(rpc_client->rsp_waiting), 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(rpc_client->rsp_done), __ATOMIC_SEQ_CST) && !rpc_client_cancel_waiting(rpc_client)) {
+            return;
+        }
+        // post may be left from previous request, so check rsp_done again after wakeup
+        sem_wait(&(rpc_client->client_sem));
+        if (__atomic_load_n(&(rpc_client->rsp_done), __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+}
+
+// check request and mark context in flight, return shard it goes to, NULL if invalid
+static inline rpc_service_shard_t *rpc_client_prepare_request(rpc_client_t *rpc_client, const unsigned int service_type)
+{
     // get capability by cptr
     rpc_service_t *service = (rpc_service_t *)rpc_get_capobj_bycptr(rpc_client->service_cap);
     if (NULL == service) {
         LOG_ERROR("Client can't get cap of rpc:0x%lx", rpc_client->service_cap);
         return NULL;
     }
-    // send request basic on request service type
-    void *res = NULL;
-    if (service_type > RPC_CLIENT_REQ_TOTAL_TYPE_COUNT) {
+    if (service_type >= RPC_CLIENT_REQ_TOTAL_TYPE_COUNT) {
         LOG_DEBUG("Unknown request type:%d", service_type);
         return NULL;
     }
+    rpc_service_shard_t *shard = rpc_service_get_shard(service, rpc_client->rpc_params.client_id);
+    if (!shard) {
+        LOG_ERROR("Service of cap:0x%lx not started", rpc_client->service_cap);
+        return NULL;
+    }
+    // one request in flight per context
+    if (!__atomic_load_n(&(rpc_client->rsp_done), __ATOMIC_ACQUIRE)) {
+        LOG_ERROR("Client:0x%lx still has request in flight", rpc_client->rpc_params.client_id);
+        return NULL;
+    }
 
-    // send rpc request
     rpc_client_package_params(rpc_client, service_type);
-    rpc_client_send_request(service, rpc_client);
+    rpc_client->submit_ns = rpc_handoff_now_ns();
+    __atomic_store_n(&(rpc_client->rsp_done), 0, __ATOMIC_RELAXED);
+    LOG_DEBUG("RPC CLIENT send request, server_id:0x%lx, client_id:0x%lx, service_type:%ld\n", service->server_id, rpc_client->rpc_params.client_id, rpc_client->rpc_params.req_type);
+    return shard;
+}
+
+static inline int rpc_client_send_request(rpc_client_t *rpc_client, const unsigned int service_type)
+{
+    rpc_service_shard_t *shard = rpc_client_prepare_request(rpc_client, service_type);
+    if (!shard) {
+        return -1;
+    }
+    // insert current client in request queue of its shard, then wake worker if it sleeps
+    mpsc_queue_push(&(shard->req_queue), &(rpc_client->service_hook));
+    rpc_service_notify(shard);
+    return 0;
+}
+
+void *rpc_client_request_service(rpc_client_t *rpc_client, const unsigned int service_type)
+{
+    if (!rpc_client) {
+        return NULL;
+    }
+    // send rpc request, then wait for it
+    if (rpc_client_send_request(rpc_client, service_type) != 0) {
+        return NULL;
+    }
+    rpc_service_t *service = (rpc_service_t *)rpc_get_capobj_bycptr(rpc_client->service_cap);
+    rpc_client_wait_response(service, rpc_client);
+    rpc_client_reap(service, rpc_client);
     // proc response
     LOG_DEBUG("Client request finished");
     switch (service_type) {
@@ -98,4 +209,174 @@ void *rpc_client_request_service(rpc_client_t *rpc_client, const unsigned int se
             return (void *)(rpc_client->rpc_params.rpc_shm_vaddr);
     }
     return NULL;
-}
\ No newline at end of file
+}
+
+unsigned long rpc_client_call_method(rpc_client_t *rpc_client, const unsigned int method, const unsigned long param)
+{
+    if (!rpc_client) {
+        return -1UL;
+    }
+    rpc_service_t *service = (rpc_service_t *)rpc_get_capobj_bycptr(rpc_client->service_cap);
+    rpc_method_t  *entry   = service ? rpc_service_get_method(service, method) : NULL;
+    if (!entry) {
+        LOG_ERROR("Client call unknown method:%u of rpc:0x%lx", method, rpc_client->service_cap);
+        return -1UL;
+    }
+    // params of request in flight still belong to worker
+    if (!__atomic_load_n(&(rpc_client->rsp_done), __ATOMIC_ACQUIRE)) {
+        LOG_ERROR("Client:0x%lx still has request in flight", rpc_client->rpc_params.client_id);
+        return -1UL;
+    }
+    rpc_client->rpc_params.method = method;
+    rpc_client->rpc_params.param  = param;
+    if (rpc_client_send_request(rpc_client, CLIENT_CALL_METHOD) != 0) {
+        return -1UL;
+    }
+    rpc_client_wait_response(service, rpc_client);
+    rpc_client_reap(service, rpc_client);
+    return (entry->flags & RPC_METHOD_NEED_RSP) ? rpc_client->rpc_params.param : 0;
+}
+
+rpc_token_t rpc_client_submit(rpc_client_t *rpc_client, const unsigned int service_type)
+{
+    if (!rpc_client || rpc_client_send_request(rpc_client, service_type) != 0) {
+        return 0;
+    }
+    return (rpc_token_t)rpc_client;
+}
+
+int rpc_client_poll(const rpc_token_t token)
+{
+    rpc_client_t *rpc_client = (rpc_client_t *)token;
+    if (!rpc_client) {
+        return -1;
+    }
+    if (!__atomic_load_n(&(rpc_client->rsp_done), __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    rpc_client_reap((rpc_service_t *)rpc_get_capobj_bycptr(rpc_client->service_cap), rpc_client);
+    return 1;
+}
+
+static inline long rpc_client_find_done(const rpc_token_t *tokens, const unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (tokens[i] && __atomic_load_n(&(((rpc_client_t *)tokens[i])->rsp_done), __ATOMIC_SEQ_CST)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// all contexts point wake_sem to one semaphore of this thread, first completion wakes it
+static __thread sem_t rpc_client_any_sem;
+static __thread int   rpc_client_any_sem_inited = 0;
+
+long rpc_client_wait_any(const rpc_token_t *tokens, const unsigned int count)
+{
+    if (!tokens || !count) {
+        return -1;
+    }
+    long          done   = -1;
+    unsigned long min_ns = ~0UL;
+    int           spin   = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        rpc_client_t *rpc_client = (rpc_client_t *)tokens[i];
+        if (rpc_client) {
+            rpc_service_t *service = (rpc_service_t *)rpc_get_capobj_bycptr(rpc_client->service_cap);
+            spin   |= service->flags & RPC_SERVICE_ADAPTIVE_SPIN;
+            min_ns  = rpc_client->service_ns < min_ns ? rpc_client->service_ns : min_ns;
+        }
+    }
+    if (min_ns == ~0UL) {
+        return -1;
+    }
+    // spin on all flags first, with budget of fastest context
+    unsigned long budget   = spin ? rpc_handoff_budget(min_ns) : 0;
+    unsigned long deadline = rpc_handoff_now_ns() + budget;
+    while ((done = rpc_client_find_done(tokens, count)) < 0 && budget && rpc_handoff_now_ns() < deadline) {
+        rpc_handoff_cpu_relax();
+    }
+    if (!rpc_client_any_sem_inited) {
+        sem_init(&rpc_client_any_sem, 0, 0);
+        rpc_client_any_sem_inited = 1;
+    }
+    while (done < 0) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (tokens[i]) {
+                ((rpc_client_t *)tokens[i])->wake_sem = &rpc_client_any_sem;
+                __atomic_store_n(&(((rpc_client_t *)tokens[i])->rsp_waiting), 1, __ATOMIC_SEQ_CST);
+            }
+        }
+        done        = rpc_client_find_done(tokens, count);
+        int pending = 0;
+        if (done < 0) {
+            sem_wait(&rpc_client_any_sem);
+            pending = -1;
+        }
+        // take back every rsp_waiting, consume posts of contexts whose server already took it
+        for (unsigned int i = 0; i < count; i++) {
+            if (tokens[i]) {
+                pending += rpc_client_cancel_waiting((rpc_client_t *)tokens[i]);
+            }
+        }
+        while (pending-- > 0) {
+            sem_wait(&rpc_client_any_sem);
+        }
+        if (done < 0) {
+            done = rpc_client_find_done(tokens, count);
+        }
+    }
+    rpc_client_reap((rpc_service_t *)rpc_get_capobj_bycptr(((rpc_client_t *)tokens[done])->service_cap), (rpc_client_t *)tokens[done]);
+    return done;
+}
+
+int rpc_client_request_batch(rpc_client_t **rpc_clients, const unsigned int *service_types, const unsigned int count)
+{
+    if (!rpc_clients || !service_types || !count || count > MAX_RPC_BATCH_COUNT) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        if (!rpc_clients[i] || rpc_clients[i]->service_cap != rpc_clients[0]->service_cap) {
+            LOG_ERROR("RPC client batch must target one service, index:%u", i);
+            return -1;
+        }
+    }
+    // link requests of same shard into one chain, in submit order
+    rpc_service_shard_t *shard[MAX_RPC_BATCH_COUNT];
+    mpsc_node_t         *first[MAX_RPC_BATCH_COUNT];
+    mpsc_node_t         *last[MAX_RPC_BATCH_COUNT];
+    unsigned int         shard_count = 0;
+    unsigned int         submitted   = 0;
+    for (; submitted < count; submitted++) {
+        rpc_service_shard_t *cur = rpc_client_prepare_request(rpc_clients[submitted], service_types[submitted]);
+        if (!cur) {
+            break;
+        }
+        mpsc_node_t *node = &(rpc_clients[submitted]->service_hook);
+        unsigned int i    = 0;
+        while (i < shard_count && shard[i] != cur) {
+            i++;
+        }
+        if (i == shard_count) {
+            shard[shard_count] = cur;
+            first[shard_count] = node;
+            shard_count++;
+        } else {
+            last[i]->next = node;
+        }
+        last[i] = node;
+    }
+    // still queue prepared ones, they are already marked in flight
+    for (unsigned int i = 0; i < shard_count; i++) {
+        mpsc_queue_push_chain(&(shard[i]->req_queue), first[i], last[i]);
+        rpc_service_notify(shard[i]);
+    }
+    // server completes drained requests in one pass, most are done once first one is
+    rpc_service_t *service = (rpc_service_t *)rpc_get_capobj_bycptr(rpc_clients[0]->service_cap);
+    for (unsigned int i = 0; i < submitted; i++) {
+        rpc_client_wait_response(service, rpc_clients[i]);
+        rpc_client_reap(service, rpc_clients[i]);
+    }
+    return submitted == count ? 0 : -1;
+}
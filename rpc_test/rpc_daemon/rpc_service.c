@@ -3,6 +3,7 @@
 #include "../include/list.h"
 #include "../include/log.h"
 #include <pthread.h>
+#include <string.h>
 #include <syscall.h>
 
 linkhash_t *service_cap_hash = NULL;
@@ -11,11 +12,19 @@ static inline cptr_t mk_rpc_service_cap(const unsigned long server_id)
 {
     rpc_service_t *service_cap = RPC_SERVICE_MALLOC(sizeof(rpc_service_t));
     if (service_cap != NULL) {
-        INIT_LIST_HEAD(&(service_cap->req_list));
-        INIT_LIST_HEAD(&(service_cap->rsp_list));
-        service_cap->server_id = server_id;
-        sem_init(&(service_cap->server_sem), 0, 0);
-        pthread_spin_init(&(service_cap->lock), 0);
+        // shards and workers are created when service starts
+        service_cap->server_id      = server_id;
+        service_cap->shard_count    = 0;
+        service_cap->worker_count   = 0;
+        service_cap->flags          = 0;
+        service_cap->shm_block_size = PAGE_SIZE;
+        service_cap->shard          = NULL;
+        service_cap->worker         = NULL;
+        memset(&(service_cap->placement), 0, sizeof(rpc_placement_t));
+        service_cap->placement.policy     = RPC_PLACE_FLOAT;
+        service_cap->placement.client_cpu = RPC_PLACEMENT_CURRENT_CPU;
+        service_cap->method       = NULL;
+        service_cap->trace        = NULL;
     }
     return (cptr_t)service_cap;
 }
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include "../include/rpc_ipc.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define RPC_IPC_THREAD_CREATE(thread_t, handler, arg) pthread_create(thread_t, NULL, handler, arg)
+#define RPC_IPC_SHM_DATA(shm)                         ((void *)((char *)(shm) + RPC_IPC_DATA_OFFSET))
+
+typedef struct rpc_ipc_conn {
+    int            sock;
+    cptr_t         client_id;
+    rpc_ipc_shm_t *shm;
+    rpc_service_t *service;
+} rpc_ipc_conn_t;
+
+typedef struct rpc_ipc_listener {
+    int            sock;
+    rpc_service_t *service;
+} rpc_ipc_listener_t;
+
+// not private futex, waiter and waker live in different processes
+static inline long rpc_ipc_futex(uint32_t *addr, const int op, const uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+// producer only, return -1 if ring full
+static inline int rpc_ipc_ring_push(rpc_ipc_ring_t *ring, const rpc_ipc_entry_t *entry)
+{
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) >= RPC_IPC_RING_SIZE) {
+        return -1;
+    }
+    ring->entry[head % RPC_IPC_RING_SIZE] = *entry;
+    __atomic_store_n(&(ring->head), head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ring->waiting), __ATOMIC_SEQ_CST)) {
+        rpc_ipc_futex(&(ring->head), FUTEX_WAKE, 1, NULL);
+    }
+    return 0;
+}
+
+// server, stamp response so client measures up to here, not up to its own wakeup
+static inline void rpc_ipc_respond(rpc_ipc_ring_t *ring, rpc_ipc_entry_t *rsp)
+{
+    rsp->complete_ns = (uint32_t)rpc_handoff_now_ns();
+    rpc_ipc_ring_push(ring, rsp);
+}
+
+// consumer only, ring must not be empty
+static inline rpc_ipc_entry_t rpc_ipc_ring_pop(rpc_ipc_ring_t *ring)
+{
+    rpc_ipc_entry_t entry = ring->entry[ring->tail % RPC_IPC_RING_SIZE];
+    __atomic_store_n(&(ring->tail), ring->tail + 1, __ATOMIC_RELEASE);
+    return entry;
+}
+
+// consumer only, spin for budget then sleep on head, timeout_ms 0 means forever,
+// return 0 if ring has entry, -1 if timeout
+static int rpc_ipc_ring_wait(rpc_ipc_ring_t *ring, const unsigned long budget_ns, const long timeout_ms)
+{
+    uint32_t      tail     = ring->tail;
+    unsigned long deadline = rpc_handoff_now_ns() + budget_ns;
+    while (budget_ns && __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) == tail) {
+        rpc_handoff_cpu_relax();
+        if (rpc_handoff_now_ns() >= deadline) {
+            break;
+        }
+    }
+    struct timespec timeout = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000};
+    while (1) {
+        uint32_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            return 0;
+        }
+        // announce sleeping before last check, so producer pushing now will wake us
+        __atomic_store_n(&(ring->waiting), 1, __ATOMIC_SEQ_CST);
+        long res = 0;
+        if (__atomic_load_n(&(ring->head), __ATOMIC_SEQ_CST) == head) {
+            res = rpc_ipc_futex(&(ring->head), FUTEX_WAIT, head, timeout_ms ? &timeout : NULL);
+        }
+        __atomic_store_n(&(ring->waiting), 0, __ATOMIC_RELAXED);
+        if (res < 0 && errno == ETIMEDOUT) {
+            return -1;
+        }
+    }
+}
+
+static inline int rpc_ipc_peer_gone(const int sock)
+{
+    struct pollfd pfd = {.fd = sock, .events = POLLRDHUP};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+static void *rpc_ipc_conn_handler(void *arg)
+{
+    rpc_ipc_conn_t   *conn            = (rpc_ipc_conn_t *)arg;
+    rpc_ipc_shm_t    *shm             = conn->shm;
+    unsigned long     idle_ns         = RPC_HANDOFF_SEED_NS;
+    rpc_srv_params_t  params          = {.client_id = conn->client_id, .rpc_shm_vaddr = RPC_IPC_SHM_DATA(shm), .rpc_shm_size = RPC_IPC_DATA_SIZE};
+    rpc_ipc_entry_t   rsp             = {0};
+    rpc_srv_handler_t service_handler = NULL;
+    rpc_method_t     *method          = NULL;
+    LOG_DEBUG("RPC IPC SERVER serve client_id:0x%lx, shm:%p", conn->client_id, shm);
+    while (1) {
+        unsigned long idle_start = rpc_handoff_now_ns();
+        unsigned long budget     = (conn->service->flags & RPC_SERVICE_ADAPTIVE_SPIN) ? rpc_handoff_budget(idle_ns) : 0;
+        if (rpc_ipc_ring_wait(&(shm->req_ring), budget, RPC_IPC_IDLE_CHECK_MS) != 0) {
+            if (rpc_ipc_peer_gone(conn->sock)) {
+                LOG_DEBUG("RPC IPC SERVER client_id:0x%lx gone", conn->client_id);
+                break;
+            }
+            continue;
+        }
+        rpc_handoff_update(&idle_ns, rpc_handoff_now_ns() - idle_start);
+
+        rpc_ipc_entry_t req = rpc_ipc_ring_pop(&(shm->req_ring));
+        params.req_type     = req.req_type;
+        params.param        = req.param;
+        rsp.req_type        = req.req_type;
+        rsp.seq             = req.seq;
+        switch (req.req_type) {
+            case CLIENT_GET_SERVICE:
+                // shm is already mapped by client, only tell its size
+                rsp.param = shm->data_size;
+                rpc_ipc_respond(&(shm->rsp_ring), &rsp);
+                break;
+            case CLIENT_REQ_SERVICE_WITH_RSP:
+            case CLIENT_REQ_SERVICE_WITHOUT_RSP:
+                service_handler = conn->service->srv_handlers.handlers[req.req_type];
+                rsp.param       = (uint64_t)(unsigned long)service_handler(&params);
+                if (req.req_type == CLIENT_REQ_SERVICE_WITH_RSP) {
+                    rpc_ipc_respond(&(shm->rsp_ring), &rsp);
+                }
+                break;
+            case CLIENT_CALL_METHOD:
+                params.method = req.method;
+                method        = rpc_service_get_method(conn->service, req.method);
+                rsp.param     = method ? (uint64_t)(unsigned long)rpc_service_call_method(method, &params) : -1UL;
+                rpc_ipc_respond(&(shm->rsp_ring), &rsp);
+                break;
+            case CLIENT_STOP_SERVICE:
+                goto exit;
+            default:
+                LOG_WARING("RPC IPC SERVER UNKNOWN REQUEST:%u", req.req_type);
+                break;
+        }
+    }
+exit:
+    munmap(shm, RPC_IPC_MAP_SIZE);
+    close(conn->sock);
+    RPC_SERVICE_FREE(conn);
+    return NULL;
+}
+
+// create mapping for new client and pass its memfd over sock
+static rpc_ipc_shm_t *rpc_ipc_shm_create(const int sock)
+{
+    int memfd = memfd_create("rpc_ipc_shm", MFD_CLOEXEC);
+    if (memfd < 0) {
+        LOG_ERROR("RPC IPC memfd create failed, errno:%d", errno);
+        return NULL;
+    }
+    rpc_ipc_shm_t *shm = MAP_FAILED;
+    if (ftruncate(memfd, RPC_IPC_MAP_SIZE) == 0) {
+        shm = mmap(NULL, RPC_IPC_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (shm == MAP_FAILED) {
+        LOG_ERROR("RPC IPC memfd map failed, errno:%d", errno);
+        close(memfd);
+        return NULL;
+    }
+    // new memfd is zero filled, rings start empty
+    shm->magic     = RPC_IPC_MAGIC;
+    shm->data_size = RPC_IPC_DATA_SIZE;
+
+    char            dummy                            = 0;
+    char            control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec    iov                              = {.iov_base = &dummy, .iov_len = 1};
+    struct msghdr   msg                              = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *cmsg                             = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level                                 = SOL_SOCKET;
+    cmsg->cmsg_type                                  = SCM_RIGHTS;
+    cmsg->cmsg_len                                   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    int res = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    // mapping keeps memfd alive
+    close(memfd);
+    if (res != 1) {
+        LOG_ERROR("RPC IPC send memfd failed, errno:%d", errno);
+        munmap(shm, RPC_IPC_MAP_SIZE);
+        return NULL;
+    }
+    return shm;
+}
+
+static void *rpc_ipc_accept_handler(void *arg)
+{
+    rpc_ipc_listener_t *listener  = (rpc_ipc_listener_t *)arg;
+    cptr_t              client_id = 0;
+    while (1) {
+        int sock = accept(listener->sock, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("RPC IPC accept failed, errno:%d", errno);
+            break;
+        }
+        rpc_ipc_conn_t *conn = RPC_SERVICE_MALLOC(sizeof(rpc_ipc_conn_t));
+        if (!conn || !(conn->shm = rpc_ipc_shm_create(sock))) {
+            RPC_SERVICE_FREE(conn);
+            close(sock);
+            continue;
+        }
+        conn->sock      = sock;
+        conn->client_id = ++client_id;
+        conn->service   = listener->service;
+        pthread_t thread;
+        if (RPC_IPC_THREAD_CREATE(&thread, rpc_ipc_conn_handler, conn) != 0) {
+            LOG_ERROR("RPC IPC start conn handler failed");
+            munmap(conn->shm, RPC_IPC_MAP_SIZE);
+            close(sock);
+            RPC_SERVICE_FREE(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listener->sock);
+    RPC_SERVICE_FREE(listener);
+    return NULL;
+}
+
+int rpc_ipc_server_start(const cptr_t service_cap, const char *sock_path)
+{
+    rpc_service_t *service = rpc_get_capobj_bycptr(service_cap);
+    if (!service || !service->shard || !sock_path) {
+        LOG_ERROR("RPC IPC SERVER START, invalid cptr or service not started");
+        return -1;
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        LOG_ERROR("RPC IPC SERVER START, sock path too long:%s", sock_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, sock_path);
+
+    rpc_ipc_listener_t *listener = RPC_SERVICE_MALLOC(sizeof(rpc_ipc_listener_t));
+    if (!listener) {
+        return -1;
+    }
+    listener->service = service;
+    listener->sock    = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(sock_path);
+    if (listener->sock < 0 || bind(listener->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener->sock, RPC_IPC_BACKLOG) != 0) {
+        LOG_ERROR("RPC IPC SERVER START, listen on %s failed, errno:%d", sock_path, errno);
+        goto clean_up;
+    }
+    pthread_t thread;
+    if (RPC_IPC_THREAD_CREATE(&thread, rpc_ipc_accept_handler, listener) != 0) {
+        LOG_ERROR("RPC IPC SERVER START, start accept handler failed");
+        goto clean_up;
+    }
+    pthread_detach(thread);
+    LOG_DEBUG("RPC IPC SERVER START, sock:%s, server_id:0x%lx", sock_path, service->server_id);
+    return 0;
+
+clean_up:
+    if (listener->sock >= 0) {
+        close(listener->sock);
+    }
+    RPC_SERVICE_FREE(listener);
+    return -1;
+}
+
+rpc_ipc_client_t *rpc_ipc_client_connect(const char *sock_path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (!sock_path || strlen(sock_path) >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+    strcpy(addr.sun_path, sock_path);
+    rpc_ipc_client_t *client = RPC_SERVICE_MALLOC(sizeof(rpc_ipc_client_t));
+    if (!client) {
+        return NULL;
+    }
+    client->seq        = 0;
+    client->service_ns = RPC_HANDOFF_SEED_NS;
+    client->shm        = MAP_FAILED;
+    client->sock       = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->sock < 0 || connect(client->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        LOG_ERROR("RPC IPC CLIENT connect %s failed, errno:%d", sock_path, errno);
+        goto clean_up;
+    }
+
+    // server answers connect with memfd of our mapping
+    char            dummy                            = 0;
+    char            control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec    iov                              = {.iov_base = &dummy, .iov_len = 1};
+    struct msghdr   msg                              = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *cmsg                             = NULL;
+    int             memfd                            = -1;
+    if (recvmsg(client->sock, &msg, MSG_CMSG_CLOEXEC) != 1 || !(cmsg = CMSG_FIRSTHDR(&msg)) ||
+        cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        LOG_ERROR("RPC IPC CLIENT recv memfd failed, errno:%d", errno);
+        goto clean_up;
+    }
+    memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    client->shm = mmap(NULL, RPC_IPC_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    close(memfd);
+    if (client->shm == MAP_FAILED || client->shm->magic != RPC_IPC_MAGIC) {
+        LOG_ERROR("RPC IPC CLIENT map shm failed, errno:%d", errno);
+        goto clean_up;
+    }
+    LOG_DEBUG("RPC IPC CLIENT connected, sock:%s, shm:%p, data_size:0x%x", sock_path, client->shm, client->shm->data_size);
+    return client;
+
+clean_up:
+    if (client->shm != MAP_FAILED) {
+        munmap(client->shm, RPC_IPC_MAP_SIZE);
+    }
+    if (client->sock >= 0) {
+        close(client->sock);
+    }
+    RPC_SERVICE_FREE(client);
+    return NULL;
+}
+
+void rpc_ipc_client_close(rpc_ipc_client_t *client)
+{
+    if (!client) {
+        return;
+    }
+    rpc_ipc_client_request(client, CLIENT_STOP_SERVICE, 0);
+    munmap(client->shm, RPC_IPC_MAP_SIZE);
+    close(client->sock);
+    RPC_SERVICE_FREE(client);
+}
+
+void *rpc_ipc_client_shm(rpc_ipc_client_t *client)
+{
+    return client ? RPC_IPC_SHM_DATA(client->shm) : NULL;
+}
+
+// push request, wait for its response if need_rsp, return response param,
+// -1UL if server is gone or answered out of order
+static unsigned long rpc_ipc_client_send(rpc_ipc_client_t *client, rpc_ipc_entry_t *req, const int need_rsp)
+{
+    unsigned long start = rpc_handoff_now_ns();
+    req->seq            = ++client->seq;
+    // requests without response may fill ring, wait server to catch up
+    while (rpc_ipc_ring_push(&(client->shm->req_ring), req) != 0) {
+        if (rpc_ipc_peer_gone(client->sock)) {
+            LOG_ERROR("RPC IPC CLIENT server gone, request type:%u, seq:%u not sent", req->req_type, req->seq);
+            return -1UL;
+        }
+        sched_yield();
+    }
+    if (!need_rsp) {
+        return 0;
+    }
+    // handler may run long, only give up once server is gone, checked as often as server checks us
+    unsigned long budget = rpc_handoff_budget(client->service_ns);
+    while (rpc_ipc_ring_wait(&(client->shm->rsp_ring), budget, RPC_IPC_IDLE_CHECK_MS) != 0) {
+        if (rpc_ipc_peer_gone(client->sock)) {
+            LOG_ERROR("RPC IPC CLIENT server gone, request type:%u, seq:%u not answered", req->req_type, req->seq);
+            return -1UL;
+        }
+        budget = 0;
+    }
+    rpc_ipc_entry_t rsp = rpc_ipc_ring_pop(&(client->shm->rsp_ring));
+    if (rsp.seq != req->seq) {
+        LOG_ERROR("RPC IPC CLIENT response out of order, type:%u, seq:%u, rsp seq:%u", req->req_type, req->seq, rsp.seq);
+        return -1UL;
+    }
+    rpc_handoff_update(&(client->service_ns), (uint32_t)(rsp.complete_ns - (uint32_t)start));
+    LOG_DEBUG("RPC IPC CLIENT request done, type:%u, seq:%u, param:0x%lx", req->req_type, req->seq, (unsigned long)rsp.param);
+    return rsp.param;
+}
+
+unsigned long rpc_ipc_client_request(rpc_ipc_client_t *client, const unsigned int service_type, const unsigned long param)
+{
+    if (!client || service_type >= RPC_CLIENT_REQ_TOTAL_TYPE_COUNT || service_type == CLIENT_CALL_METHOD) {
+        return 0;
+    }
+    rpc_ipc_entry_t req = {.req_type = service_type, .param = param};
+    return rpc_ipc_client_send(client, &req, service_type == CLIENT_GET_SERVICE || service_type == CLIENT_REQ_SERVICE_WITH_RSP);
+}
+
+unsigned long rpc_ipc_client_call_method(rpc_ipc_client_t *client, const unsigned int method, const unsigned long param)
+{
+    if (!client || method >= MAX_RPC_METHOD_COUNT) {
+        return -1UL;
+    }
+    rpc_ipc_entry_t req = {.req_type = CLIENT_CALL_METHOD, .method = method, .param = param};
+    return rpc_ipc_client_send(client, &req, 1);
+}
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include "../include/rpc_placement.h"
+#include "../include/log.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RPC_PLACEMENT_SYSFS_CPU     "/sys/devices/system/cpu/cpu%d"
+#define RPC_PLACEMENT_MAX_CACHE_IDX 8
+
+// parse sysfs cpu list like "0-3,8,10-11" into set
+static int rpc_placement_read_cpu_list(const char *path, cpu_set_t *set)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char  buf[256] = {0};
+    char *res      = fgets(buf, sizeof(buf), file);
+    fclose(file);
+    if (!res) {
+        return -1;
+    }
+    CPU_ZERO(set);
+    char *cur = buf;
+    while (*cur >= '0' && *cur <= '9') {
+        long first = strtol(cur, &cur, 10);
+        long last  = first;
+        if (*cur == '-') {
+            last = strtol(cur + 1, &cur, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*cur == ',') {
+            cur++;
+        }
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+static int rpc_placement_smt_siblings(const int cpu, cpu_set_t *set)
+{
+    char path[128];
+    snprintf(path, sizeof(path), RPC_PLACEMENT_SYSFS_CPU "/topology/thread_siblings_list", cpu);
+    return rpc_placement_read_cpu_list(path, set);
+}
+
+// cpus sharing cache of highest level with cpu
+static int rpc_placement_llc_cpus(const int cpu, cpu_set_t *set)
+{
+    char path[128];
+    int  llc_level = 0;
+    for (int idx = 0; idx < RPC_PLACEMENT_MAX_CACHE_IDX; idx++) {
+        snprintf(path, sizeof(path), RPC_PLACEMENT_SYSFS_CPU "/cache/index%d/level", cpu, idx);
+        FILE *file  = fopen(path, "r");
+        int   level = 0;
+        if (!file) {
+            break;
+        }
+        int res = fscanf(file, "%d", &level);
+        fclose(file);
+        if (res != 1 || level < llc_level) {
+            continue;
+        }
+        snprintf(path, sizeof(path), RPC_PLACEMENT_SYSFS_CPU "/cache/index%d/shared_cpu_list", cpu, idx);
+        cpu_set_t shared;
+        if (rpc_placement_read_cpu_list(path, &shared) == 0) {
+            *set      = shared;
+            llc_level = level;
+        }
+    }
+    return llc_level ? 0 : -1;
+}
+
+// collect cpus of set allowed for process, except exclude
+static unsigned int rpc_placement_pick(const cpu_set_t *set, const cpu_set_t *allowed, const int exclude, int *cpus)
+{
+    unsigned int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < MAX_RPC_PLACEMENT_CPU_COUNT; cpu++) {
+        if (cpu != exclude && CPU_ISSET(cpu, set) && CPU_ISSET(cpu, allowed)) {
+            cpus[count++] = cpu;
+        }
+    }
+    return count;
+}
+
+int rpc_placement_resolve(rpc_placement_t *placement, int *worker_cpu, const unsigned int worker_count)
+{
+    for (unsigned int i = 0; i < worker_count; i++) {
+        worker_cpu[i] = -1;
+    }
+    if (placement->client_cpu == RPC_PLACEMENT_CURRENT_CPU) {
+        placement->client_cpu = rpc_placement_current_cpu();
+    }
+    if (placement->policy == RPC_PLACE_FLOAT) {
+        return 0;
+    }
+
+    cpu_set_t    allowed;
+    cpu_set_t    set;
+    int          cpus[MAX_RPC_PLACEMENT_CPU_COUNT];
+    unsigned int count = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        LOG_ERROR("RPC PLACEMENT get affinity failed");
+        return -1;
+    }
+    switch (placement->policy) {
+        case RPC_PLACE_CPUS:
+            for (unsigned int i = 0; i < placement->cpu_count && i < MAX_RPC_PLACEMENT_CPU_COUNT; i++) {
+                if (placement->cpu[i] >= 0 && placement->cpu[i] < CPU_SETSIZE && CPU_ISSET(placement->cpu[i], &allowed)) {
+                    cpus[count++] = placement->cpu[i];
+                }
+            }
+            break;
+        case RPC_PLACE_SMT_SIBLING:
+            if (placement->client_cpu >= 0 && rpc_placement_smt_siblings(placement->client_cpu, &set) == 0) {
+                count = rpc_placement_pick(&set, &allowed, placement->client_cpu, cpus);
+            }
+            if (count) {
+                break;
+            }
+            // core has no free sibling, nearest next is llc
+            __attribute__((fallthrough));
+        case RPC_PLACE_SAME_LLC:
+            if (placement->client_cpu >= 0 && rpc_placement_llc_cpus(placement->client_cpu, &set) == 0) {
+                count = rpc_placement_pick(&set, &allowed, placement->client_cpu, cpus);
+            }
+            break;
+        default:
+            LOG_WARING("RPC PLACEMENT unknown policy:%u", placement->policy);
+            break;
+    }
+    // nothing else near client, share its cpu rather than float far away
+    if (!count && placement->client_cpu >= 0) {
+        cpus[count++] = placement->client_cpu;
+    }
+    if (!count) {
+        LOG_WARING("RPC PLACEMENT no cpu for policy:%u, workers float", placement->policy);
+        return 0;
+    }
+    for (unsigned int i = 0; i < worker_count; i++) {
+        worker_cpu[i] = cpus[i % count];
+    }
+    LOG_DEBUG("RPC PLACEMENT policy:%u, client_cpu:%d, cpus:%u, first worker cpu:%d", placement->policy, placement->client_cpu, count, worker_cpu[0]);
+    return worker_count;
+}
+
+int rpc_placement_attr_set(pthread_attr_t *attr, const int cpu)
+{
+    if (cpu < 0) {
+        return 0;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+int rpc_placement_pin_self(const int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+int rpc_placement_current_cpu(void)
+{
+    return sched_getcpu();
+}
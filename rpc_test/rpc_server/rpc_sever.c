@@ -1,4 +1,5 @@
 #include "../include/rpc_service.h"
+#include <sched.h>
 #include <string.h>
 
 #define RPC_SERVER_THREAD_CREATE(thread_t, attr, handler, arg) pthread_create(thread_t, attr, handler, arg)
@@ -20,52 +21,267 @@ rpc_service_handlers_t rpc_default_handlers = {
     .handlers[CLIENT_REQ_SERVICE_WITHOUT_RSP] = (rpc_srv_handler_t)rpc_default_req_without_rsp_handler,
 };
 
-//
-static inline rpc_srv_params_t rpc_service_get_request(rpc_service_t *service)
+// take one sleeper off shard, return 0 if there is none
+static inline int rpc_service_take_sleeper(rpc_service_shard_t *shard)
 {
-    sem_wait(&(service->server_sem));
-    pthread_spin_lock(&(service->lock));
-    list_t *request = service->req_list.next;
-    list_del_init(request);
-    pthread_spin_unlock(&(service->lock));
+    int sleepers = __atomic_load_n(&(shard->sleepers), __ATOMIC_SEQ_CST);
+    while (sleepers > 0) {
+        if (__atomic_compare_exchange_n(&(shard->sleepers), &sleepers, sleepers - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// called by client after pushing request, semaphore is only touched when a worker sleeps
+void rpc_service_notify(rpc_service_shard_t *shard)
+{
+    if (rpc_service_take_sleeper(shard)) {
+        sem_post(&(shard->server_sem));
+    }
+}
+
+// release client waiting for request done, post semaphore only if it stopped spinning
+void rpc_service_complete(rpc_client_t *client)
+{
+    __atomic_store_n(&(client->rsp_done), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&(client->rsp_waiting), 0, __ATOMIC_SEQ_CST)) {
+        sem_post(__atomic_load_n(&(client->wake_sem), __ATOMIC_ACQUIRE));
+    }
+}
 
-    rpc_client_t *client = container_of(request, rpc_client_t, service_hook);
-    LOG_DEBUG("RPC SERVER get request, client_id:0x%lx, req_type:%ld", client->rpc_params.client_id, client->rpc_params.req_type);
+rpc_method_t *rpc_service_get_method(rpc_service_t *service, const unsigned long method)
+{
+    rpc_method_t *table = __atomic_load_n(&(service->method), __ATOMIC_ACQUIRE);
+    if (!table || method >= MAX_RPC_METHOD_COUNT || !__atomic_load_n(&(table[method].handler), __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &(table[method]);
+}
+
+void *rpc_service_call_method(rpc_method_t *method, rpc_srv_params_t *params)
+{
+    if (method->flags & RPC_METHOD_CONCURRENT) {
+        return method->handler(params);
+    }
+    pthread_mutex_lock(&(method->lock));
+    void *res = method->handler(params);
+    pthread_mutex_unlock(&(method->lock));
+    return res;
+}
+
+int rpc_service_register_method(const cptr_t service_cap, const unsigned int method, rpc_srv_handler_t handler, const unsigned int flags)
+{
+    rpc_service_t *service = NULL;
+    if (!(service = rpc_get_capobj_bycptr(service_cap)) || method >= MAX_RPC_METHOD_COUNT || !handler) {
+        LOG_ERROR("RPC SERVER register method:%u failed, cptr:0x%lx, handler:%p", method, service_cap, handler);
+        return -1;
+    }
+    rpc_method_t *table = __atomic_load_n(&(service->method), __ATOMIC_ACQUIRE);
+    if (!table) {
+        rpc_method_t *new_table = RPC_SERVICE_MALLOC(sizeof(rpc_method_t) * MAX_RPC_METHOD_COUNT);
+        if (!new_table) {
+            LOG_ERROR("RPC SERVER alloc method table failed");
+            return -1;
+        }
+        memset(new_table, 0, sizeof(rpc_method_t) * MAX_RPC_METHOD_COUNT);
+        for (unsigned int i = 0; i < MAX_RPC_METHOD_COUNT; i++) {
+            pthread_mutex_init(&(new_table[i].lock), NULL);
+        }
+        // another thread may register first, keep its table
+        if (__atomic_compare_exchange_n(&(service->method), &table, new_table, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            table = new_table;
+        } else {
+            RPC_SERVICE_FREE(new_table);
+        }
+    }
+    // flags first, worker sees them once it sees handler
+    table[method].flags = flags;
+    __atomic_store_n(&(table[method].handler), handler, __ATOMIC_RELEASE);
+    LOG_DEBUG("RPC SERVER register method:%u, handler:%p, flags:0x%x", method, handler, flags);
+    return 0;
+}
 
-    // if client need response, then insert clien in rsp_list
-    if (client->rpc_params.req_type == CLIENT_GET_SERVICE ||
-        client->rpc_params.req_type == CLIENT_REQ_SERVICE_WITH_RSP) {
-        list_add_tail(&(client->service_hook), &(service->rsp_list));
-    } else {
-        sem_post(&(client->client_sem));
+rpc_trace_t *rpc_service_method_trace(rpc_service_t *service, rpc_method_t *method)
+{
+    if (!service->trace || !method) {
+        return NULL;
+    }
+    rpc_trace_t *trace = __atomic_load_n(&(method->trace), __ATOMIC_ACQUIRE);
+    if (trace) {
+        return trace;
+    }
+    rpc_trace_t *new_trace = RPC_SERVICE_MALLOC(sizeof(rpc_trace_t));
+    if (!new_trace) {
+        return NULL;
+    }
+    memset(new_trace, 0, sizeof(rpc_trace_t));
+    // client and worker may race to create it, loser uses winner's
+    if (__atomic_compare_exchange_n(&(method->trace), &trace, new_trace, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return new_trace;
     }
-    return (client->rpc_params);
+    RPC_SERVICE_FREE(new_trace);
+    return trace;
 }
 
-static inline void rpc_service_awake_waiter(rpc_service_t *service)
+// clock read only when someone uses it, client spin budget or trace
+static inline unsigned long rpc_service_stamp(rpc_service_t *service)
+{
+    return (service->trace || (service->flags & RPC_SERVICE_ADAPTIVE_SPIN)) ? rpc_handoff_now_ns() : 0;
+}
+
+// worker side stages, wakeup and total are recorded by client when it sees completion
+static inline void rpc_service_trace_request(rpc_trace_t *trace, const rpc_trace_stamp_t *stamp)
+{
+    rpc_trace_record(trace, RPC_TRACE_QUEUE, stamp->submit, stamp->dequeue);
+    rpc_trace_record(trace, RPC_TRACE_DISPATCH, stamp->dequeue, stamp->start);
+    rpc_trace_record(trace, RPC_TRACE_HANDLER, stamp->start, stamp->end);
+}
+
+// spin until queue gets request or budget runs out, head leaves stub once a client pushes
+static inline void rpc_service_spin_request(rpc_service_shard_t *shard)
+{
+    unsigned long budget = rpc_handoff_budget(shard->idle_ns);
+    if (!budget) {
+        return;
+    }
+    unsigned long deadline = rpc_handoff_now_ns() + budget;
+    while (__atomic_load_n(&(shard->req_queue.head), __ATOMIC_ACQUIRE) == &(shard->req_queue.stub)) {
+        for (int i = 0; i < RPC_HANDOFF_POLL_BATCH; i++) {
+            rpc_handoff_cpu_relax();
+        }
+        if (rpc_handoff_now_ns() >= deadline) {
+            return;
+        }
+    }
+}
+
+// return 1 if got request, 0 if queue empty, -1 if client still pushing
+static inline int rpc_service_pop_request(rpc_service_shard_t *shard, mpsc_node_t **request)
+{
+    pthread_spin_lock(&(shard->lock));
+    *request = mpsc_queue_pop(&(shard->req_queue));
+    int res  = *request ? 1 : (mpsc_queue_empty(&(shard->req_queue)) ? 0 : -1);
+    pthread_spin_unlock(&(shard->lock));
+    return res;
+}
+
+// pop more requests already in queue under one lock, return count popped
+static inline unsigned int rpc_service_drain_requests(rpc_service_shard_t *shard, mpsc_node_t **request, const unsigned int max)
+{
+    unsigned int count = 0;
+    pthread_spin_lock(&(shard->lock));
+    while (count < max && (request[count] = mpsc_queue_pop(&(shard->req_queue))) != NULL) {
+        count++;
+    }
+    pthread_spin_unlock(&(shard->lock));
+    return count;
+}
+
+static rpc_session_slot_t *rpc_service_session_get(rpc_service_shard_t *shard, const rpc_srv_params_t *params);
+
+// worker drains queue without touching semaphore, sleeps only when queue is empty,
+// return count of requests got, at most RPC_SERVICE_DRAIN_COUNT,
+// waiter[i] is set to client which still waits for response, NULL if client already released,
+// stamp[i] gets submit and dequeue time when service traces,
+// session[i] is held for requests using client shm, NULL if client has none
+static inline unsigned int rpc_service_get_requests(rpc_service_shard_t *shard, rpc_srv_params_t *params, rpc_client_t **waiter,
+                                                    rpc_trace_stamp_t *stamp, rpc_session_slot_t **session)
+{
+    mpsc_node_t  *request    = NULL;
+    unsigned long idle_start = 0;
+    int           spin       = shard->service->flags & RPC_SERVICE_ADAPTIVE_SPIN;
+    while (1) {
+        int res = rpc_service_pop_request(shard, &request);
+        if (res > 0) {
+            break;
+        }
+        if (res < 0) {
+            sched_yield();
+            continue;
+        }
+        if (spin && !idle_start) {
+            idle_start = rpc_handoff_now_ns();
+            rpc_service_spin_request(shard);
+            continue;
+        }
+        // announce sleeping before last check, so client pushing now will see it
+        __atomic_add_fetch(&(shard->sleepers), 1, __ATOMIC_SEQ_CST);
+        if ((res = rpc_service_pop_request(shard, &request)) != 0) {
+            // if client already took us as sleeper, its post must be consumed
+            if (!rpc_service_take_sleeper(shard)) {
+                sem_wait(&(shard->server_sem));
+            }
+            if (res > 0) {
+                break;
+            }
+            continue;
+        }
+        sem_wait(&(shard->server_sem));
+    }
+    if (idle_start) {
+        rpc_handoff_update(&(shard->idle_ns), rpc_handoff_now_ns() - idle_start);
+    }
+
+    mpsc_node_t *requests[RPC_SERVICE_DRAIN_COUNT];
+    requests[0]        = request;
+    unsigned int  count   = 1 + rpc_service_drain_requests(shard, &(requests[1]), RPC_SERVICE_DRAIN_COUNT - 1);
+    unsigned long now     = rpc_service_stamp(shard->service);
+    unsigned long dequeue = shard->service->trace ? now : 0;
+    for (unsigned int i = 0; i < count; i++) {
+        rpc_client_t *client = container_of(requests[i], rpc_client_t, service_hook);
+        // client may reuse context once released, take its submit time first
+        stamp[i].submit  = dequeue ? client->submit_ns : 0;
+        stamp[i].dequeue = dequeue;
+        stamp[i].start   = 0;
+        stamp[i].end     = 0;
+        LOG_DEBUG("RPC SERVER get request, client_id:0x%lx, req_type:%ld", client->rpc_params.client_id, client->rpc_params.req_type);
+
+        // if client need response, worker keeps it until response sent,
+        // unknown method also keeps it, so failure is reported to client
+        params[i]            = client->rpc_params;
+        rpc_method_t *method = NULL;
+        // take session before client is released, its stop may be served by another worker right after
+        session[i] = NULL;
+        if (params[i].req_type == CLIENT_REQ_SERVICE_WITH_RSP || params[i].req_type == CLIENT_REQ_SERVICE_WITHOUT_RSP ||
+            params[i].req_type == CLIENT_CALL_METHOD) {
+            session[i] = rpc_service_session_get(shard, &(params[i]));
+        }
+        if (params[i].req_type == CLIENT_GET_SERVICE ||
+            params[i].req_type == CLIENT_REQ_SERVICE_WITH_RSP ||
+            (params[i].req_type == CLIENT_CALL_METHOD &&
+             (!(method = rpc_service_get_method(shard->service, params[i].method)) || (method->flags & RPC_METHOD_NEED_RSP)))) {
+            waiter[i] = client;
+        } else {
+            waiter[i]           = NULL;
+            client->complete_ns = now;
+            rpc_service_complete(client);
+        }
+    }
+    return count;
+}
+
+static inline void rpc_service_awake_waiter(rpc_service_t *service, rpc_client_t *client)
 {
-    list_t *waiter = service->rsp_list.next;
-    list_del_init(waiter);
-    rpc_client_t *client = container_of(waiter, rpc_client_t, service_hook);
     LOG_DEBUG("RPC SERVER wakeup client, client_id:0x%lx", client->rpc_params.client_id);
+    client->complete_ns = rpc_service_stamp(service);
     // change context from server to client
-    sem_post(&(client->client_sem));
+    rpc_service_complete(client);
 }
 
 // this total function is designed running in kernel
-static inline void rpc_service_send_response(rpc_service_t *service, rpc_srv_params_t *rsp_params)
+static inline void rpc_service_send_response(rpc_client_t *client, rpc_srv_params_t *rsp_params)
 {
     // store response params in clinet struct
-    list_t       *waiter             = service->rsp_list.next;
-    rpc_client_t *client             = container_of(waiter, rpc_client_t, service_hook);
     client->rpc_params.param         = rsp_params->param;
     client->rpc_params.rpc_shm_vaddr = rsp_params->rpc_shm_vaddr;
+    client->rpc_params.session       = rsp_params->session;
     LOG_DEBUG("RPC SERVER send response, client_id:0x%lx, shmaddr:%p\n", client->rpc_params.client_id, client->rpc_params.rpc_shm_vaddr);
 }
 
 static inline void *rpc_shm_block_alloc(unsigned long *size)
 {
-    if (*size > PAGE_SIZE) {
+    if (*size > MAX_RPC_SHM_BLOCK_SIZE) {
         return NULL;
     }
     unsigned long real_size  = *size;
@@ -84,90 +300,358 @@ static inline void rpc_shm_block_free(void *block_start)
     }
 }
 
-void *rpc_service_handler(void *arg)
+// open session for client with shm block, return existing one if client already has
+static rpc_session_slot_t *rpc_service_session_open(rpc_service_shard_t *shard, const cptr_t client_id)
 {
-    LOG_DEBUG("RPC SERVICE DEFAULT HANDLER START");
-    rpc_service_t *service      = (rpc_service_t *)arg;
-    mempool_t     *rpc_shm_pool = mempool_create(PAGE_SIZE, MAX_RPC_SHM_BLOCK_COUNT, rpc_shm_block_alloc);
-    if (!rpc_shm_pool) {
-        LOG_ERROR("RPC SHM POOL CREATED FAILED");
+    pthread_mutex_lock(&(shard->shm_lock));
+    rpc_session_slot_t *slot = (rpc_session_slot_t *)flathash_get((unsigned long)client_id, shard->shm_hash);
+    if (slot != NULL) {
+        pthread_mutex_unlock(&(shard->shm_lock));
+        return slot;
+    }
+    mempool_block_t *rpc_client_shm = NULL;
+    if (!shard->session_free_count || !(rpc_client_shm = mempool_alloc(shard->shm_pool))) {
+        LOG_ERROR("RPC SERVER alloc shm for client failed");
+        pthread_mutex_unlock(&(shard->shm_lock));
         return NULL;
     }
-    linkhash_t *rpc_shm_hash = linkhash_create(MAX_RPC_SERVICE_BUCKET_COUNT);
-    if (!rpc_shm_hash) {
-        LOG_ERROR("RPC SHM HASH CREATED FAILED");
+    slot            = &(shard->session[shard->session_free[shard->session_free_count - 1]]);
+    slot->client_id = client_id;
+    slot->shm       = rpc_client_shm;
+    if (flathash_add((unsigned long)client_id, slot, shard->shm_hash) != 0) {
+        LOG_ERROR("RPC SHM HASH ADD FAILED, Client:0x%lx", client_id);
+        mempool_free(shard->shm_pool, rpc_client_shm);
+        slot->shm = NULL;
+        pthread_mutex_unlock(&(shard->shm_lock));
         return NULL;
     }
-    rpc_srv_params_t  params               = {0};
-    mempool_block_t   empty_rpc_client_shm = {.block_start = 0, .size = 0};
-    mempool_block_t  *rpc_client_shm       = &empty_rpc_client_shm;
-    rpc_srv_handler_t service_handler      = NULL;
+    shard->session_free_count--;
+    // publish slot, handles of previous owner stop matching
+    __atomic_store_n(&(slot->generation), slot->generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(shard->shm_lock));
+    return slot;
+}
+
+// under shm_lock, free shm of closed session and slot once no request holds it
+static void rpc_service_session_retire(rpc_service_shard_t *shard, rpc_session_slot_t *slot)
+{
+    if (!slot->closing || __atomic_load_n(&(slot->inflight), __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    mempool_free(shard->shm_pool, slot->shm);
+    slot->shm                                        = NULL;
+    slot->closing                                    = 0;
+    shard->session_free[shard->session_free_count++] = slot - shard->session;
+    LOG_DEBUG("RPC SERVER retire session, slot:%ld", slot - shard->session);
+}
+
+static void rpc_service_session_close(rpc_service_shard_t *shard, const cptr_t client_id)
+{
+    pthread_mutex_lock(&(shard->shm_lock));
+    rpc_session_slot_t *slot = (rpc_session_slot_t *)flathash_remove((unsigned long)client_id, shard->shm_hash);
+    if ((long)slot > 0) {
+        // invalidate handles before checking holders, getter counts itself before checking handle
+        __atomic_store_n(&(slot->generation), slot->generation + 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&(slot->closing), 1, __ATOMIC_SEQ_CST);
+        // requests of client released at dequeue may still run on other workers
+        rpc_service_session_retire(shard, slot);
+        LOG_DEBUG("RPC SERVER close session, client_id:0x%lx, slot:%ld, inflight:%u", client_id, slot - shard->session, slot->inflight);
+    }
+    pthread_mutex_unlock(&(shard->shm_lock));
+}
+
+static void rpc_service_session_put(rpc_service_shard_t *shard, rpc_session_slot_t *slot)
+{
+    if (__atomic_sub_fetch(&(slot->inflight), 1, __ATOMIC_SEQ_CST) || !__atomic_load_n(&(slot->closing), __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    pthread_mutex_lock(&(shard->shm_lock));
+    rpc_service_session_retire(shard, slot);
+    pthread_mutex_unlock(&(shard->shm_lock));
+}
+
+// hold session of request so its shm outlives handler even if client stops meanwhile,
+// resolve handle client carries in O(1) without lock, fall back to hash for client without one
+static rpc_session_slot_t *rpc_service_session_get(rpc_service_shard_t *shard, const rpc_srv_params_t *params)
+{
+    uint32_t index = RPC_SESSION_INDEX(params->session);
+    if (params->session && index < shard->session_count) {
+        rpc_session_slot_t *slot = &(shard->session[index]);
+        // count before checking handle, close changes generation before checking count
+        __atomic_add_fetch(&(slot->inflight), 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(slot->generation), __ATOMIC_SEQ_CST) == RPC_SESSION_GEN(params->session) &&
+            slot->client_id == params->client_id) {
+            return slot;
+        }
+        rpc_service_session_put(shard, slot);
+    }
+    pthread_mutex_lock(&(shard->shm_lock));
+    rpc_session_slot_t *slot = (rpc_session_slot_t *)flathash_get((unsigned long)params->client_id, shard->shm_hash);
+    if (slot) {
+        __atomic_add_fetch(&(slot->inflight), 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&(shard->shm_lock));
+    return slot;
+}
+
+// worker only writes its stats, readers may see them slightly stale
+static inline void rpc_service_worker_account(rpc_service_worker_stat_t *stat, const unsigned int count)
+{
+    int cpu = rpc_placement_current_cpu();
+    if (cpu != stat->last_cpu) {
+        if (stat->last_cpu >= 0) {
+            __atomic_store_n(&(stat->migrations), stat->migrations + 1, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&(stat->last_cpu), cpu, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&(stat->requests), stat->requests + count, __ATOMIC_RELAXED);
+}
+
+void *rpc_service_handler(void *arg)
+{
+    LOG_DEBUG("RPC SERVICE DEFAULT HANDLER START");
+    rpc_service_worker_t *worker          = (rpc_service_worker_t *)arg;
+    rpc_service_shard_t  *shard           = worker->shard;
+    rpc_service_t        *service         = shard->service;
+    rpc_srv_params_t      params[RPC_SERVICE_DRAIN_COUNT];
+    rpc_client_t         *waiter[RPC_SERVICE_DRAIN_COUNT];
+    rpc_session_slot_t   *held[RPC_SERVICE_DRAIN_COUNT];
+    mempool_block_t      *rpc_client_shm  = NULL;
+    rpc_session_slot_t   *session         = NULL;
+    rpc_srv_handler_t     service_handler = NULL;
+    rpc_method_t         *method          = NULL;
+    rpc_trace_stamp_t     stamp[RPC_SERVICE_DRAIN_COUNT];
     while (1) {
         LOG_DEBUG("RPC SERVER wait client");
-        params         = rpc_service_get_request(service);
-        rpc_client_shm = (mempool_block_t *)linkhash_get((unsigned long)(params.client_id), rpc_shm_hash);
-        switch (params.req_type) {
-            case CLIENT_GET_SERVICE:
-                // check if client already request
-                if (rpc_client_shm != NULL) {
-                    LOG_DEBUG("RPC SERVER Client:0x%lx already requested rpc_client_shm", params.client_id);
-                    rpc_service_awake_waiter(service);
+        // run handlers of drained requests back to back, then complete all waiters in one pass
+        unsigned int count = rpc_service_get_requests(shard, params, waiter, stamp, held);
+        rpc_service_worker_account(&(worker->stat), count);
+        for (unsigned int i = 0; i < count; i++) {
+            switch (params[i].req_type) {
+                case CLIENT_GET_SERVICE:
+                    // return session client already opened, or open one for client
+                    session = rpc_service_session_open(shard, params[i].client_id);
+                    if (session != NULL) {
+                        // map rpc_shm to client, session lets later requests skip hash lookup
+                        params[i].rpc_shm_vaddr = session->shm->block_start;
+                        params[i].param         = session->shm->size;
+                        params[i].session       = RPC_SESSION_MAKE(session->generation, session - shard->session);
+                        LOG_DEBUG("RPC SERVER client_shm:%p, size:0x%lx", params[i].rpc_shm_vaddr, params[i].param);
+                        rpc_service_send_response(waiter[i], &(params[i]));
+                    }
                     break;
-                }
-                // if not, then request one for client
-                rpc_client_shm = mempool_alloc(rpc_shm_pool);
-                if (rpc_client_shm != NULL) {
-                    if (linkhash_add((unsigned long)(params.client_id), rpc_client_shm, rpc_shm_hash) != 0) {
-                        LOG_ERROR("RPC SHM HASH ADD FAILED, Client:0x%lx", params.client_id);
-                        mempool_free(rpc_shm_pool, rpc_client_shm);
-                        rpc_service_awake_waiter(service);
+                case CLIENT_REQ_SERVICE_WITH_RSP:
+                case CLIENT_REQ_SERVICE_WITHOUT_RSP:
+                    service_handler = service->srv_handlers.handlers[params[i].req_type];
+                    rpc_client_shm  = held[i] ? held[i]->shm : NULL;
+                    if (!rpc_client_shm) {
+                        LOG_ERROR("RPC SERVER service for client_id:%lx not found", params[i].client_id);
                         break;
                     }
-                } else {
-                    LOG_ERROR("RPC SERVER alloc shm for client failed");
-                    rpc_service_awake_waiter(service);
+                    // handler sees server view of shm, not address client claims
+                    params[i].rpc_shm_vaddr = rpc_client_shm->block_start;
+                    params[i].rpc_shm_size  = rpc_client_shm->size;
+                    LOG_DEBUG("RPC SERVER service for client_id:%lx, shm_vaddr:%p, handler:%p", params[i].client_id, rpc_client_shm->block_start, service_handler);
+                    stamp[i].start = stamp[i].dequeue ? rpc_handoff_now_ns() : 0;
+                    service_handler(&(params[i]));
+                    stamp[i].end = stamp[i].start ? rpc_handoff_now_ns() : 0;
+                    rpc_service_trace_request(service->trace, &(stamp[i]));
                     break;
-                }
-
-                // map rpc_shm to client
-                params.rpc_shm_vaddr = rpc_client_shm->block_start;
-                params.param         = rpc_client_shm->size;
-                LOG_DEBUG("RPC SERVER alloc client_shm:%p, size:0x%lx", params.rpc_shm_vaddr, params.param);
-                rpc_service_send_response(service, &params);
-                rpc_service_awake_waiter(service);
-                break;
-            case CLIENT_REQ_SERVICE_WITH_RSP:
-                service_handler = service->srv_handlers.handlers[params.req_type];
-                if (!rpc_client_shm) {
-                    LOG_ERROR("RPC SERVER service for client_id:%lx not found", params.client_id);
+                case CLIENT_CALL_METHOD:
+                    method         = rpc_service_get_method(service, params[i].method);
+                    rpc_client_shm = held[i] ? held[i]->shm : NULL;
+                    if (!method || !rpc_client_shm) {
+                        LOG_ERROR("RPC SERVER method:%lu or service for client_id:%lx not found", params[i].method, params[i].client_id);
+                        params[i].param = -1UL;
+                        if (waiter[i]) {
+                            rpc_service_send_response(waiter[i], &(params[i]));
+                        }
+                        break;
+                    }
+                    params[i].rpc_shm_vaddr = rpc_client_shm->block_start;
+                    params[i].rpc_shm_size  = rpc_client_shm->size;
+                    stamp[i].start          = stamp[i].dequeue ? rpc_handoff_now_ns() : 0;
+                    params[i].param         = (unsigned long)rpc_service_call_method(method, &(params[i]));
+                    stamp[i].end            = stamp[i].start ? rpc_handoff_now_ns() : 0;
+                    if (stamp[i].start) {
+                        rpc_service_trace_request(service->trace, &(stamp[i]));
+                        rpc_service_trace_request(rpc_service_method_trace(service, method), &(stamp[i]));
+                    }
+                    if (waiter[i]) {
+                        rpc_service_send_response(waiter[i], &(params[i]));
+                        // latency sensitive method does not wait for rest of batch
+                        if (!(method->flags & RPC_METHOD_BATCH)) {
+                            rpc_service_awake_waiter(service, waiter[i]);
+                            waiter[i] = NULL;
+                        }
+                    }
                     break;
-                }
-                LOG_DEBUG("RPC SERVER service for client_id:%lx, shm_vaddr:%p, handler:%p", params.client_id, rpc_client_shm->block_start, service_handler);
-                service_handler(&params);
-                rpc_service_awake_waiter(service);
-                break;
-            case CLIENT_REQ_SERVICE_WITHOUT_RSP:
-                service_handler = service->srv_handlers.handlers[params.req_type];
-                if (!rpc_client_shm) {
-                    LOG_ERROR("RPC SERVER service for client_id:%lx not found", params.client_id);
+                case CLIENT_STOP_SERVICE:
+                    rpc_service_session_close(shard, params[i].client_id);
                     break;
-                }
-                LOG_DEBUG("RPC SERVER service for client_id:%lx, shm_vaddr:%p, handler:%p", params.client_id, rpc_client_shm->block_start, service_handler);
-                service_handler(&params);
-                break;
-            case CLIENT_STOP_SERVICE:
-                break;
-            default:
-                LOG_WARING("RPC SERVER UNKNOWN REQUEST");
-                break;
+                default:
+                    LOG_WARING("RPC SERVER UNKNOWN REQUEST");
+                    break;
+            }
+            if (held[i]) {
+                rpc_service_session_put(shard, held[i]);
+            }
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            if (waiter[i]) {
+                rpc_service_awake_waiter(service, waiter[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+rpc_service_shard_t *rpc_service_get_shard(rpc_service_t *service, const cptr_t client_id)
+{
+    unsigned int shard_count = __atomic_load_n(&(service->shard_count), __ATOMIC_ACQUIRE);
+    if (!shard_count) {
+        return NULL;
+    }
+    // client id is (seq << 32) | tid, mix all bits so seq also spreads clients
+    return &(service->shard[hash_64bkey((unsigned long)client_id) % shard_count]);
+}
+
+// release what rpc_service_shard_init set up, shard has no sessions left
+static void rpc_service_shard_destroy(rpc_service_shard_t *shard)
+{
+    flathash_destroy(shard->shm_hash);
+    mempool_destroy(shard->shm_pool, rpc_shm_block_free);
+    RPC_SERVICE_FREE(shard->session);
+    RPC_SERVICE_FREE(shard->session_free);
+    sem_destroy(&(shard->server_sem));
+    pthread_spin_destroy(&(shard->lock));
+    pthread_mutex_destroy(&(shard->shm_lock));
+}
+
+static int rpc_service_shard_init(rpc_service_shard_t *shard, rpc_service_t *service, const unsigned long shm_block_count)
+{
+    mpsc_queue_init(&(shard->req_queue));
+    sem_init(&(shard->server_sem), 0, 0);
+    shard->sleepers = 0;
+    shard->idle_ns  = RPC_HANDOFF_SEED_NS;
+    pthread_spin_init(&(shard->lock), 0);
+    pthread_mutex_init(&(shard->shm_lock), NULL);
+    shard->service  = service;
+    shard->shm_pool           = mempool_create(service->shm_block_size, shm_block_count, rpc_shm_block_alloc);
+    shard->shm_hash           = flathash_create(shm_block_count);
+    shard->session            = RPC_SERVICE_MALLOC(sizeof(rpc_session_slot_t) * shm_block_count);
+    shard->session_free       = RPC_SERVICE_MALLOC(sizeof(uint32_t) * shm_block_count);
+    shard->session_count      = shm_block_count;
+    shard->session_free_count = shm_block_count;
+    if (!shard->shm_pool || !shard->shm_hash || !shard->session || !shard->session_free) {
+        LOG_ERROR("RPC SHM POOL OR HASH CREATED FAILED, pool:%p, hash:%p", shard->shm_pool, shard->shm_hash);
+        rpc_service_shard_destroy(shard);
+        return -1;
+    }
+    memset(shard->session, 0, sizeof(rpc_session_slot_t) * shm_block_count);
+    // hand out low slots first
+    for (uint32_t i = 0; i < shm_block_count; i++) {
+        shard->session_free[i] = shm_block_count - 1 - i;
+    }
+    return 0;
+}
+
+int rpc_service_set_placement(const cptr_t service_cap, const rpc_placement_t *placement)
+{
+    rpc_service_t *service = NULL;
+    if (!(service = rpc_get_capobj_bycptr(service_cap)) || !placement || service->shard) {
+        LOG_ERROR("RPC SERVER SET PLACEMENT, invalid cptr or service already started");
+        return -1;
+    }
+    if (placement->policy == RPC_PLACE_CPUS && (!placement->cpu_count || placement->cpu_count > MAX_RPC_PLACEMENT_CPU_COUNT)) {
+        LOG_ERROR("RPC SERVER SET PLACEMENT, invalid cpu count:%u", placement->cpu_count);
+        return -1;
+    }
+    service->placement = *placement;
+    return 0;
+}
+
+int rpc_service_set_shm_block_size(const cptr_t service_cap, const unsigned long size)
+{
+    rpc_service_t *service = NULL;
+    if (!(service = rpc_get_capobj_bycptr(service_cap)) || service->shard) {
+        LOG_ERROR("RPC SERVER SET SHM BLOCK SIZE, invalid cptr or service already started");
+        return -1;
+    }
+    if (!size || size > MAX_RPC_SHM_BLOCK_SIZE) {
+        LOG_ERROR("RPC SERVER SET SHM BLOCK SIZE, invalid size:%lu, max:%lu", size, (unsigned long)MAX_RPC_SHM_BLOCK_SIZE);
+        return -1;
+    }
+    service->shm_block_size = (size + PAGE_SIZE - 1) & ~(unsigned long)(PAGE_SIZE - 1);
+    return 0;
+}
+
+int rpc_service_get_stat(const cptr_t service_cap, rpc_service_stat_t *stat)
+{
+    rpc_service_t *service = NULL;
+    if (!(service = rpc_get_capobj_bycptr(service_cap)) || !stat) {
+        return -1;
+    }
+    memset(stat, 0, sizeof(rpc_service_stat_t));
+    stat->placement   = service->placement;
+    stat->shard_count = __atomic_load_n(&(service->shard_count), __ATOMIC_ACQUIRE);
+    if (!stat->shard_count) {
+        return 0;
+    }
+    stat->worker_count = service->worker_count;
+    for (unsigned int i = 0; i < stat->worker_count; i++) {
+        rpc_service_worker_stat_t *src = &(service->worker[i].stat);
+        stat->worker[i].pinned_cpu     = src->pinned_cpu;
+        stat->worker[i].last_cpu       = __atomic_load_n(&(src->last_cpu), __ATOMIC_RELAXED);
+        stat->worker[i].migrations     = __atomic_load_n(&(src->migrations), __ATOMIC_RELAXED);
+        stat->worker[i].requests       = __atomic_load_n(&(src->requests), __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+int rpc_service_trace_dump(const cptr_t service_cap, FILE *out)
+{
+    rpc_service_t *service = NULL;
+    if (!(service = rpc_get_capobj_bycptr(service_cap)) || !service->trace || !out) {
+        return -1;
+    }
+    char          name[32];
+    rpc_method_t *table = __atomic_load_n(&(service->method), __ATOMIC_ACQUIRE);
+    fprintf(out, "name,stage,count,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+    rpc_trace_dump(service->trace, "service", out);
+    for (unsigned int i = 0; table && i < MAX_RPC_METHOD_COUNT; i++) {
+        rpc_trace_t *trace = __atomic_load_n(&(table[i].trace), __ATOMIC_ACQUIRE);
+        if (trace) {
+            snprintf(name, sizeof(name), "method_%u", i);
+            rpc_trace_dump(trace, name, out);
+        }
+    }
+    return 0;
+}
+
+void rpc_service_trace_reset(const cptr_t service_cap)
+{
+    rpc_service_t *service = NULL;
+    if (!(service = rpc_get_capobj_bycptr(service_cap)) || !service->trace) {
+        return;
+    }
+    rpc_method_t *table = __atomic_load_n(&(service->method), __ATOMIC_ACQUIRE);
+    rpc_trace_reset(service->trace);
+    for (unsigned int i = 0; table && i < MAX_RPC_METHOD_COUNT; i++) {
+        rpc_trace_t *trace = __atomic_load_n(&(table[i].trace), __ATOMIC_ACQUIRE);
+        if (trace) {
+            rpc_trace_reset(trace);
         }
     }
-exit:
-    linkhash_destroy(rpc_shm_hash);
-    mempool_destroy(rpc_shm_pool, rpc_shm_block_free);
 }
 
 rpc_server_thread_t rpc_service_start(const cptr_t service_cap, rpc_service_handlers_t *service_handlers)
+{
+    return rpc_service_start_pool(service_cap, service_handlers, 1, 0);
+}
+
+rpc_server_thread_t rpc_service_start_pool(const cptr_t service_cap, rpc_service_handlers_t *service_handlers,
+                                           const unsigned int worker_count, const unsigned int flags)
 {
     // check cap
     rpc_service_t *service = NULL;
@@ -175,6 +659,10 @@ rpc_server_thread_t rpc_service_start(const cptr_t service_cap, rpc_service_hand
         LOG_ERROR("RPC SERVER START, invalid cptr");
         return 0;
     }
+    if (!worker_count || worker_count > MAX_RPC_SERVICE_WORKER_COUNT || service->shard) {
+        LOG_ERROR("RPC SERVER START, invalid worker count:%u or service already started", worker_count);
+        return 0;
+    }
 
     // record rpc handlers for each request type in service
     rpc_service_handlers_t *real_handlers = service_handlers;
@@ -182,16 +670,86 @@ rpc_server_thread_t rpc_service_start(const cptr_t service_cap, rpc_service_hand
         LOG_WARING("RPC SERVER START, use default service handler");
         real_handlers = &rpc_default_handlers;
     }
+    memcpy(&(service->srv_handlers.handlers), real_handlers, sizeof(rpc_srv_handler_t) * RPC_CLIENT_REQ_TYPE_COUNT);
+    service->flags = flags;
     LOG_DEBUG("RPC SERVER START, handler[%d]:%p, handler[%d]:%p",
               CLIENT_REQ_SERVICE_WITH_RSP, service->srv_handlers.handlers[CLIENT_REQ_SERVICE_WITH_RSP],
               CLIENT_REQ_SERVICE_WITHOUT_RSP, service->srv_handlers.handlers[CLIENT_REQ_SERVICE_WITHOUT_RSP]);
-    memcpy(&(service->srv_handlers.handlers), real_handlers, sizeof(rpc_srv_handler_t) * RPC_CLIENT_REQ_TYPE_COUNT);
 
-    // start rpc_server
-    rpc_server_thread_t server = 0;
-    if (RPC_SERVER_THREAD_CREATE(&server, NULL, rpc_service_handler, service) != 0) {
-        LOG_ERROR("RPC SERVER START, failed to start rpc_server");
+    // with affinity every worker owns one shard, otherwise all workers share one
+    unsigned int  shard_count     = (flags & RPC_SERVICE_CLIENT_AFFINITY) ? worker_count : 1;
+    unsigned int  shard_ready     = 0;
+    unsigned long shm_block_count = (MAX_RPC_SHM_BLOCK_COUNT + shard_count - 1) / shard_count;
+    service->shard                = RPC_SERVICE_MALLOC(sizeof(rpc_service_shard_t) * shard_count);
+    service->worker               = RPC_SERVICE_MALLOC(sizeof(rpc_service_worker_t) * worker_count);
+    if (!service->shard || !service->worker) {
+        LOG_ERROR("RPC SERVER START, alloc shard or worker failed");
+        goto clean_up;
+    }
+    if ((flags & RPC_SERVICE_TRACE) && !service->trace) {
+        if (!(service->trace = RPC_SERVICE_MALLOC(sizeof(rpc_trace_t)))) {
+            LOG_ERROR("RPC SERVER START, alloc trace failed");
+            goto clean_up;
+        }
+        memset(service->trace, 0, sizeof(rpc_trace_t));
+    }
+    for (; shard_ready < shard_count; shard_ready++) {
+        if (rpc_service_shard_init(&(service->shard[shard_ready]), service, shm_block_count) != 0) {
+            goto clean_up;
+        }
+    }
+
+    // start rpc_server workers, worker i serves shard i % shard_count, on cpu placement gives it
+    int worker_cpu[MAX_RPC_SERVICE_WORKER_COUNT];
+    rpc_placement_resolve(&(service->placement), worker_cpu, worker_count);
+    for (unsigned int i = 0; i < worker_count; i++) {
+        rpc_service_worker_t *worker = &(service->worker[i]);
+        pthread_attr_t        attr;
+        worker->shard           = &(service->shard[i % shard_count]);
+        worker->stat.pinned_cpu = worker_cpu[i];
+        worker->stat.last_cpu   = -1;
+        worker->stat.migrations = 0;
+        worker->stat.requests   = 0;
+        pthread_attr_init(&attr);
+        if (rpc_placement_attr_set(&attr, worker_cpu[i]) != 0) {
+            LOG_WARING("RPC SERVER START, pin worker:%u to cpu:%d failed, it floats", i, worker_cpu[i]);
+            pthread_attr_destroy(&attr);
+            pthread_attr_init(&attr);
+            worker->stat.pinned_cpu = -1;
+        }
+        int res = RPC_SERVER_THREAD_CREATE(&(worker->thread), &attr, rpc_service_handler, worker);
+        pthread_attr_destroy(&attr);
+        if (res != 0) {
+            LOG_ERROR("RPC SERVER START, failed to start rpc_server worker:%u", i);
+            if (!i) {
+                goto clean_up;
+            }
+            break;
+        }
+        service->worker_count++;
     }
-    LOG_DEBUG("RPC SERVER START, rpc_server:0x%lx", server);
-    return server;
-}
\ No newline at end of file
+    // with affinity shard i is served by worker i only, drop shards left without worker
+    // so no client is routed to them
+    if (service->worker_count < shard_count) {
+        for (unsigned int i = service->worker_count; i < shard_count; i++) {
+            rpc_service_shard_destroy(&(service->shard[i]));
+        }
+        shard_count = service->worker_count;
+    }
+    // publish shards to clients only after they are ready
+    __atomic_store_n(&(service->shard_count), shard_count, __ATOMIC_RELEASE);
+    LOG_DEBUG("RPC SERVER START, rpc_server:0x%lx, workers:%u, shards:%u", service->worker[0].thread, service->worker_count, shard_count);
+    return service->worker[0].thread;
+
+clean_up:
+    for (unsigned int i = 0; i < shard_ready; i++) {
+        rpc_service_shard_destroy(&(service->shard[i]));
+    }
+    RPC_SERVICE_FREE(service->shard);
+    RPC_SERVICE_FREE(service->worker);
+    RPC_SERVICE_FREE(service->trace);
+    service->shard  = NULL;
+    service->worker = NULL;
+    service->trace  = NULL;
+    return 0;
+}
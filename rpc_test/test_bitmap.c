@@ -1,21 +1,149 @@
 #include "include/atomic.h"
 #include "include/bitmap.h"
 #include "include/log.h"
+#include <pthread.h>
+
+// big enough that summary spans several words
+#define TEST_BITMAP_BYTES        (1 << 13)
+#define TEST_BITMAP_THREAD_COUNT 8
+
+// each thread allocs until bitmap is full, count what it got
+static void *test_bitmap_atomic_alloc(void *arg)
+{
+    bitmap_t     *bmp   = (bitmap_t *)arg;
+    unsigned long count = 0;
+    while (bitmap_atomic_alloc(bmp) >= 0) {
+        count++;
+    }
+    return (void *)count;
+}
 
 int main(int argc, char **argv)
 {
-    int       i;
-    bitmap_t *bmp = bitmap_create(64);
+    bitmap_t    *bmp  = bitmap_create(TEST_BITMAP_BYTES);
+    unsigned int bits = TEST_BITMAP_BYTES << 3;
     LOG_DEBUG("bitmap used_bits:%d, first_po:%d, bytes:%u", atomic_get(&(bmp->used_bits_count)),
               atomic_get(&(bmp->first_free_pos)),
               bmp->bytes);
-    for (int i = 0; i < 3; i++) {
-        bitmap_get_first_free(bmp);
-        LOG_DEBUG("bitmap used_bits:%d, first_po:%d, bytes:%u", atomic_get(&(bmp->used_bits_count)),
-                  atomic_get(&(bmp->first_free_pos)),
-                  bmp->bytes);
+    // fill whole bitmap, every alloc must return next bit
+    for (unsigned int i = 0; i < bits; i++) {
+        if (bitmap_get_first_free(bmp) != (int)i) {
+            LOG_ERROR("bitmap alloc out of order at:%u", i);
+            return -1;
+        }
+    }
+    if (bitmap_get_first_free(bmp) != -1) {
+        LOG_ERROR("bitmap full but alloc succeed");
+        return -1;
+    }
+    // free scattered bits, they must come back lowest first
+    for (unsigned int i = 3; i < bits; i += 4099) {
         bitmap_clear(bmp, i);
     }
+    for (unsigned int i = 3; i < bits; i += 4099) {
+        if (bitmap_get_first_free(bmp) != (int)i) {
+            LOG_ERROR("bitmap realloc failed at:%u", i);
+            return -1;
+        }
+    }
+    LOG_DEBUG("bitmap used_bits:%d, first_po:%d, bytes:%u", atomic_get(&(bmp->used_bits_count)),
+              atomic_get(&(bmp->first_free_pos)),
+              bmp->bytes);
+
+    // contiguous runs, leave holes smaller than wanted run and check they are skipped
+    bitmap_init(bmp, TEST_BITMAP_BYTES);
+    unsigned int start = 0;
+    for (unsigned int i = 0; i < bits; i += 100) {
+        bitmap_set(bmp, i);
+    }
+    if (bitmap_alloc_range(bmp, 100, &start) == 0) {
+        LOG_ERROR("bitmap alloc range got run across used bit, start:%u", start);
+        return -1;
+    }
+    if (bitmap_alloc_range(bmp, 99, &start) != 0 || start != 1) {
+        LOG_ERROR("bitmap alloc range 99 failed, start:%u", start);
+        return -1;
+    }
+    bitmap_free_range(bmp, 0, 301);
+    if (bitmap_alloc_range(bmp, 300, &start) != 0 || start != 0) {
+        LOG_ERROR("bitmap alloc range after free failed, start:%u", start);
+        return -1;
+    }
+    // run spanning summary groups
+    bitmap_init(bmp, TEST_BITMAP_BYTES);
+    for (unsigned int i = 0; i < bits; i++) {
+        if (i < 4000 || i >= 9000) {
+            bitmap_set(bmp, i);
+        }
+    }
+    if (bitmap_alloc_range(bmp, 5000, &start) != 0 || start != 4000 ||
+        (unsigned int)atomic_get(&(bmp->used_bits_count)) != bits) {
+        LOG_ERROR("bitmap alloc range across group failed, start:%u", start);
+        return -1;
+    }
+    LOG_DEBUG("bitmap alloc range finished");
+
+    // bulk ops must agree with per bit ops
+    bitmap_init(bmp, TEST_BITMAP_BYTES);
+    bitmap_t *other = bitmap_create(TEST_BITMAP_BYTES);
+    bitmap_set_range(bmp, 37, 5000);
+    bitmap_clear_range(bmp, 100, 1000);
+    for (unsigned int i = 0; i < bits; i += 3) {
+        bitmap_set(other, i);
+    }
+    int expect_free = 0;
+    for (unsigned int i = 50; i < 7000; i++) {
+        expect_free += !bitmap_test(bmp, i);
+    }
+    if (bitmap_count_free(bmp, 50, 6950) != expect_free || bitmap_count_used(bmp) != 4000 ||
+        atomic_get(&(bmp->used_bits_count)) != 4000) {
+        LOG_ERROR("bitmap count failed, free:%d, expect:%d, used:%d", bitmap_count_free(bmp, 50, 6950), expect_free,
+                  bitmap_count_used(bmp));
+        return -1;
+    }
+    unsigned int expect_used = 0;
+    for (unsigned int i = 0; i < bits; i++) {
+        expect_used += bitmap_test(bmp, i) && !bitmap_test(other, i);
+    }
+    bitmap_bulk_op(bmp, other, BITMAP_OP_ANDNOT);
+    if ((unsigned int)bitmap_count_used(bmp) != expect_used || (unsigned int)atomic_get(&(bmp->used_bits_count)) != expect_used ||
+        bitmap_test(bmp, 39) || !bitmap_test(bmp, 40)) {
+        LOG_ERROR("bitmap andnot failed, used:%d, expect:%u", bitmap_count_used(bmp), expect_used);
+        return -1;
+    }
+    bitmap_bulk_op(bmp, other, BITMAP_OP_OR);
+    bitmap_bulk_op(other, bmp, BITMAP_OP_AND);
+    // other & (bmp | other) == other
+    if (bitmap_count_used(other) != (int)((bits + 2) / 3) ||
+        bitmap_get_first_free(bmp) != 1) {
+        LOG_ERROR("bitmap or/and failed, used:%d", bitmap_count_used(other));
+        return -1;
+    }
+    bitmap_destroy(other);
+    LOG_DEBUG("bitmap bulk ops finished");
+
+    // concurrent allocators must share out every bit exactly once
+    bitmap_init(bmp, TEST_BITMAP_BYTES);
+    pthread_t     allocator[TEST_BITMAP_THREAD_COUNT];
+    unsigned long total = 0;
+    for (int i = 0; i < TEST_BITMAP_THREAD_COUNT; i++) {
+        pthread_create(&allocator[i], NULL, test_bitmap_atomic_alloc, bmp);
+    }
+    for (int i = 0; i < TEST_BITMAP_THREAD_COUNT; i++) {
+        void *count = NULL;
+        pthread_join(allocator[i], &count);
+        total += (unsigned long)count;
+    }
+    if (total != bits || (unsigned int)atomic_get(&(bmp->used_bits_count)) != bits) {
+        LOG_ERROR("bitmap atomic alloc got:%lu bits, used:%d, expect:%u", total, atomic_get(&(bmp->used_bits_count)), bits);
+        return -1;
+    }
+    bitmap_atomic_free(bmp, bits >> 1);
+    if (bitmap_atomic_alloc(bmp) != (int)(bits >> 1)) {
+        LOG_ERROR("bitmap atomic realloc failed");
+        return -1;
+    }
+    LOG_DEBUG("bitmap atomic alloc finished, threads:%d, bits:%lu", TEST_BITMAP_THREAD_COUNT, total);
     bitmap_destroy(bmp);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,38 @@
+#include "include/flathash.h"
+#include "include/hashlist.h"
+#include "include/log.h"
+#include <limits.h>
+
+#define MAX_HASH_OBJ_COUNT 4096
+
+int main(int argc, char *argv[])
+{
+    flathash_t *hashtable = flathash_create(LINKHASH_MAX_BUCKET_COUNT);
+    LOG_DEBUG("hashtable:%p, capacity:%lu, obj_count:%lu", hashtable, hashtable->capacity, hashtable->obj_count);
+    // keys only differ in high bits, like pointers used as cptr
+    for (unsigned long i = 1; i <= MAX_HASH_OBJ_COUNT; i++) {
+        flathash_add(i << 32, (void *)(ULONG_MAX - i), hashtable);
+    }
+    LOG_DEBUG("hashtable add finished, capacity:%lu, obj_count:%lu", hashtable->capacity, hashtable->obj_count);
+    for (unsigned long i = 1; i <= MAX_HASH_OBJ_COUNT; i++) {
+        if (flathash_get(i << 32, hashtable) != (long)(ULONG_MAX - i)) {
+            LOG_ERROR("flathash get failed, key:0x%lx", i << 32);
+            return -1;
+        }
+    }
+    // remove half of keys, then check rest are still reachable across tombstones
+    for (unsigned long i = 1; i <= MAX_HASH_OBJ_COUNT; i += 2) {
+        flathash_remove(i << 32, hashtable);
+    }
+    for (unsigned long i = 1; i <= MAX_HASH_OBJ_COUNT; i++) {
+        long val = flathash_get(i << 32, hashtable);
+        if ((i & 1) ? val != 0 : val != (long)(ULONG_MAX - i)) {
+            LOG_ERROR("flathash get after remove failed, key:0x%lx, val:0x%lx", i << 32, val);
+            return -1;
+        }
+    }
+    LOG_DEBUG("hashtable remove finished, capacity:%lu, obj_count:%lu, tombstone:%lu",
+              hashtable->capacity, hashtable->obj_count, hashtable->tombstone_count);
+    flathash_destroy(hashtable);
+    return 0;
+}
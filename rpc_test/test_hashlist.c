@@ -2,19 +2,93 @@
 #include "include/list.h"
 #include "include/log.h"
 #include <limits.h>
+#include <string.h>
 
-#define MAX_HASH_TABLE_COUNT 128
+#define MAX_HASH_TABLE_COUNT    128
+#define HASH_TEST_READER_COUNT  4
+#define HASH_TEST_ROUNDS        1024
+#define HASH_TEST_DIST_KEYS     (MAX_HASH_TABLE_COUNT << 10)
+// fullest bucket may hold at most this times average load
+#define HASH_TEST_DIST_MAX_SKEW 2
 
 unsigned long long list[MAX_HASH_TABLE_COUNT] = {0};
 
+static volatile int hash_test_stop = 0;
+
+// put keys generated by key_of(i) into buckets, report max load and chi-square of distribution
+static int hash_test_distribution(const char *desc, unsigned long (*key_of)(unsigned long))
+{
+    memset(list, 0, sizeof(list));
+    for (unsigned long i = 0; i < HASH_TEST_DIST_KEYS; i++) {
+        list[hash_64bkey(key_of(i)) & (MAX_HASH_TABLE_COUNT - 1)] += 1;
+    }
+    unsigned long long expect = HASH_TEST_DIST_KEYS / MAX_HASH_TABLE_COUNT;
+    unsigned long long max    = 0;
+    double             chi2   = 0;
+    for (int i = 0; i < MAX_HASH_TABLE_COUNT; i++) {
+        double diff  = (double)list[i] - (double)expect;
+        chi2        += diff * diff / expect;
+        max          = list[i] > max ? list[i] : max;
+    }
+    LOG_DEBUG("hash distribution %s, keys:%lu, buckets:%d, max:%llu, expect:%llu, chi2:%.1f",
+              desc, (unsigned long)HASH_TEST_DIST_KEYS, MAX_HASH_TABLE_COUNT, max, expect, chi2);
+    return max > expect * HASH_TEST_DIST_MAX_SKEW ? -1 : 0;
+}
+
+static unsigned long hash_test_seq_key(unsigned long i)
+{
+    return i;
+}
+
+// differ only in high 32 bits
+static unsigned long hash_test_high_key(unsigned long i)
+{
+    return i << 32;
+}
+
+// malloc-like pointers, 64 byte aligned
+static unsigned long hash_test_ptr_key(unsigned long i)
+{
+    return 0x7f0000000000UL + (i << 6);
+}
+
+// readers keep looking up stable keys while writer adds and removes others
+static void *hash_test_reader(void *arg)
+{
+    linkhash_t   *hashtable = (linkhash_t *)arg;
+    unsigned long miss      = 0;
+    while (!hash_test_stop) {
+        for (int i = 0; i < MAX_HASH_TABLE_COUNT; i++) {
+            if (linkhash_get(i, hashtable) != (long)(ULONG_MAX - i)) {
+                miss++;
+            }
+        }
+    }
+    return (void *)miss;
+}
+
 int main(int argc, char *argv[])
 {
-    // for (int i = 0; i < UINT_MAX >> 16; i++) {
-    //     list[hash_32bkey(i) % MAX_HASH_TABLE_COUNT] += 1;
-    // }
-    // for (int i = 0; i < MAX_HASH_TABLE_COUNT; i++){
-    //     LOG_DEBUG("list[%d]:%llu", i, list[i]);
-    // }
+    if (hash_test_distribution("sequential", hash_test_seq_key) ||
+        hash_test_distribution("high bits", hash_test_high_key) ||
+        hash_test_distribution("pointer", hash_test_ptr_key)) {
+        LOG_ERROR("hash distribution skewed");
+        return -1;
+    }
+
+    // string keyed table
+    const char *names[] = {"userfs", "rpc_daemon", "rpc_server", "rpc_client"};
+    linkhash_t *strtable = linkhash_create_custom(MAX_HASH_TABLE_COUNT, hash_strkey, linkhash_str_equal);
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        linkhash_add((unsigned long)names[i], (void *)(unsigned long)(i + 1), strtable);
+    }
+    char lookup[] = "rpc_server";
+    if (linkhash_get((unsigned long)lookup, strtable) != 3) {
+        LOG_ERROR("string key get failed, key:%s", lookup);
+        return -1;
+    }
+    linkhash_destroy(strtable);
+
     linkhash_t *hashtable = linkhash_create(MAX_HASH_TABLE_COUNT);
     LOG_DEBUG("hashtable:%p, bucket_start:%p, bucket_count:%lu, obj_count:%d",
               hashtable,
@@ -22,11 +96,44 @@ int main(int argc, char *argv[])
               hashtable->bucket_count,
               atomic_load(&(hashtable->obj_count)));
     for (int i = 0; i < MAX_HASH_TABLE_COUNT; i++) {
-        linkhash_add(i, ULONG_MAX - i, hashtable);
+        linkhash_add(i, (void *)(ULONG_MAX - i), hashtable);
+    }
+
+    // batched lookup, include keys never added
+    unsigned long keys[MAX_HASH_TABLE_COUNT + 8];
+    long          vals[MAX_HASH_TABLE_COUNT + 8];
+    for (int i = 0; i < MAX_HASH_TABLE_COUNT + 8; i++) {
+        keys[i] = i;
+    }
+    int found = linkhash_get_many(keys, MAX_HASH_TABLE_COUNT + 8, vals, hashtable);
+    for (int i = 0; i < MAX_HASH_TABLE_COUNT + 8; i++) {
+        if (vals[i] != (i < MAX_HASH_TABLE_COUNT ? (long)(ULONG_MAX - i) : 0)) {
+            LOG_ERROR("get_many failed, key:%d, val:0x%lx", i, vals[i]);
+            return -1;
+        }
+    }
+    LOG_DEBUG("get_many finished, found:%d", found);
+
+    pthread_t reader[HASH_TEST_READER_COUNT];
+    for (int i = 0; i < HASH_TEST_READER_COUNT; i++) {
+        pthread_create(&reader[i], NULL, hash_test_reader, hashtable);
+    }
+    for (int round = 0; round < HASH_TEST_ROUNDS; round++) {
+        unsigned long key = MAX_HASH_TABLE_COUNT + (round % MAX_HASH_TABLE_COUNT);
+        linkhash_add(key, (void *)key, hashtable);
+        linkhash_remove(key, hashtable);
+    }
+    hash_test_stop = 1;
+    unsigned long miss = 0;
+    for (int i = 0; i < HASH_TEST_READER_COUNT; i++) {
+        void *res = NULL;
+        pthread_join(reader[i], &res);
+        miss += (unsigned long)res;
     }
+    LOG_DEBUG("concurrent get finished, miss:%lu, obj_count:%d", miss, atomic_load(&(hashtable->obj_count)));
     // hash_obj_t *hlist_obj = linkhash_get(MAX_HASH_TABLE_COUNT >> 2, hashtable);
     // unsigned long val = linkhash_remove(MAX_HASH_TABLE_COUNT >> 2, hashtable);
     // LOG_DEBUG("hashtable remove, val:0x%lx", val);
     linkhash_destroy(hashtable);
-    return 0;
-}
\ No newline at end of file
+    return miss ? -1 : 0;
+}
@@ -0,0 +1,117 @@
+#include "include/rpc_ipc.h"
+#include <string.h>
+#include <sys/wait.h>
+
+#define TEST_RPC_IPC_SOCK       "/tmp/rpc_ipc_test.sock"
+#define TEST_RPC_IPC_REQ_COUNT  1000
+#define TEST_RPC_IPC_DATA_BYTES 4096
+#define TEST_RPC_IPC_METHOD     7
+
+// sum bytes client wrote in shm, shm is mapped at different address in each process,
+// args and result are read and written in place through frame
+void *rpc_ipc_sum_handler(const void *arg)
+{
+    const rpc_srv_params_t *params = (const rpc_srv_params_t *)arg;
+    rpc_frame_cursor_t      cursor;
+    rpc_frame_t            *frame  = rpc_frame_get(params->rpc_shm_vaddr, params->rpc_shm_size, &cursor);
+    uint32_t               *len_in = frame ? RPC_FRAME_ARG_GET(frame, &cursor, uint32_t) : NULL;
+    // client may change it once read, use only local copy
+    uint32_t                len    = len_in ? *len_in : 0;
+    const unsigned char    *data   = len_in ? rpc_frame_arg_next(frame, &cursor, len) : NULL;
+    uint64_t               *sum    = data ? RPC_FRAME_RESULT_PUT(frame, &cursor, uint64_t) : NULL;
+    if (!sum) {
+        return (void *)-1UL;
+    }
+    *sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        *sum += data[i];
+    }
+    return (void *)(unsigned long)len;
+}
+
+void *rpc_ipc_fill_handler(const void *arg)
+{
+    const rpc_srv_params_t *params = (const rpc_srv_params_t *)arg;
+    memset(params->rpc_shm_vaddr, 0x5a, params->param);
+    return NULL;
+}
+
+void *rpc_ipc_double_handler(const void *arg)
+{
+    return (void *)(((const rpc_srv_params_t *)arg)->param * 2);
+}
+
+static int test_rpc_ipc_client(void)
+{
+    rpc_ipc_client_t *client = NULL;
+    for (int i = 0; i < 100 && !client; i++) {
+        usleep(10000);
+        client = rpc_ipc_client_connect(TEST_RPC_IPC_SOCK);
+    }
+    if (!client) {
+        return 1;
+    }
+    unsigned char *data = rpc_ipc_client_shm(client);
+    if (rpc_ipc_client_request(client, CLIENT_GET_SERVICE, 0) != RPC_IPC_DATA_SIZE) {
+        LOG_ERROR("RPC IPC get service returned wrong shm size");
+        return 1;
+    }
+    for (int i = 0; i < TEST_RPC_IPC_REQ_COUNT; i++) {
+        // write args straight into shared frame
+        rpc_frame_t   *frame  = rpc_frame_init(data, RPC_IPC_DATA_SIZE, 0);
+        unsigned long  expect = 0;
+        *RPC_FRAME_ARG_PUT(frame, uint32_t) = TEST_RPC_IPC_DATA_BYTES;
+        unsigned char *arg = rpc_frame_arg_reserve(frame, TEST_RPC_IPC_DATA_BYTES);
+        for (int j = 0; j < TEST_RPC_IPC_DATA_BYTES; j++) {
+            arg[j]  = (unsigned char)(i + j);
+            expect += arg[j];
+        }
+        rpc_ipc_client_request(client, CLIENT_REQ_SERVICE_WITH_RSP, 0);
+        rpc_frame_cursor_t cursor = {0};
+        uint64_t          *sum    = RPC_FRAME_RESULT_GET(frame, &cursor, uint64_t);
+        if (!sum || *sum != expect) {
+            LOG_ERROR("RPC IPC request:%d got sum:%lu, expect:%lu", i, sum ? (unsigned long)*sum : 0, expect);
+            return 1;
+        }
+    }
+    // request without response fills shm, ring keeps order, so answer of next one means it was served
+    rpc_ipc_client_request(client, CLIENT_REQ_SERVICE_WITHOUT_RSP, TEST_RPC_IPC_DATA_BYTES);
+    rpc_ipc_client_request(client, CLIENT_GET_SERVICE, 0);
+    if (data[0] != 0x5a || data[TEST_RPC_IPC_DATA_BYTES - 1] != 0x5a) {
+        LOG_ERROR("RPC IPC server write not seen by client");
+        return 1;
+    }
+    if (rpc_ipc_client_call_method(client, TEST_RPC_IPC_METHOD, 21) != 42 ||
+        rpc_ipc_client_call_method(client, TEST_RPC_IPC_METHOD + 1, 21) != -1UL) {
+        LOG_ERROR("RPC IPC method call returned wrong value");
+        return 1;
+    }
+    rpc_ipc_client_close(client);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // client runs in another process, only memfd mapping is shared
+    pid_t pid = fork();
+    if (pid == 0) {
+        return test_rpc_ipc_client();
+    }
+    cptr_t                 service_cap          = rpc_service_register(0, getpid());
+    rpc_service_handlers_t rpc_service_handlers = {.handlers[CLIENT_REQ_SERVICE_WITH_RSP]    = rpc_ipc_sum_handler,
+                                                   .handlers[CLIENT_REQ_SERVICE_WITHOUT_RSP] = rpc_ipc_fill_handler};
+    rpc_service_start_pool(service_cap, &rpc_service_handlers, 1, RPC_SERVICE_ADAPTIVE_SPIN);
+    rpc_service_register_method(service_cap, TEST_RPC_IPC_METHOD, rpc_ipc_double_handler, RPC_METHOD_NEED_RSP | RPC_METHOD_CONCURRENT);
+    if (rpc_ipc_server_start(service_cap, TEST_RPC_IPC_SOCK) != 0) {
+        return -1;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    unlink(TEST_RPC_IPC_SOCK);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        LOG_ERROR("RPC IPC client failed, status:0x%x", status);
+        return -1;
+    }
+    LOG_DEBUG("RPC IPC test finished, requests:%d", TEST_RPC_IPC_REQ_COUNT);
+    return 0;
+}
@@ -6,6 +6,14 @@
 #include <string.h>
 #include <syscall.h>
 
+#define TEST_RPC_WORKER_COUNT 4
+#define TEST_RPC_ASYNC_COUNT  4
+#define TEST_RPC_METHOD_ECHO  1000
+#define TEST_RPC_METHOD_COUNT 1001
+#define TEST_RPC_METHOD_CALLS 64
+
+static unsigned long rpc_method_counter = 0;
+
 static unsigned long gettid()
 {
     return syscall(SYS_gettid);
@@ -44,21 +52,42 @@ void *rpc_userdefine_req_without_rsp_handler(const void *arg)
     return write_size;
 }
 
+void *rpc_userdefine_echo_handler(const void *arg)
+{
+    return (void *)(((rpc_srv_params_t *)arg)->param + 1);
+}
+
+// not registered concurrent, so plain increment is safe
+void *rpc_userdefine_count_handler(const void *arg)
+{
+    rpc_method_counter += ((rpc_srv_params_t *)arg)->param;
+    return NULL;
+}
+
 int main(int argc, char **argv)
 {
     int            service_id  = 0;
     cptr_t         service_cap = rpc_service_register(service_id, gettid());
     rpc_service_t *service     = (rpc_service_t *)service_cap;
     LOG_DEBUG("RPC SERVICE register, server_id:0x%lx, service_id:0x%lx, self:0x%lx", service_id, service->server_id, gettid());
+    // workers near cpu of this thread, client follows them below
+    rpc_placement_t placement = {.policy = RPC_PLACE_SMT_SIBLING, .client_cpu = RPC_PLACEMENT_CURRENT_CPU};
+    rpc_service_set_placement(service_cap, &placement);
+    // frames bigger than one page fit in client shm
+    rpc_service_set_shm_block_size(service_cap, 2 * PAGE_SIZE);
     rpc_service_handlers_t rpc_service_handlers = {.handlers[CLIENT_REQ_SERVICE_WITH_RSP]    = rpc_userdefine_req_with_rsp_handler,
                                                    .handlers[CLIENT_REQ_SERVICE_WITHOUT_RSP] = rpc_userdefine_req_without_rsp_handler};
-    rpc_server_thread_t    server_id            = rpc_service_start(service_cap, &rpc_service_handlers);
+    rpc_server_thread_t    server_id            = rpc_service_start_pool(service_cap, &rpc_service_handlers, TEST_RPC_WORKER_COUNT,
+                                                                             RPC_SERVICE_CLIENT_AFFINITY | RPC_SERVICE_ADAPTIVE_SPIN | RPC_SERVICE_TRACE);
+    rpc_service_register_method(service_cap, TEST_RPC_METHOD_ECHO, rpc_userdefine_echo_handler, RPC_METHOD_NEED_RSP | RPC_METHOD_CONCURRENT);
+    rpc_service_register_method(service_cap, TEST_RPC_METHOD_COUNT, rpc_userdefine_count_handler, RPC_METHOD_BATCH);
 
     LOG_DEBUG("client_thread begin");
     rpc_client_t *rpc_client = rpc_client_get_service(service_id);
     LOG_DEBUG("RPC client get_service, service_cap:0x%lx", rpc_client->service_cap);
+    rpc_client_migrate(rpc_client);
     void *shmaddr = rpc_client_request_service(rpc_client, CLIENT_GET_SERVICE);
-    LOG_DEBUG("RPC client get rpc_shm:%p\n", shmaddr);
+    LOG_DEBUG("RPC client get rpc_shm:%p, size:0x%lx\n", shmaddr, rpc_client->rpc_params.param);
     shmaddr = rpc_client_request_service(rpc_client, CLIENT_GET_SERVICE);
     LOG_DEBUG("RPC client get rpc_shm:%p\n", shmaddr);
 
@@ -89,6 +118,60 @@ int main(int argc, char **argv)
 
         // sleep(1);
     }
+
+    // keep several requests in flight, each context has its own shm block
+    rpc_client_t *async_client[TEST_RPC_ASYNC_COUNT];
+    rpc_token_t   token[TEST_RPC_ASYNC_COUNT];
+    for (int i = 0; i < TEST_RPC_ASYNC_COUNT; i++) {
+        async_client[i]                       = rpc_client_get_service(service_id);
+        test_rpcservice_params_t *file_params = rpc_client_request_service(async_client[i], CLIENT_GET_SERVICE);
+        memcpy(file_params->file_name, "rpc_service_test", strlen("rpc_service_test") + 1);
+        file_params->str_len = 45;
+        token[i]             = rpc_client_submit(async_client[i], CLIENT_REQ_SERVICE_WITH_RSP);
+    }
+    for (int i = 0; i < TEST_RPC_ASYNC_COUNT; i++) {
+        long                      done        = rpc_client_wait_any(token, TEST_RPC_ASYNC_COUNT);
+        test_rpcservice_params_t *file_params = async_client[done]->rpc_params.rpc_shm_vaddr;
+        LOG_DEBUG("Client async read done:%ld, read_size:%lx, content:%s", done, file_params->str_len, file_params->file_content);
+        token[done] = 0;
+    }
+
+    // same contexts again as one batch, one wakeup per shard
+    unsigned int batch_type[TEST_RPC_ASYNC_COUNT];
+    for (int i = 0; i < TEST_RPC_ASYNC_COUNT; i++) {
+        ((test_rpcservice_params_t *)async_client[i]->rpc_params.rpc_shm_vaddr)->str_len = 45;
+        batch_type[i]                                                                   = CLIENT_REQ_SERVICE_WITH_RSP;
+    }
+    if (rpc_client_request_batch(async_client, batch_type, TEST_RPC_ASYNC_COUNT) != 0) {
+        LOG_ERROR("Client batch request failed");
+    }
+    for (int i = 0; i < TEST_RPC_ASYNC_COUNT; i++) {
+        test_rpcservice_params_t *file_params = async_client[i]->rpc_params.rpc_shm_vaddr;
+        LOG_DEBUG("Client batch read done:%d, read_size:%lx, content:%s", i, file_params->str_len, file_params->file_content);
+    }
+
+    // methods from dispatch table, counter calls are released at dequeue, echo answer shows they ran
+    for (int i = 0; i < TEST_RPC_METHOD_CALLS; i++) {
+        rpc_client_call_method(async_client[i % TEST_RPC_ASYNC_COUNT], TEST_RPC_METHOD_COUNT, 1);
+    }
+    unsigned long echo = 0;
+    for (int i = 0; i < TEST_RPC_ASYNC_COUNT; i++) {
+        echo = rpc_client_call_method(async_client[i], TEST_RPC_METHOD_ECHO, i);
+        if (echo != (unsigned long)i + 1) {
+            LOG_ERROR("Client method echo:%lu, expect:%d", echo, i + 1);
+        }
+    }
+    if (rpc_client_call_method(rpc_client, TEST_RPC_METHOD_ECHO + 2, 0) != -1UL) {
+        LOG_ERROR("Client call of unknown method succeeded");
+    }
+    LOG_DEBUG("Client method calls done, counter:%lu, expect:%d", rpc_method_counter, TEST_RPC_METHOD_CALLS);
+    rpc_service_stat_t stat;
+    rpc_service_get_stat(service_cap, &stat);
+    for (unsigned int i = 0; i < stat.worker_count; i++) {
+        LOG_DEBUG("Worker:%u pinned cpu:%d, last cpu:%d, migrations:%lu, requests:%lu", i, stat.worker[i].pinned_cpu,
+                  stat.worker[i].last_cpu, stat.worker[i].migrations, stat.worker[i].requests);
+    }
+    rpc_service_trace_dump(service_cap, stdout);
     pthread_join(server_id, NULL);
     return 0;
 }
\ No newline at end of file
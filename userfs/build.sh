@@ -7,6 +7,8 @@ SRC_FILE+=" userfs_heap.c"
 SRC_FILE+=" userfs_file_ctrl.c"
 SRC_FILE+=" userfs_dentry_hash.c"
 SRC_FILE+=" userfs_file_ops.c"
+SRC_FILE+=" userfs_bcache.c"
+SRC_FILE+=" userfs_readahead.c"
 
 INCLUDE_PATH=" ./include"
 
@@ -16,6 +16,16 @@ uint64_t user_disk_read(void *buf, uint64_t size, uint64_t disk_off)
     return pread(g_disk_fd, buf, size, disk_off);
 }
 
+uint64_t user_disk_readv(const struct iovec *iov, int iovcnt, uint64_t disk_off)
+{
+    return preadv(g_disk_fd, iov, iovcnt, disk_off);
+}
+
+uint64_t user_disk_writev(const struct iovec *iov, int iovcnt, uint64_t disk_off)
+{
+    return pwritev(g_disk_fd, iov, iovcnt, disk_off);
+}
+
 int userfs_disk_open(const char *pathname)
 {
     g_disk_fd = open(pathname, O_RDWR | O_CREAT, 0777);
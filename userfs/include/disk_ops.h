@@ -4,10 +4,13 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 uint64_t user_disk_write(const void *buf, uint64_t size, uint64_t disk_off);
 uint64_t user_disk_read(void *buf, uint64_t size, uint64_t disk_off);
+uint64_t user_disk_readv(const struct iovec *iov, int iovcnt, uint64_t disk_off);
+uint64_t user_disk_writev(const struct iovec *iov, int iovcnt, uint64_t disk_off);
 int      userfs_disk_open(const char *pathname);
 int      user_disk_close(void);
 
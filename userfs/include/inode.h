@@ -13,6 +13,8 @@
 #define USERFS_INODE_SIZE        1024
 #define USERFS_DENTRY_SIZE       32
 #define USERFS_MAX_FILE_NAME_LEN (uint32_t)(USERFS_DENTRY_SIZE - sizeof(uint32_t) - 1)
+/*v2pnode table entries that fit in inode space*/
+#define USERFS_INODE_V2P_COUNT   ((USERFS_INODE_SIZE - sizeof(struct userfs_inode)) / sizeof(unsigned long))
 
 #define USERFS_BTYPE_FREE        (0x12345678u)
 #define USERFS_BTYPE_SUPER       (83u)
@@ -20,6 +22,10 @@
 #define USERFS_BTYPE_BGROUP_DESC (71u)
 #define USERFS_BTYPE_DATA        (68u)
 
+/*on-disk format tag, bump low byte whenever the layout changes
+v2: bitmaps are 64-bit words followed by summary words and run hints*/
+#define USERFS_SUPER_MAGIC       (0x55465302u)
+
 #if ENABLE_USERFS_MEMPOOL == 1
 #include "mempool.h"
 mempool_ctrl_t userfs_mem_pool;
@@ -33,6 +39,8 @@ mempool_ctrl_t userfs_mem_pool;
 #endif
 
 struct userfs_super_block {
+    /*format tag, must be USERFS_SUPER_MAGIC*/
+    uint32_t s_magic;
     /*timestamp*/
     uint32_t s_wtime;
     /*data block alloc by block group*/
@@ -0,0 +1,123 @@
+#ifndef USERFS_BCACHE_H
+#define USERFS_BCACHE_H
+#include "inode.h"
+#include "vnode.h"
+#include <stdint.h>
+
+/*global block buffer cache, one buffer per (block, shard offset), shared by
+every open of a file and kept after close until CLOCK evicts it*/
+#define USERFS_BCACHE_DEFAULT_BUDGET       (1ul << 10 << 10 << 8)
+#define USERFS_BCACHE_DEFAULT_BUCKET_COUNT 1024
+/*write-back thread wakes this often, writes buffers dirty longer than expire,
+or oldest ones first while dirty bytes are over limit, limit 0 means budget / 4*/
+#define USERFS_BCACHE_WB_INTERVAL_MS       500
+#define USERFS_BCACHE_WB_EXPIRE_MS         3000
+
+enum userfs_bcache_space {
+    USERFS_BCACHE_DATA,
+    USERFS_BCACHE_META,
+};
+
+typedef struct userfs_bcache_stat {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;
+    uint64_t budget;
+    uint32_t buffers;
+    uint64_t dirty_bytes;
+    uint64_t writebacks;
+    uint64_t readaheads;
+    uint64_t readahead_hits;
+} userfs_bcache_stat_t;
+
+typedef struct userfs_bcache_wb_params {
+    uint32_t interval_ms;
+    uint32_t expire_ms;
+    uint64_t dirty_limit;
+} userfs_bcache_wb_params_t;
+
+int userfs_bcache_init(
+    const uint64_t mem_budget,
+    const uint32_t bucket_count);
+
+void userfs_bcache_destroy(void);
+
+void userfs_bcache_set_budget(
+    const uint64_t mem_budget);
+
+/*find cached buffer and take a reference, NULL on miss or if cache isn't initialized*/
+userfs_bbuf_t *userfs_bcache_get(
+    const uint32_t space,
+    const uint32_t blocknr,
+    const uint32_t block_s_off,
+    const uint32_t size);
+
+/*hand buffer just read or made to cache with one reference held by caller, return buffer
+caller uses from now on: bbuf itself, or buffer of same key already cached, waited for if
+being read and referenced for caller, bbuf is released then, so a block never has a cached
+and a private copy at once, bbuf stays private only if cache is off or key is held by a
+busy buffer of other shard size*/
+userfs_bbuf_t *userfs_bcache_add(
+    userfs_bbuf_t *bbuf,
+    const uint32_t space);
+
+/*hand buffer not read yet to cache only if block isn't cached, one reference held by
+caller, getters of block wait until userfs_bcache_read_done, return -1 if cached or cache is off*/
+int userfs_bcache_add_reading(
+    userfs_bbuf_t *bbuf,
+    const uint32_t space);
+
+/*buffer added by userfs_bcache_add_reading is filled, res < 0 drops it from cache,
+caller's reference is dropped either way*/
+void userfs_bcache_read_done(
+    userfs_bbuf_t *bbuf,
+    const int      res);
+
+/*drop reference, nothing for private buffers*/
+void userfs_bcache_put(
+    userfs_bbuf_t *bbuf);
+
+void userfs_bcache_put_list(
+    userfs_bbuf_t *buf_list,
+    uint16_t       buf_list_len);
+
+/*remove cached buffer of freed block and release its memory,
+return 0 if cache owned it, -1 if buffer is private*/
+int userfs_bcache_forget(
+    userfs_bbuf_t *bbuf);
+
+/*remove every idle cached shard of freed data block, dirty ones are dropped unwritten,
+shards being read or written are released by their io owner, return shards removed*/
+uint32_t userfs_bcache_forget_dblock(
+    const uint32_t blocknr);
+
+/*buffer has new data, cached ones are queued for write-back thread*/
+void userfs_bcache_mark_dirty(
+    userfs_bbuf_t *bbuf);
+
+/*write buffer now if dirty, first_block and block_size locate it on disk,
+inode part of inode shard is left to file sync*/
+int userfs_bcache_sync(
+    userfs_bbuf_t *bbuf,
+    const uint32_t first_block,
+    const uint32_t block_size);
+
+int userfs_bcache_sync_list(
+    userfs_bbuf_t *buf_list,
+    uint16_t       buf_list_len,
+    const uint32_t first_block,
+    const uint32_t block_size);
+
+/*start thread writing dirty cached buffers of filesystem sb in background,
+params NULL means defaults*/
+int userfs_bcache_writeback_start(
+    const userfs_super_block_t      *sb,
+    const userfs_bcache_wb_params_t *params);
+
+/*stop thread after it wrote every dirty cached buffer*/
+void userfs_bcache_writeback_stop(void);
+
+void userfs_bcache_stat_get(
+    userfs_bcache_stat_t *stat);
+#endif
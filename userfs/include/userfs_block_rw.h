@@ -3,6 +3,43 @@
 #include "vnode.h"
 #include <stdint.h>
 
+/*buffers gathered into one vectored disk io at most*/
+#define USERFS_BBUF_IOV_MAX  64
+/*buffers sorted by disk offset together, longer lists are flushed in batches*/
+#define USERFS_BBUF_IO_BATCH 256
+
+/*bytes of one buffer and where they go on disk*/
+typedef struct userfs_bbuf_io {
+    uint64_t off;
+    uint8_t *data;
+    uint32_t size;
+} userfs_bbuf_io_t;
+
+static inline uint64_t userfs_mbbuf_disk_off(
+    const userfs_bbuf_t *mb_buf,
+    const uint32_t       first_mblock,
+    const uint32_t       metablock_size)
+{
+    return (uint64_t)metablock_size * (uint64_t)(mb_buf->b_blocknr + first_mblock);
+}
+
+static inline uint64_t userfs_dbbuf_disk_off(
+    const userfs_bbuf_t *db_buf,
+    const uint32_t       first_dblock,
+    const uint32_t       dblock_size)
+{
+    return db_buf->b_block_s_off + (uint64_t)dblock_size * (uint64_t)(db_buf->b_blocknr + first_dblock);
+}
+
+/*sort io array by disk offset in place, then read or write one vectored io per run of
+physically adjacent entries*/
+int userfs_bbuf_io_submit(
+    userfs_bbuf_io_t *io,
+    const uint32_t    io_count,
+    const int         write);
+
+/*list flushes write buffers in disk offset order, physically adjacent ones with one
+vectored write*/
 int userfs_mbbuf_list_flush(
     uint32_t       first_mblock,
     uint32_t       metablock_size,
@@ -27,6 +64,13 @@ int userfs_dbbuf_list_read(
     userfs_bbuf_t *buf_list,
     uint16_t       buf_list_len);
 
+/*read buffers in array, physically adjacent ones with one vectored read*/
+int userfs_dbbuf_array_read(
+    uint32_t        first_dblock,
+    uint32_t        dblock_size,
+    userfs_bbuf_t **buf_array,
+    uint32_t        buf_count);
+
 int userfs_read_metadata_block(
     userfs_bbuf_t *mb_buf,
     uint32_t       first_mblock,
@@ -7,6 +7,8 @@
 #include <sys/time.h>
 
 #define USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE (1 << 10 << 10 << 2)
+/*shards of one dblock file ops gather in one pass*/
+#define USERFS_DBLOCK_SHARD_BATCH            64
 
 void userfs_free_dbbuf(
     userfs_bbuf_t *db_buf);
@@ -32,6 +34,23 @@ userfs_bbuf_t *userfs_get_used_dblock(
     uint32_t              dblock_off,
     uint32_t              dblock_shard_size);
 
+/*get shards at dblock_off[0..count) of dblock, count no more than USERFS_DBLOCK_SHARD_BATCH,
+offsets ascending, cached shards come from buffer cache, others are read with one
+vectored read per run of adjacent shards*/
+int userfs_get_used_dblock_shards(
+    userfs_super_block_t *sb,
+    uint32_t              dblock_nr,
+    const uint32_t       *dblock_off,
+    uint32_t              count,
+    uint32_t              dblock_shard_size,
+    userfs_bbuf_t       **db_bufs);
+
+/*get shard caller overwrites whole, zero filled if not cached, never read from disk*/
+userfs_bbuf_t *userfs_get_blank_dblock(
+    uint32_t dblock_nr,
+    uint32_t dblock_off,
+    uint32_t dblock_shard_size);
+
 userfs_bbuf_t *userfs_get_new_inode(
     userfs_super_block_t    *sb,
     userfs_bgd_index_list_t *bgd_idx_list,
@@ -40,6 +40,11 @@ uint32_t userfs_file_read(
     userfs_bbuf_t        *inodebbuf,
     userfs_super_block_t *sb);
 
+/*write file's remaining dirty data, then inode*/
+int userfs_file_fsync(
+    userfs_bbuf_t        *inodebbuf,
+    userfs_super_block_t *sb);
+
 int userfs_file_close(
     const char           *name,
     const uint32_t        name_len,
@@ -0,0 +1,48 @@
+#ifndef USERFS_READAHEAD_H
+#define USERFS_READAHEAD_H
+#include "inode.h"
+#include "vnode.h"
+#include <stdint.h>
+
+/*sequential stream of an open file gets a window of shards read into buffer cache
+ahead of it, window starts at INIT shards, doubles each time stream enters next shard
+and collapses to 0 on random read*/
+#define USERFS_RA_INIT_WINDOW        2
+#define USERFS_RA_DEFAULT_MAX_WINDOW 8
+#define USERFS_RA_DEFAULT_WORKERS    2
+#define USERFS_RA_MAX_WORKERS        8
+
+typedef struct userfs_file_ra {
+    uint64_t next_off;  /* real offset where sequential read goes on */
+    uint32_t cur_shard; /* file shard last read was in */
+    uint32_t ra_end;    /* file shards before it are read ahead or queued */
+    uint32_t window;    /* shards read ahead of current one, 0 means random access */
+    uint32_t inflight;  /* queued and running requests, under readahead lock */
+} userfs_file_ra_t;
+
+typedef struct userfs_ra_params {
+    uint32_t workers;
+    uint32_t max_window;
+} userfs_ra_params_t;
+
+/*start workers reading shards of filesystem sb into buffer cache, params NULL means defaults*/
+int userfs_readahead_start(
+    const userfs_super_block_t *sb,
+    const userfs_ra_params_t   *params);
+
+/*drop queued requests and stop workers*/
+void userfs_readahead_stop(void);
+
+/*file read of size bytes at real_roff (inode space included) succeeded,
+detect pattern and queue shards ahead of sequential stream*/
+void userfs_readahead_update(
+    userfs_bbuf_t *inodebbuf,
+    const uint32_t real_roff,
+    const uint32_t size,
+    const uint32_t dblock_shard_size);
+
+/*drop queued requests of file, wait for running ones and free its state,
+called at last close, before file buffers are put*/
+void userfs_readahead_release(
+    userfs_bbuf_t *inodebbuf);
+#endif
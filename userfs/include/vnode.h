@@ -5,13 +5,21 @@
 #include <stdint.h>
 
 struct block_buffer {
-    struct block_buffer *b_this_page; /* circular list of page's buffers */
-    uint16_t             b_list_len;
-    uint32_t             b_type;    /*block type:metadata block or data block*/
-    uint32_t             b_blocknr; /* start block number */
-    uint32_t             b_block_s_off;
-    uint32_t             b_size;
-    uint8_t             *b_data; /* pointer to data within the page */
+    struct block_buffer   *b_this_page; /* circular list of page's buffers */
+    uint16_t               b_list_len;
+    uint32_t               b_type;    /*block type:metadata block or data block*/
+    uint32_t               b_blocknr; /* start block number */
+    uint32_t               b_block_s_off;
+    uint32_t               b_size;
+    uint8_t               *b_data; /* pointer to data within the page */
+    /*buffer cache state, lists and count only touched under cache lock*/
+    uint32_t               b_state;    /* USERFS_BBUF_* flags, changed atomically */
+    uint32_t               b_count;    /* users holding cached buffer, 0 means evictable */
+    list_t                 b_hash;     /* chain in cache hash bucket */
+    list_t                 b_clock;    /* position in cache clock ring */
+    list_t                 b_dirty;    /* position in cache dirty list, oldest first */
+    uint64_t               b_dirty_ns; /* when buffer became dirty */
+    struct userfs_file_ra *b_ra;       /* readahead state of open file, inode buf only */
 };
 
 typedef struct block_buffer                  userfs_bbuf_t;
@@ -38,6 +46,38 @@ struct block_group_descriptors_index_list_ops {
         uint32_t                                   bgi_bgroup_nr);
 };
 
+/*block buffer state*/
+#define USERFS_BBUF_CACHED      (1u << 0) /* owned by buffer cache */
+#define USERFS_BBUF_META        (1u << 1) /* metadata block, blocknr counts from first mblock */
+#define USERFS_BBUF_REFERENCED  (1u << 2) /* clock bit, hit since hand last passed */
+#define USERFS_BBUF_DIRTY       (1u << 3) /* shard data differs from disk */
+#define USERFS_BBUF_WRITEBACK   (1u << 4) /* being written, buffer pinned */
+#define USERFS_BBUF_INODE       (1u << 5) /* first shard of file, starts with inode */
+#define USERFS_BBUF_INODE_DIRTY (1u << 6) /* inode differs from disk, written by file sync only */
+#define USERFS_BBUF_READING     (1u << 7) /* being filled from disk, getters wait for it */
+#define USERFS_BBUF_READAHEAD   (1u << 8) /* prefetched, not used by any read yet */
+
+static inline void userfs_bbuf_set_state(
+    struct block_buffer *bbuf,
+    const uint32_t       flags)
+{
+    __atomic_fetch_or(&(bbuf->b_state), flags, __ATOMIC_RELAXED);
+}
+
+static inline void userfs_bbuf_clear_state(
+    struct block_buffer *bbuf,
+    const uint32_t       flags)
+{
+    __atomic_fetch_and(&(bbuf->b_state), ~flags, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t userfs_bbuf_test_state(
+    const struct block_buffer *bbuf,
+    const uint32_t             flags)
+{
+    return __atomic_load_n(&(bbuf->b_state), __ATOMIC_RELAXED) & flags;
+}
+
 #define USERFS_NAME2INODE    0
 #define USERFS_NAME2INODEBUF 1
 
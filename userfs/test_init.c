@@ -1,10 +1,12 @@
 #include "disk_ops.h"
 #include "inode.h"
 #include "log.h"
+#include "userfs_bcache.h"
 #include "userfs_block_rw.h"
 #include "userfs_dentry_hash.h"
 #include "userfs_file_ctrl.h"
 #include "userfs_file_ops.h"
+#include "userfs_readahead.h"
 #include "vnode.h"
 #include <malloc.h>
 #include <stdint.h>
@@ -66,6 +68,7 @@ int main(int argc, char **argv)
 {
     /*filesystem create*/
     userfs_disk_open("./userfs_disk");
+    userfs_bcache_init(USERFS_BCACHE_DEFAULT_BUDGET, USERFS_BCACHE_DEFAULT_BUCKET_COUNT);
 #if USERFS_CREATE == 1
     uint32_t       real_block_size;
     userfs_bbuf_t *sb_bbuf;
@@ -117,6 +120,10 @@ int main(int argc, char **argv)
     userfs_bbuf_t *mount_dentry_table  = NULL;
     userfs_bbuf_t *mount_sb_buf =
         userfs_mount_init(UFS_METABLOCK_SIZE, 0, &mount_bg_desc_table, &mount_dentry_table);
+    if (!mount_sb_buf) {
+        LOG_DESC(ERR, "Main", "Mount failed");
+        exit(1);
+    }
     userfs_super_block_t *mount_sb = USERFS_MBLOCK(mount_sb_buf->b_data)->sb;
     LOG_DESC(DBG, "Main", "dblock count:%u, dblock size:0x%xB, mblock size:0x%xB, mblock count:%u, f_mblock count:%u, first mblock:%u, mblock bitmap len:%u",
              mount_sb->s_data_block_count,
@@ -148,6 +155,9 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    userfs_bcache_writeback_start(mount_sb, NULL);
+    userfs_readahead_start(mount_sb, NULL);
+
 #define TEST_FILE_COUNT 32
     userfs_bbuf_t *inodebbuf[TEST_FILE_COUNT];
     char           filename[TEST_FILE_COUNT];
@@ -216,6 +226,24 @@ int main(int argc, char **argv)
         roff += rlen;
     }
 
+    /*one call crossing shards and into next dblock, read back in one call too*/
+    static char cross_wbuf[1 << 10 << 10 << 3];
+    static char cross_rbuf[sizeof(cross_wbuf)];
+    uint32_t    cross_off = mount_sb->s_data_block_size * 5 - (sizeof(cross_wbuf) >> 1) + 512;
+    for (uint32_t i = 0; i < sizeof(cross_wbuf); i++) {
+        cross_wbuf[i] = 'a' + (i * 7 + i / 4096) % 26;
+    }
+    uint32_t cross_wsize = userfs_file_write(cross_wbuf, cross_off, sizeof(cross_wbuf), USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE,
+                                             write_inodebbuf, mount_sb, mount_bgd_idx_list);
+    uint32_t cross_rsize = userfs_file_read(cross_rbuf, cross_off, sizeof(cross_rbuf), USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE,
+                                            write_inodebbuf, mount_sb);
+    LOG_DESC(DBG, "Main", "Cross shard io, wsize:0x%x, rsize:0x%x, match:%d", cross_wsize, cross_rsize,
+             cross_rsize == sizeof(cross_rbuf) && !memcmp(cross_wbuf, cross_rbuf, sizeof(cross_rbuf)));
+
+    if (userfs_file_fsync(write_inodebbuf, mount_sb) < 0) {
+        LOG_DESC(ERR, "Main", "Fsync file:%s FAILED", filename);
+    }
+
     roff = mount_sb->s_data_block_size << 2;
     for (int i = 0; i < wtimes; i++) {
         char     read_buf[32] = {0};
@@ -227,10 +255,52 @@ int main(int argc, char **argv)
     }
     userfs_file_close(filename, strlen(filename), USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE, mount_sb, dentry_hashtable);
 
+    /*reopen closed file, inode and data shards come from buffer cache*/
+    userfs_bcache_stat_t bcache_stat = {0};
+    userfs_bcache_stat_get(&bcache_stat);
+    uint64_t reopen_misses = bcache_stat.misses;
+    write_inodebbuf        = userfs_file_open(filename, strlen(filename), USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE,
+                                              mount_sb, dentry_hashtable);
+    roff                   = mount_sb->s_data_block_size << 2;
+    for (int i = 0; write_inodebbuf && i < wtimes; i++) {
+        char     read_buf[32] = {0};
+        uint32_t rlen         = 32;
+        uint32_t rsize        = userfs_file_read(read_buf, roff, rlen, USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE,
+                                                 write_inodebbuf, mount_sb);
+        LOG_DESC(DBG, "Main", "Reopen read test:%s", read_buf);
+        roff += rlen;
+    }
+    /*stream through shards of first dblock, shards ahead of it come from readahead*/
+    static char stream_buf[1 << 16];
+    uint64_t    stream_bytes = 0;
+    roff                     = USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE - USERFS_INODE_SIZE;
+    for (int i = 0; write_inodebbuf && i < (USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE / sizeof(stream_buf)) * 3; i++) {
+        uint32_t rsize = userfs_file_read(stream_buf, roff, sizeof(stream_buf), USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE,
+                                          write_inodebbuf, mount_sb);
+        if (!rsize) {
+            break;
+        }
+        stream_bytes += rsize;
+        roff         += rsize;
+    }
+    userfs_file_close(filename, strlen(filename), USERFS_DEFAULT_DATA_BLOCK_SHARD_SIZE, mount_sb, dentry_hashtable);
+    userfs_bcache_stat_get(&bcache_stat);
+    LOG_DESC(DBG, "Main", "Buffer cache hits:%lu, misses:%lu, reopen misses:%lu, evictions:%lu, buffers:%u, bytes:0x%lx, budget:0x%lx, "
+             "dirty bytes:0x%lx, writebacks:%lu, stream bytes:0x%lx, readaheads:%lu, readahead hits:%lu",
+             bcache_stat.hits, bcache_stat.misses, bcache_stat.misses - reopen_misses, bcache_stat.evictions,
+             bcache_stat.buffers, bcache_stat.bytes, bcache_stat.budget, bcache_stat.dirty_bytes, bcache_stat.writebacks,
+             stream_bytes, bcache_stat.readaheads, bcache_stat.readahead_hits);
+
+    userfs_readahead_stop();
+
+    /*every dirty cached buffer is on disk once thread stops*/
+    userfs_bcache_writeback_stop();
+
     userfs_mbbuf_list_flush(mount_sb->s_first_metablock, mount_sb->s_metablock_size, mount_sb_buf, mount_sb_buf->b_list_len);
     userfs_mbbuf_list_flush(mount_sb->s_first_metablock, mount_sb->s_metablock_size, mount_bg_desc_table, mount_bg_desc_table->b_list_len);
     userfs_mbbuf_list_flush(mount_sb->s_first_metablock, mount_sb->s_metablock_size, mount_dentry_table, mount_dentry_table->b_list_len);
 
     user_disk_close();
+    userfs_bcache_destroy();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,786 @@
+#include "userfs_bcache.h"
+#include "inode.h"
+#include "list.h"
+#include "log.h"
+#include "userfs_block_rw.h"
+#include "vnode.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct userfs_bcache {
+    pthread_mutex_t lock;
+    list_t         *bucket;
+    uint32_t        bucket_count;
+    /*ring of every cached buffer, hand points at next one CLOCK looks at*/
+    list_t          clock;
+    list_t         *hand;
+    uint64_t        budget;
+    uint64_t        bytes;
+    uint32_t        buffers;
+    uint64_t        hits;
+    uint64_t        misses;
+    uint64_t        evictions;
+    /*dirty cached buffers, oldest first*/
+    list_t          dirty;
+    uint64_t        dirty_bytes;
+    uint64_t        writebacks;
+    uint64_t        readaheads;
+    uint64_t        readahead_hits;
+    /*signaled when a buffer read or write finishes*/
+    pthread_cond_t  io_done;
+    /*write-back thread and where buffers go on disk*/
+    pthread_t       wb_thread;
+    pthread_cond_t  wb_wakeup;
+    int             wb_running;
+    uint64_t        wb_interval_ns;
+    uint64_t        wb_expire_ns;
+    uint64_t        wb_dirty_limit;
+    uint32_t        first_dblock;
+    uint32_t        dblock_size;
+    uint32_t        first_mblock;
+    uint32_t        mblock_size;
+} userfs_bcache_t;
+
+static userfs_bcache_t g_bcache = {.lock = PTHREAD_MUTEX_INITIALIZER, .io_done = PTHREAD_COND_INITIALIZER};
+
+static inline uint64_t userfs_bcache_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint32_t userfs_bcache_hash(
+    const uint32_t space,
+    const uint32_t blocknr,
+    const uint32_t block_s_off)
+{
+    uint64_t key = ((uint64_t)blocknr << 32 | block_s_off) ^ ((uint64_t)space << 63);
+    key         *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(key >> 32) % g_bcache.bucket_count;
+}
+
+static inline uint32_t userfs_bcache_space(
+    const userfs_bbuf_t *bbuf)
+{
+    return userfs_bbuf_test_state(bbuf, USERFS_BBUF_META) ? USERFS_BCACHE_META : USERFS_BCACHE_DATA;
+}
+
+static userfs_bbuf_t *userfs_bcache_lookup(
+    const uint32_t space,
+    const uint32_t blocknr,
+    const uint32_t block_s_off)
+{
+    list_t        *head = &(g_bcache.bucket[userfs_bcache_hash(space, blocknr, block_s_off)]);
+    userfs_bbuf_t *bbuf = NULL;
+    list_for_each_entry(bbuf, head, userfs_bbuf_t, b_hash)
+    {
+        if (bbuf->b_blocknr == blocknr && bbuf->b_block_s_off == block_s_off && userfs_bcache_space(bbuf) == space) {
+            return bbuf;
+        }
+    }
+    return NULL;
+}
+
+static void userfs_bcache_unlink(
+    userfs_bbuf_t *bbuf)
+{
+    if (g_bcache.hand == &(bbuf->b_clock)) {
+        g_bcache.hand = bbuf->b_clock.next;
+    }
+    if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_DIRTY)) {
+        list_remove(&(bbuf->b_dirty));
+        g_bcache.dirty_bytes -= bbuf->b_size;
+    }
+    list_remove(&(bbuf->b_hash));
+    list_remove(&(bbuf->b_clock));
+    g_bcache.bytes   -= bbuf->b_size;
+    g_bcache.buffers -= 1;
+    userfs_bbuf_clear_state(bbuf, USERFS_BBUF_CACHED | USERFS_BBUF_REFERENCED | USERFS_BBUF_DIRTY);
+}
+
+static void userfs_bcache_release(
+    userfs_bbuf_t *bbuf)
+{
+    USERFS_MEM_FREE(bbuf->b_data);
+    USERFS_MEM_FREE(bbuf);
+}
+
+static void userfs_bcache_dirty_locked(
+    userfs_bbuf_t *bbuf)
+{
+    if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_DIRTY)) {
+        return;
+    }
+    userfs_bbuf_set_state(bbuf, USERFS_BBUF_DIRTY);
+    bbuf->b_dirty_ns      = userfs_bcache_now_ns();
+    list_add_tail(&(bbuf->b_dirty), &(g_bcache.dirty));
+    g_bcache.dirty_bytes += bbuf->b_size;
+    if (g_bcache.wb_running && g_bcache.dirty_bytes > g_bcache.wb_dirty_limit) {
+        pthread_cond_signal(&(g_bcache.wb_wakeup));
+    }
+}
+
+/*inode part of inode shard is left out, inode refers open shards by buffer address,
+only file sync writes it*/
+static void userfs_bcache_io_fill(
+    userfs_bbuf_t    *bbuf,
+    const uint32_t    first_block,
+    const uint32_t    block_size,
+    userfs_bbuf_io_t *io)
+{
+    io->data = bbuf->b_data;
+    io->size = bbuf->b_size;
+    if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_META)) {
+        io->off = userfs_mbbuf_disk_off(bbuf, first_block, block_size);
+        return;
+    }
+    io->off = userfs_dbbuf_disk_off(bbuf, first_block, block_size);
+    if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_INODE)) {
+        io->off  += USERFS_INODE_SIZE;
+        io->data += USERFS_INODE_SIZE;
+        io->size -= USERFS_INODE_SIZE;
+    }
+}
+
+/*called with lock held, buffer leaves dirty list and stays pinned until its write ends,
+data written after dirty bit was cleared dirties it again*/
+static void userfs_bcache_writeout_begin(
+    userfs_bbuf_t *bbuf)
+{
+    list_remove(&(bbuf->b_dirty));
+    g_bcache.dirty_bytes -= bbuf->b_size;
+    userfs_bbuf_clear_state(bbuf, USERFS_BBUF_DIRTY);
+    userfs_bbuf_set_state(bbuf, USERFS_BBUF_WRITEBACK);
+    bbuf->b_count++;
+}
+
+/*called and returns with lock held, lock is dropped while buffers begun by
+userfs_bcache_writeout_begin are written with sorted and coalesced io,
+all of them are dirty again if any write fails*/
+static int userfs_bcache_writeout(
+    userfs_bbuf_t   **bufs,
+    userfs_bbuf_io_t *io,
+    const uint32_t    count)
+{
+    pthread_mutex_unlock(&(g_bcache.lock));
+
+    int res = userfs_bbuf_io_submit(io, count, 1);
+
+    pthread_mutex_lock(&(g_bcache.lock));
+    for (uint32_t i = 0; i < count; i++) {
+        userfs_bbuf_t *bbuf = bufs[i];
+        bbuf->b_count--;
+        userfs_bbuf_clear_state(bbuf, USERFS_BBUF_WRITEBACK);
+        if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_CACHED)) {
+            /*block was freed while written*/
+            userfs_bcache_release(bbuf);
+            continue;
+        }
+        if (res < 0) {
+            userfs_bcache_dirty_locked(bbuf);
+        }
+    }
+    pthread_cond_broadcast(&(g_bcache.io_done));
+    return res;
+}
+
+static inline void userfs_bcache_geometry(
+    const userfs_bbuf_t *bbuf,
+    uint32_t            *first_block,
+    uint32_t            *block_size)
+{
+    *first_block = userfs_bbuf_test_state(bbuf, USERFS_BBUF_META) ? g_bcache.first_mblock : g_bcache.first_dblock;
+    *block_size  = userfs_bbuf_test_state(bbuf, USERFS_BBUF_META) ? g_bcache.mblock_size : g_bcache.dblock_size;
+}
+
+/*idle dirty buffer is about to be replaced, keep its data*/
+static int userfs_bcache_clean_idle(
+    userfs_bbuf_t *bbuf)
+{
+    uint32_t first_block;
+    uint32_t block_size;
+    userfs_bcache_geometry(bbuf, &first_block, &block_size);
+    if (!block_size) {
+        LOG_DESC(WAR, "USERFS BCACHE", "Write-back not started, cannot write dirty buf:%p, block nr:%u",
+                 bbuf, bbuf->b_blocknr);
+        return -1;
+    }
+    userfs_bbuf_io_t io;
+    userfs_bcache_io_fill(bbuf, first_block, block_size, &io);
+    userfs_bcache_writeout_begin(bbuf);
+    /*buffer may be gone or busy again after lock was dropped, caller looks it up again*/
+    return userfs_bcache_writeout(&bbuf, &io, 1);
+}
+
+/*CLOCK: sweep from hand, skip busy and dirty buffers, give referenced ones a second chance,
+two rounds are enough to find an idle one if any exists*/
+static int userfs_bcache_evict_one(void)
+{
+    for (uint32_t i = 0; i < 2 * g_bcache.buffers + 1; i++) {
+        list_t *cur   = g_bcache.hand;
+        g_bcache.hand = cur->next;
+        if (cur == &(g_bcache.clock)) {
+            continue;
+        }
+        userfs_bbuf_t *bbuf = container_of(cur, userfs_bbuf_t, b_clock);
+        if (bbuf->b_count || userfs_bbuf_test_state(bbuf, USERFS_BBUF_DIRTY)) {
+            continue;
+        }
+        if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_REFERENCED)) {
+            userfs_bbuf_clear_state(bbuf, USERFS_BBUF_REFERENCED);
+            continue;
+        }
+        LOG_DESC(DBG, "USERFS BCACHE", "Evict buf:%p, block nr:%u, in block off:0x%x, size:0x%x, cached bytes:0x%lx",
+                 bbuf, bbuf->b_blocknr, bbuf->b_block_s_off, bbuf->b_size, g_bcache.bytes);
+        userfs_bcache_unlink(bbuf);
+        userfs_bcache_release(bbuf);
+        g_bcache.evictions++;
+        return 0;
+    }
+    return -1;
+}
+
+/*busy and dirty buffers can't go, cache may stay over budget until they are put
+or written back*/
+static void userfs_bcache_shrink(
+    const uint64_t need)
+{
+    while (g_bcache.bytes + need > g_bcache.budget) {
+        if (userfs_bcache_evict_one() < 0) {
+            if (g_bcache.wb_running && g_bcache.dirty_bytes) {
+                pthread_cond_signal(&(g_bcache.wb_wakeup));
+            }
+            break;
+        }
+    }
+}
+
+/*lock held, buffer gets one reference for caller*/
+/*take reference for caller, under lock*/
+static void userfs_bcache_hold(
+    userfs_bbuf_t *bbuf)
+{
+    /*idle buffer isn't on any file's buffer list anymore*/
+    if (bbuf->b_count++ == 0) {
+        bbuf->b_this_page = NULL;
+        bbuf->b_list_len  = 1;
+    }
+    userfs_bbuf_set_state(bbuf, USERFS_BBUF_REFERENCED);
+    if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_READAHEAD)) {
+        userfs_bbuf_clear_state(bbuf, USERFS_BBUF_READAHEAD);
+        g_bcache.readahead_hits++;
+    }
+}
+
+static void userfs_bcache_insert(
+    userfs_bbuf_t *bbuf,
+    const uint32_t space)
+{
+    userfs_bcache_shrink(bbuf->b_size);
+
+    userfs_bbuf_clear_state(bbuf, USERFS_BBUF_REFERENCED | USERFS_BBUF_DIRTY | USERFS_BBUF_META);
+    userfs_bbuf_set_state(bbuf, USERFS_BBUF_CACHED | (space == USERFS_BCACHE_META ? USERFS_BBUF_META : 0));
+    bbuf->b_count = 1;
+    list_add(&(bbuf->b_hash), &(g_bcache.bucket[userfs_bcache_hash(space, bbuf->b_blocknr, bbuf->b_block_s_off)]));
+    /*just behind hand, so new buffer is looked at last*/
+    list_add_tail(&(bbuf->b_clock), g_bcache.hand);
+    g_bcache.bytes   += bbuf->b_size;
+    g_bcache.buffers += 1;
+}
+
+int userfs_bcache_init(
+    const uint64_t mem_budget,
+    const uint32_t bucket_count)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    if (g_bcache.bucket) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        LOG_DESC(ERR, "USERFS BCACHE", "Buffer cache already initialized");
+        return -1;
+    }
+    uint32_t count  = bucket_count ? bucket_count : USERFS_BCACHE_DEFAULT_BUCKET_COUNT;
+    list_t  *bucket = USERFS_MEM_ALLOC(sizeof(list_t) * count);
+    if (!bucket) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        LOG_DESC(ERR, "USERFS BCACHE", "Alloc hash buckets failed, bucket count:%u", count);
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        INIT_LIST_HEAD(&(bucket[i]));
+    }
+    INIT_LIST_HEAD(&(g_bcache.clock));
+    INIT_LIST_HEAD(&(g_bcache.dirty));
+    g_bcache.hand           = &(g_bcache.clock);
+    g_bcache.bucket_count   = count;
+    g_bcache.budget         = mem_budget ? mem_budget : USERFS_BCACHE_DEFAULT_BUDGET;
+    g_bcache.bytes          = 0;
+    g_bcache.buffers        = 0;
+    g_bcache.hits           = 0;
+    g_bcache.misses         = 0;
+    g_bcache.evictions      = 0;
+    g_bcache.dirty_bytes    = 0;
+    g_bcache.writebacks     = 0;
+    g_bcache.readaheads     = 0;
+    g_bcache.readahead_hits = 0;
+    g_bcache.bucket         = bucket;
+    pthread_mutex_unlock(&(g_bcache.lock));
+    LOG_DESC(DBG, "USERFS BCACHE", "Buffer cache init, budget:0x%lxB, bucket count:%u", g_bcache.budget, count);
+    return 0;
+}
+
+void userfs_bcache_destroy(void)
+{
+    userfs_bcache_writeback_stop();
+    pthread_mutex_lock(&(g_bcache.lock));
+    if (!g_bcache.bucket) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        return;
+    }
+    while (g_bcache.clock.next != &(g_bcache.clock)) {
+        userfs_bbuf_t *bbuf = container_of(g_bcache.clock.next, userfs_bbuf_t, b_clock);
+        userfs_bcache_unlink(bbuf);
+        userfs_bcache_release(bbuf);
+    }
+    /*cache is off after this, get and add miss, init may set it up again*/
+    USERFS_MEM_FREE(g_bcache.bucket);
+    g_bcache.bucket       = NULL;
+    g_bcache.bucket_count = 0;
+    INIT_LIST_HEAD(&(g_bcache.clock));
+    INIT_LIST_HEAD(&(g_bcache.dirty));
+    g_bcache.hand         = &(g_bcache.clock);
+    g_bcache.bytes        = 0;
+    g_bcache.buffers      = 0;
+    g_bcache.dirty_bytes  = 0;
+    pthread_mutex_unlock(&(g_bcache.lock));
+}
+
+void userfs_bcache_set_budget(
+    const uint64_t mem_budget)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    g_bcache.budget = mem_budget ? mem_budget : USERFS_BCACHE_DEFAULT_BUDGET;
+    if (g_bcache.bucket) {
+        userfs_bcache_shrink(0);
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+}
+
+userfs_bbuf_t *userfs_bcache_get(
+    const uint32_t space,
+    const uint32_t blocknr,
+    const uint32_t block_s_off,
+    const uint32_t size)
+{
+    if (!g_bcache.bucket) {
+        return NULL;
+    }
+    pthread_mutex_lock(&(g_bcache.lock));
+    userfs_bbuf_t *bbuf = userfs_bcache_lookup(space, blocknr, block_s_off);
+    /*block is being read, by readahead mostly, wait for it instead of reading it again,
+    failed read drops it*/
+    while (bbuf && userfs_bbuf_test_state(bbuf, USERFS_BBUF_READING)) {
+        pthread_cond_wait(&(g_bcache.io_done), &(g_bcache.lock));
+        bbuf = userfs_bcache_lookup(space, blocknr, block_s_off);
+    }
+    /*buffer of other shard size can't serve this request, caller reads and replaces it,
+    so disk must have its data first*/
+    if (bbuf && bbuf->b_size != size && !bbuf->b_count && userfs_bbuf_test_state(bbuf, USERFS_BBUF_DIRTY)) {
+        userfs_bcache_clean_idle(bbuf);
+        bbuf = userfs_bcache_lookup(space, blocknr, block_s_off);
+    }
+    if (!bbuf || bbuf->b_size != size) {
+        g_bcache.misses++;
+        pthread_mutex_unlock(&(g_bcache.lock));
+        return NULL;
+    }
+    userfs_bcache_hold(bbuf);
+    g_bcache.hits++;
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return bbuf;
+}
+
+userfs_bbuf_t *userfs_bcache_add(
+    userfs_bbuf_t *bbuf,
+    const uint32_t space)
+{
+    if (!g_bcache.bucket) {
+        return bbuf;
+    }
+    pthread_mutex_lock(&(g_bcache.lock));
+    userfs_bbuf_t *old = userfs_bcache_lookup(space, bbuf->b_blocknr, bbuf->b_block_s_off);
+    /*readahead may have cached block since caller missed it, its data is as new as ours*/
+    while (old && userfs_bbuf_test_state(old, USERFS_BBUF_READING)) {
+        pthread_cond_wait(&(g_bcache.io_done), &(g_bcache.lock));
+        old = userfs_bcache_lookup(space, bbuf->b_blocknr, bbuf->b_block_s_off);
+    }
+    /*cached copy may be newer than disk, caller switches to it*/
+    if (old && old->b_size == bbuf->b_size) {
+        userfs_bcache_hold(old);
+        pthread_mutex_unlock(&(g_bcache.lock));
+        LOG_DESC(DBG, "USERFS BCACHE", "Block already cached, block nr:%u, in block off:0x%x, cached buf:%p, dropped buf:%p",
+                 bbuf->b_blocknr, bbuf->b_block_s_off, old, bbuf);
+        userfs_bcache_release(bbuf);
+        return old;
+    }
+    if (old && !old->b_count && userfs_bbuf_test_state(old, USERFS_BBUF_DIRTY)) {
+        if (userfs_bcache_clean_idle(old) < 0) {
+            pthread_mutex_unlock(&(g_bcache.lock));
+            LOG_DESC(WAR, "USERFS BCACHE", "Cached dirty buf of block nr:%u cannot be replaced", bbuf->b_blocknr);
+            return bbuf;
+        }
+        old = userfs_bcache_lookup(space, bbuf->b_blocknr, bbuf->b_block_s_off);
+    }
+    if (old) {
+        if (old->b_count || userfs_bbuf_test_state(old, USERFS_BBUF_DIRTY)) {
+            pthread_mutex_unlock(&(g_bcache.lock));
+            LOG_DESC(WAR, "USERFS BCACHE", "Block cached with other shard size and in use, block nr:%u, in block off:0x%x, cached buf:%p, new buf:%p",
+                     bbuf->b_blocknr, bbuf->b_block_s_off, old, bbuf);
+            return bbuf;
+        }
+        userfs_bcache_unlink(old);
+        userfs_bcache_release(old);
+    }
+    userfs_bcache_insert(bbuf, space);
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return bbuf;
+}
+
+int userfs_bcache_add_reading(
+    userfs_bbuf_t *bbuf,
+    const uint32_t space)
+{
+    if (!g_bcache.bucket) {
+        return -1;
+    }
+    pthread_mutex_lock(&(g_bcache.lock));
+    /*cached copy may be newer than disk, never replace it*/
+    if (userfs_bcache_lookup(space, bbuf->b_blocknr, bbuf->b_block_s_off)) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        return -1;
+    }
+    userfs_bbuf_set_state(bbuf, USERFS_BBUF_READING);
+    userfs_bcache_insert(bbuf, space);
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return 0;
+}
+
+void userfs_bcache_read_done(
+    userfs_bbuf_t *bbuf,
+    const int      res)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    userfs_bbuf_clear_state(bbuf, USERFS_BBUF_READING);
+    pthread_cond_broadcast(&(g_bcache.io_done));
+    /*getters waited instead of taking a reference, caller holds the only one*/
+    bbuf->b_count = 0;
+    if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_CACHED)) {
+        /*block was freed while read*/
+        userfs_bcache_release(bbuf);
+    } else if (res < 0) {
+        userfs_bcache_unlink(bbuf);
+        userfs_bcache_release(bbuf);
+    } else {
+        if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_READAHEAD)) {
+            g_bcache.readaheads++;
+        }
+        if (g_bcache.bytes > g_bcache.budget) {
+            userfs_bcache_shrink(0);
+        }
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+}
+
+void userfs_bcache_put(
+    userfs_bbuf_t *bbuf)
+{
+    if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_CACHED)) {
+        return;
+    }
+    pthread_mutex_lock(&(g_bcache.lock));
+    if (bbuf->b_count && --bbuf->b_count == 0 && g_bcache.bytes > g_bcache.budget) {
+        userfs_bcache_shrink(0);
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+}
+
+void userfs_bcache_put_list(
+    userfs_bbuf_t *buf_list,
+    uint16_t       buf_list_len)
+{
+    for (int i = 0; i < buf_list_len && buf_list; i++) {
+        /*buffer may be evicted as soon as it is put*/
+        userfs_bbuf_t *next = buf_list->b_this_page;
+        userfs_bcache_put(buf_list);
+        buf_list = next;
+    }
+}
+
+int userfs_bcache_forget(
+    userfs_bbuf_t *bbuf)
+{
+    if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_CACHED)) {
+        return -1;
+    }
+    pthread_mutex_lock(&(g_bcache.lock));
+    userfs_bcache_unlink(bbuf);
+    /*buffer being written or read is released by its io owner*/
+    int in_io = userfs_bbuf_test_state(bbuf, USERFS_BBUF_WRITEBACK | USERFS_BBUF_READING);
+    pthread_mutex_unlock(&(g_bcache.lock));
+    if (!in_io) {
+        userfs_bcache_release(bbuf);
+    }
+    return 0;
+}
+
+uint32_t userfs_bcache_forget_dblock(
+    const uint32_t blocknr)
+{
+    uint32_t count = 0;
+    pthread_mutex_lock(&(g_bcache.lock));
+    if (!g_bcache.bucket) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        return 0;
+    }
+    /*shards of a block hash apart, freeing blocks is rare, so walk every buffer*/
+    list_t *cur = g_bcache.clock.next;
+    while (cur != &(g_bcache.clock)) {
+        userfs_bbuf_t *bbuf = container_of(cur, userfs_bbuf_t, b_clock);
+        cur                 = cur->next;
+        if (bbuf->b_blocknr != blocknr || userfs_bbuf_test_state(bbuf, USERFS_BBUF_META)) {
+            continue;
+        }
+        int in_io = userfs_bbuf_test_state(bbuf, USERFS_BBUF_WRITEBACK | USERFS_BBUF_READING);
+        if (bbuf->b_count && !in_io) {
+            LOG_DESC(WAR, "USERFS BCACHE", "Shard of freed dblock still held, buf:%p, dblock nr:%u, in block off:0x%x, refcount:%u",
+                     bbuf, blocknr, bbuf->b_block_s_off, bbuf->b_count);
+            continue;
+        }
+        userfs_bcache_unlink(bbuf);
+        if (!in_io) {
+            userfs_bcache_release(bbuf);
+        }
+        count++;
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return count;
+}
+
+void userfs_bcache_mark_dirty(
+    userfs_bbuf_t *bbuf)
+{
+    if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_CACHED)) {
+        userfs_bbuf_set_state(bbuf, USERFS_BBUF_DIRTY);
+        return;
+    }
+    pthread_mutex_lock(&(g_bcache.lock));
+    userfs_bcache_dirty_locked(bbuf);
+    pthread_mutex_unlock(&(g_bcache.lock));
+}
+
+int userfs_bcache_sync(
+    userfs_bbuf_t *bbuf,
+    const uint32_t first_block,
+    const uint32_t block_size)
+{
+    userfs_bbuf_io_t io;
+    if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_CACHED)) {
+        if (!userfs_bbuf_test_state(bbuf, USERFS_BBUF_DIRTY)) {
+            return 0;
+        }
+        userfs_bbuf_clear_state(bbuf, USERFS_BBUF_DIRTY);
+        userfs_bcache_io_fill(bbuf, first_block, block_size, &io);
+        if (userfs_bbuf_io_submit(&io, 1, 1) < 0) {
+            userfs_bbuf_set_state(bbuf, USERFS_BBUF_DIRTY);
+            return -1;
+        }
+        return 0;
+    }
+    int res = 0;
+    pthread_mutex_lock(&(g_bcache.lock));
+    /*write-back thread may be writing it, its write may miss newer data*/
+    while (userfs_bbuf_test_state(bbuf, USERFS_BBUF_WRITEBACK)) {
+        pthread_cond_wait(&(g_bcache.io_done), &(g_bcache.lock));
+    }
+    if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_DIRTY)) {
+        userfs_bcache_io_fill(bbuf, first_block, block_size, &io);
+        userfs_bcache_writeout_begin(bbuf);
+        res = userfs_bcache_writeout(&bbuf, &io, 1);
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return res;
+}
+
+int userfs_bcache_sync_list(
+    userfs_bbuf_t *buf_list,
+    uint16_t       buf_list_len,
+    const uint32_t first_block,
+    const uint32_t block_size)
+{
+    userfs_bbuf_t   *bufs[USERFS_BBUF_IO_BATCH];
+    userfs_bbuf_io_t io[USERFS_BBUF_IO_BATCH];
+    uint32_t         count = 0;
+    int              res   = 0;
+    pthread_mutex_lock(&(g_bcache.lock));
+    for (int i = 0; i < buf_list_len && buf_list; i++, buf_list = buf_list->b_this_page) {
+        if (!userfs_bbuf_test_state(buf_list, USERFS_BBUF_CACHED)) {
+            /*private buffer, nobody else writes it*/
+            pthread_mutex_unlock(&(g_bcache.lock));
+            if (userfs_bcache_sync(buf_list, first_block, block_size) < 0) {
+                res = -1;
+            }
+            pthread_mutex_lock(&(g_bcache.lock));
+            continue;
+        }
+        while (userfs_bbuf_test_state(buf_list, USERFS_BBUF_WRITEBACK)) {
+            pthread_cond_wait(&(g_bcache.io_done), &(g_bcache.lock));
+        }
+        if (!userfs_bbuf_test_state(buf_list, USERFS_BBUF_DIRTY)) {
+            continue;
+        }
+        /*dirty shards of a file are written together, adjacent ones with one io*/
+        userfs_bcache_io_fill(buf_list, first_block, block_size, &(io[count]));
+        userfs_bcache_writeout_begin(buf_list);
+        bufs[count++] = buf_list;
+        if (count == USERFS_BBUF_IO_BATCH) {
+            res   |= userfs_bcache_writeout(bufs, io, count);
+            count  = 0;
+        }
+    }
+    if (count) {
+        res |= userfs_bcache_writeout(bufs, io, count);
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return res < 0 ? -1 : 0;
+}
+
+static void *userfs_bcache_writeback_thread(
+    void *arg)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    while (1) {
+        int      stop = !g_bcache.wb_running;
+        uint64_t now  = userfs_bcache_now_ns();
+        while (1) {
+            userfs_bbuf_t   *bufs[USERFS_BBUF_IO_BATCH];
+            userfs_bbuf_io_t io[USERFS_BBUF_IO_BATCH];
+            uint32_t         count = 0;
+            int              busy  = 0;
+            /*take oldest buffers in one batch, written sorted by disk offset*/
+            while (count < USERFS_BBUF_IO_BATCH && g_bcache.dirty.next != &(g_bcache.dirty)) {
+                userfs_bbuf_t *bbuf = container_of(g_bcache.dirty.next, userfs_bbuf_t, b_dirty);
+                /*oldest buffer is young enough and dirty memory is low, nothing else to do*/
+                if (!stop && g_bcache.dirty_bytes <= g_bcache.wb_dirty_limit && now - bbuf->b_dirty_ns < g_bcache.wb_expire_ns) {
+                    break;
+                }
+                /*file sync is writing it*/
+                if (userfs_bbuf_test_state(bbuf, USERFS_BBUF_WRITEBACK)) {
+                    busy = 1;
+                    break;
+                }
+                uint32_t first_block;
+                uint32_t block_size;
+                userfs_bcache_geometry(bbuf, &first_block, &block_size);
+                userfs_bcache_io_fill(bbuf, first_block, block_size, &(io[count]));
+                userfs_bcache_writeout_begin(bbuf);
+                bufs[count++] = bbuf;
+            }
+            if (!count) {
+                if (!busy) {
+                    break;
+                }
+                pthread_cond_wait(&(g_bcache.io_done), &(g_bcache.lock));
+                continue;
+            }
+            LOG_DESC(DBG, "USERFS BCACHE", "Write back bufs:%u, dirty bytes left:0x%lx", count, g_bcache.dirty_bytes);
+            if (userfs_bcache_writeout(bufs, io, count) < 0) {
+                /*retry on next round instead of spinning on a failing disk*/
+                break;
+            }
+            g_bcache.writebacks += count;
+            now                  = userfs_bcache_now_ns();
+        }
+        if (stop) {
+            break;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t wake = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec + g_bcache.wb_interval_ns;
+        ts.tv_sec     = wake / 1000000000ull;
+        ts.tv_nsec    = wake % 1000000000ull;
+        pthread_cond_timedwait(&(g_bcache.wb_wakeup), &(g_bcache.lock), &ts);
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+    return NULL;
+}
+
+int userfs_bcache_writeback_start(
+    const userfs_super_block_t      *sb,
+    const userfs_bcache_wb_params_t *params)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    if (!g_bcache.bucket || g_bcache.wb_running) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        LOG_DESC(ERR, "USERFS BCACHE", "Cache not initialized or write-back already running");
+        return -1;
+    }
+    uint32_t interval_ms    = params && params->interval_ms ? params->interval_ms : USERFS_BCACHE_WB_INTERVAL_MS;
+    uint32_t expire_ms      = params && params->expire_ms ? params->expire_ms : USERFS_BCACHE_WB_EXPIRE_MS;
+    g_bcache.wb_interval_ns = (uint64_t)interval_ms * 1000000ull;
+    g_bcache.wb_expire_ns   = (uint64_t)expire_ms * 1000000ull;
+    g_bcache.wb_dirty_limit = params && params->dirty_limit ? params->dirty_limit : g_bcache.budget >> 2;
+    g_bcache.first_dblock   = sb->s_first_datablock;
+    g_bcache.dblock_size    = sb->s_data_block_size;
+    g_bcache.first_mblock   = sb->s_first_metablock;
+    g_bcache.mblock_size    = sb->s_metablock_size;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(g_bcache.wb_wakeup), &attr);
+    pthread_condattr_destroy(&attr);
+    g_bcache.wb_running = 1;
+    if (pthread_create(&(g_bcache.wb_thread), NULL, userfs_bcache_writeback_thread, NULL) != 0) {
+        g_bcache.wb_running = 0;
+        pthread_cond_destroy(&(g_bcache.wb_wakeup));
+        pthread_mutex_unlock(&(g_bcache.lock));
+        LOG_DESC(ERR, "USERFS BCACHE", "Create write-back thread failed");
+        return -1;
+    }
+    pthread_mutex_unlock(&(g_bcache.lock));
+    LOG_DESC(DBG, "USERFS BCACHE", "Write-back start, interval:%ums, expire:%ums, dirty limit:0x%lxB",
+             interval_ms, expire_ms, g_bcache.wb_dirty_limit);
+    return 0;
+}
+
+void userfs_bcache_writeback_stop(void)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    if (!g_bcache.wb_running) {
+        pthread_mutex_unlock(&(g_bcache.lock));
+        return;
+    }
+    g_bcache.wb_running = 0;
+    pthread_cond_signal(&(g_bcache.wb_wakeup));
+    pthread_mutex_unlock(&(g_bcache.lock));
+    pthread_join(g_bcache.wb_thread, NULL);
+    pthread_cond_destroy(&(g_bcache.wb_wakeup));
+}
+
+void userfs_bcache_stat_get(
+    userfs_bcache_stat_t *stat)
+{
+    pthread_mutex_lock(&(g_bcache.lock));
+    stat->hits           = g_bcache.hits;
+    stat->misses         = g_bcache.misses;
+    stat->evictions      = g_bcache.evictions;
+    stat->bytes          = g_bcache.bytes;
+    stat->budget         = g_bcache.budget;
+    stat->buffers        = g_bcache.buffers;
+    stat->dirty_bytes    = g_bcache.dirty_bytes;
+    stat->writebacks     = g_bcache.writebacks;
+    stat->readaheads     = g_bcache.readaheads;
+    stat->readahead_hits = g_bcache.readahead_hits;
+    pthread_mutex_unlock(&(g_bcache.lock));
+}
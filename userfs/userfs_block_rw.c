@@ -3,6 +3,73 @@
 #include "inode.h"
 #include "log.h"
 #include "vnode.h"
+#include <stdlib.h>
+
+static int userfs_bbuf_io_cmp(
+    const void *a,
+    const void *b)
+{
+    uint64_t x = ((const userfs_bbuf_io_t *)a)->off;
+    uint64_t y = ((const userfs_bbuf_io_t *)b)->off;
+    return x < y ? -1 : (x > y);
+}
+
+int userfs_bbuf_io_submit(
+    userfs_bbuf_io_t *io,
+    const uint32_t    io_count,
+    const int         write)
+{
+    struct iovec iov[USERFS_BBUF_IOV_MAX];
+    uint32_t     i = 0;
+    qsort(io, io_count, sizeof(userfs_bbuf_io_t), userfs_bbuf_io_cmp);
+    while (i < io_count) {
+        uint64_t off       = io[i].off;
+        uint64_t expect_sz = 0;
+        uint64_t real_sz;
+        int      iovcnt    = 0;
+        /*extend run while next buffer starts where it ends on disk*/
+        do {
+            iov[iovcnt].iov_base  = io[i].data;
+            iov[iovcnt].iov_len   = io[i].size;
+            expect_sz            += io[i].size;
+            iovcnt++;
+            i++;
+        } while (i < io_count && iovcnt < USERFS_BBUF_IOV_MAX && io[i].off == off + expect_sz);
+        real_sz = write ? user_disk_writev(iov, iovcnt, off) : user_disk_readv(iov, iovcnt, off);
+        if (real_sz != expect_sz) {
+            LOG_DESC(ERR, "BLOCK BUF IO", "Vectored %s failed, off:0x%lxB, bufs:%d, expect bytes:0x%lxB, real bytes:0x%lxB",
+                     write ? "write" : "read", off, iovcnt, expect_sz, real_sz);
+            return -1;
+        }
+        LOG_DESC(DBG, "BLOCK BUF IO", "Vectored %s, off:0x%lxB, bufs:%d, bytes:0x%lxB", write ? "write" : "read", off, iovcnt, real_sz);
+    }
+    return 0;
+}
+
+/*flush buffer list in batches, each batch in disk offset order*/
+static int userfs_bbuf_list_flush(
+    const uint32_t first_block,
+    const uint32_t block_size,
+    userfs_bbuf_t *buf_list,
+    const uint16_t buf_list_len,
+    const int      meta)
+{
+    userfs_bbuf_io_t io[USERFS_BBUF_IO_BATCH];
+    uint32_t         io_count = 0;
+    for (int i = 0; i < buf_list_len && buf_list; i++, buf_list = buf_list->b_this_page) {
+        io[io_count].off  = meta ? userfs_mbbuf_disk_off(buf_list, first_block, block_size)
+                                 : userfs_dbbuf_disk_off(buf_list, first_block, block_size);
+        io[io_count].data = buf_list->b_data;
+        io[io_count].size = buf_list->b_size;
+        if (++io_count == USERFS_BBUF_IO_BATCH) {
+            if (userfs_bbuf_io_submit(io, io_count, 1) < 0) {
+                return -1;
+            }
+            io_count = 0;
+        }
+    }
+    return io_count ? userfs_bbuf_io_submit(io, io_count, 1) : 0;
+}
 
 int userfs_mbbuf_list_flush(
     uint32_t       first_mblock,
@@ -10,18 +77,9 @@ int userfs_mbbuf_list_flush(
     userfs_bbuf_t *buf_list,
     uint16_t       buf_list_len)
 {
-    for (int i = 0; i < buf_list_len; i++) {
-        uint64_t woff      = metablock_size * (buf_list->b_blocknr + first_mblock);
-        uint32_t expect_wb = buf_list->b_size;
-        uint32_t real_wb;
-        if ((real_wb = user_disk_write(buf_list->b_data, expect_wb, woff)) != expect_wb) {
-            LOG_DESC(ERR, "MBLOCK BUF FLUSH", "Flush failed, mblock id:%u, woff:0x%lxB, expect wbytes:0x%xB, real wbytes:0x%xB",
-                     buf_list->b_blocknr, woff, expect_wb, real_wb);
-            return -1;
-        };
-        LOG_DESC(DBG, "MBLOCK BUF FLUSH", "mblock id:%u, woff:0x%lxB, expect wbytes:0x%xB, real wbytes:0x%xB",
-                 buf_list->b_blocknr, woff, expect_wb, real_wb);
-        buf_list = buf_list->b_this_page;
+    if (userfs_bbuf_list_flush(first_mblock, metablock_size, buf_list, buf_list_len, 1) < 0) {
+        LOG_DESC(ERR, "MBLOCK BUF FLUSH", "Flush failed, first mblock id:%u, list len:%u", buf_list->b_blocknr, buf_list_len);
+        return -1;
     }
     return 0;
 }
@@ -59,7 +117,7 @@ int userfs_read_metadata_block(
     mb_buf->b_blocknr  = target_mb_id;
     mb_buf->b_size     = metablock_size;
 
-    uint32_t res       = userfs_mbbuf_list_read(first_mblock, metablock_size, mb_buf, 1);
+    int      res       = userfs_mbbuf_list_read(first_mblock, metablock_size, mb_buf, 1);
     if (res < 0) {
         LOG_DESC(ERR, "READ METADATA BLOCK", "Read fail, read mblock id:%u, expect rbytes:0x%xB",
                  target_mb_id, expect_rb);
@@ -75,19 +133,10 @@ int userfs_dbbuf_list_flush(
     userfs_bbuf_t *buf_list,
     uint16_t       buf_list_len)
 {
-    for (int i = 0; i < buf_list_len; i++) {
-        uint64_t woff = buf_list->b_block_s_off +
-                        (uint64_t)(buf_list->b_blocknr + first_dblock) * (uint64_t)dblock_size;
-        uint32_t expect_wb = buf_list->b_size;
-        uint32_t real_wb;
-        if ((real_wb = user_disk_write(buf_list->b_data, expect_wb, woff)) != expect_wb) {
-            LOG_DESC(ERR, "MBLOCK BUF FLUSH", "Flush failed, mblock id:%u, woff:0x%lxB, in dblock off:0x%x, expect wbytes:0x%xB, real wbytes:0x%xB",
-                     buf_list->b_blocknr, woff, buf_list->b_block_s_off, expect_wb, real_wb);
-            return -1;
-        };
-        LOG_DESC(DBG, "MBLOCK BUF FLUSH", "mblock id:%u, woff:0x%lxB, in dblock off:0x%x, expect wbytes:0x%xB, real wbytes:0x%xB",
-                 buf_list->b_blocknr, woff, buf_list->b_block_s_off, expect_wb, real_wb);
-        buf_list = buf_list->b_this_page;
+    if (userfs_bbuf_list_flush(first_dblock, dblock_size, buf_list, buf_list_len, 0) < 0) {
+        LOG_DESC(ERR, "DBLOCK BUF FLUSH", "Flush failed, first dblock id:%u, in dblock off:0x%x, list len:%u",
+                 buf_list->b_blocknr, buf_list->b_block_s_off, buf_list_len);
+        return -1;
     }
     return 0;
 }
@@ -115,13 +164,37 @@ int userfs_dbbuf_list_read(
     return 0;
 }
 
+int userfs_dbbuf_array_read(
+    uint32_t        first_dblock,
+    uint32_t        dblock_size,
+    userfs_bbuf_t **buf_array,
+    uint32_t        buf_count)
+{
+    userfs_bbuf_io_t io[USERFS_BBUF_IO_BATCH];
+    for (uint32_t i = 0; i < buf_count; i += USERFS_BBUF_IO_BATCH) {
+        uint32_t io_count = buf_count - i < USERFS_BBUF_IO_BATCH ? buf_count - i : USERFS_BBUF_IO_BATCH;
+        for (uint32_t j = 0; j < io_count; j++) {
+            io[j].off  = userfs_dbbuf_disk_off(buf_array[i + j], first_dblock, dblock_size);
+            io[j].data = buf_array[i + j]->b_data;
+            io[j].size = buf_array[i + j]->b_size;
+        }
+        if (userfs_bbuf_io_submit(io, io_count, 0) < 0) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < buf_count; i++) {
+        buf_array[i]->b_type = USERFS_MBLOCK(buf_array[i]->b_data)->block_type;
+    }
+    return 0;
+}
+
 int userfs_read_data_block(
     userfs_bbuf_t *db_buf,
     uint32_t       first_dblock,
     uint32_t       dblock_size)
 {
     uint32_t expect_rb = db_buf->b_size;
-    uint32_t res       = userfs_dbbuf_list_read(first_dblock, dblock_size, db_buf, db_buf->b_list_len);
+    int      res       = userfs_dbbuf_list_read(first_dblock, dblock_size, db_buf, db_buf->b_list_len);
     if (res < 0) {
         LOG_DESC(ERR, "READ METADATA BLOCK", "Read fail, read mblock id:%u, expect rbytes:0x%xB",
                  db_buf->b_blocknr, expect_rb);
@@ -1,6 +1,7 @@
 #include "userfs_file_ctrl.h"
 #include "log.h"
 #include "pthread_spinlock.h"
+#include "userfs_bcache.h"
 #include "userfs_block_rw.h"
 #include "userfs_dentry_hash.h"
 #include "userfs_heap.h"
@@ -113,9 +114,10 @@ userfs_bbuf_t *userfs_get_new_dblock(
     userfs_bgroup_desc_t *cur_lightest_load_bgd = userfs_bgdidx2bgd(
         bgd_idx_list, sb->s_bgroup_desc_per_mb_count, cur_lightest_load_bgd_idx->bgi_bgroup_nr, sb->s_bgroup_desc_size);
 
-    /*alloc dblock from bgroup descriptors*/
-    uint32_t bg_dblock_nr = bitmap_get_first_free(&cur_lightest_load_bgd->block_bm);
-    if (bg_dblock_nr == (uint32_t)(-1)) {
+    /*alloc dblock from bgroup descriptors, block bitmap is only ever claimed
+    through the atomic ops so concurrent writers never get the same dblock*/
+    int bg_dblock_nr = bitmap_atomic_alloc(&cur_lightest_load_bgd->block_bm);
+    if (bg_dblock_nr < 0) {
         userfs_free_dbbuf(db_buf);
         LOG_DESC(DBG, "USERFS GET NEW DBLOCK", "No free block in current bgroup");
         return NULL;
@@ -135,6 +137,8 @@ userfs_bbuf_t *userfs_get_new_dblock(
     db_buf->b_list_len    = 1;
     db_buf->b_blocknr     = dblock_nr + bg_dblock_nr;
     db_buf->b_type        = USERFS_BTYPE_DATA;
+    /*block is fresh, shards still cached are left from its previous owner*/
+    userfs_bcache_forget_dblock(db_buf->b_blocknr);
     LOG_DESC(DBG, "USERFS GET NEW DBLOCK", "bgroup nr:%u, block in bgroup nr:%u, block nr:%u, db buf size:0x%xB, total free dblock:%u",
              dblock_nr, bg_dblock_nr, dblock_nr + bg_dblock_nr, db_buf->b_size, sb->s_free_data_block_count);
 
@@ -147,8 +151,16 @@ userfs_bbuf_t *userfs_get_used_dblock(
     uint32_t              dblock_off,
     uint32_t              dblock_shard_size)
 {
+    /*shard may still be cached from an earlier open*/
+    userfs_bbuf_t *db_buf = userfs_bcache_get(USERFS_BCACHE_DATA, target_dblock_id, dblock_off, dblock_shard_size);
+    if (db_buf) {
+        LOG_DESC(DBG, "USERFS GET USED DBLOCK", "Cache hit, dblock nr:%u, in dblock off:0x%x, dblock buf:%p",
+                 target_dblock_id, dblock_off, db_buf);
+        return db_buf;
+    }
+
     /*alloc block buf from new dblock*/
-    userfs_bbuf_t *db_buf = userfs_alloc_dbbuf(dblock_shard_size);
+    db_buf = userfs_alloc_dbbuf(dblock_shard_size);
     if (!db_buf) {
         LOG_DESC(ERR, "USERFS GET USED DBLOCK", "Alloc dblock buf failed");
         return NULL;
@@ -162,9 +174,85 @@ userfs_bbuf_t *userfs_get_used_dblock(
     and start from @dblock_off to @dblock_shard_size*/
     if (userfs_read_data_block(db_buf, sb->s_first_datablock, sb->s_data_block_size) != 0) {
         LOG_DESC(ERR, "USERFS GET USED DBLOCK", "Read dblock failed");
+        userfs_free_dbbuf(db_buf);
         return NULL;
     }
-    return db_buf;
+    /*if cache refuses it, buffer stays private to this file*/
+    return userfs_bcache_add(db_buf, USERFS_BCACHE_DATA);
+}
+
+int userfs_get_used_dblock_shards(
+    userfs_super_block_t *sb,
+    uint32_t              target_dblock_id,
+    const uint32_t       *dblock_off,
+    uint32_t              count,
+    uint32_t              dblock_shard_size,
+    userfs_bbuf_t       **db_bufs)
+{
+    userfs_bbuf_t *read_bufs[USERFS_DBLOCK_SHARD_BATCH];
+    uint32_t       read_idx[USERFS_DBLOCK_SHARD_BATCH];
+    uint32_t       read_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        db_bufs[i] = userfs_bcache_get(USERFS_BCACHE_DATA, target_dblock_id, dblock_off[i], dblock_shard_size);
+        if (db_bufs[i]) {
+            continue;
+        }
+        db_bufs[i] = userfs_alloc_dbbuf(dblock_shard_size);
+        if (!db_bufs[i]) {
+            LOG_DESC(ERR, "USERFS GET USED DBLOCK", "Alloc dblock buf failed");
+            count = i;
+            goto release;
+        }
+        db_bufs[i]->b_list_len    = 1;
+        db_bufs[i]->b_blocknr     = target_dblock_id;
+        db_bufs[i]->b_block_s_off = dblock_off[i];
+        db_bufs[i]->b_size        = dblock_shard_size;
+        read_idx[read_count]      = i;
+        read_bufs[read_count++]   = db_bufs[i];
+    }
+    if (read_count && userfs_dbbuf_array_read(sb->s_first_datablock, sb->s_data_block_size, read_bufs, read_count) != 0) {
+        LOG_DESC(ERR, "USERFS GET USED DBLOCK", "Read dblock shards failed, dblock nr:%u, shards:%u", target_dblock_id, read_count);
+        goto release;
+    }
+    for (uint32_t i = 0; i < read_count; i++) {
+        db_bufs[read_idx[i]] = userfs_bcache_add(read_bufs[i], USERFS_BCACHE_DATA);
+    }
+    LOG_DESC(DBG, "USERFS GET USED DBLOCK", "Get dblock shards, dblock nr:%u, shards:%u, read from disk:%u",
+             target_dblock_id, count, read_count);
+    return 0;
+
+release:
+    for (uint32_t i = 0; i < count; i++) {
+        if (userfs_bbuf_test_state(db_bufs[i], USERFS_BBUF_CACHED)) {
+            userfs_bcache_put(db_bufs[i]);
+        } else {
+            userfs_free_dbbuf(db_bufs[i]);
+        }
+        db_bufs[i] = NULL;
+    }
+    return -1;
+}
+
+userfs_bbuf_t *userfs_get_blank_dblock(
+    uint32_t target_dblock_id,
+    uint32_t dblock_off,
+    uint32_t dblock_shard_size)
+{
+    userfs_bbuf_t *db_buf = userfs_bcache_get(USERFS_BCACHE_DATA, target_dblock_id, dblock_off, dblock_shard_size);
+    if (db_buf) {
+        return db_buf;
+    }
+    db_buf = userfs_alloc_dbbuf(dblock_shard_size);
+    if (!db_buf) {
+        LOG_DESC(ERR, "USERFS GET BLANK DBLOCK", "Alloc dblock buf failed");
+        return NULL;
+    }
+    memset(db_buf->b_data, 0, dblock_shard_size);
+    db_buf->b_list_len    = 1;
+    db_buf->b_blocknr     = target_dblock_id;
+    db_buf->b_block_s_off = dblock_off;
+    db_buf->b_size        = dblock_shard_size;
+    return userfs_bcache_add(db_buf, USERFS_BCACHE_DATA);
 }
 
 userfs_bbuf_t *userfs_free_used_dblock()
@@ -202,6 +290,8 @@ userfs_bbuf_t *userfs_get_new_inode(
     inode->i_dtime            = 0;
     inode->i_size             = 0;
     inode->i_v2pnode_table[0] = inode_bbuf->b_blocknr;
+    userfs_bbuf_set_state(inode_bbuf, USERFS_BBUF_INODE);
+    inode_bbuf = userfs_bcache_add(inode_bbuf, USERFS_BCACHE_DATA);
     LOG_DESC(DBG, "USERFS INODE ALLOC", "File create time:0x%lx, file size:0x%x, file blocks:%u, first block:%lu",
              inode->i_ctime, inode->i_size, inode->i_blocks, inode->i_v2pnode_table[0]);
 
@@ -214,7 +304,11 @@ userfs_bbuf_t *userfs_get_used_inode(
     uint32_t              dblock_shard_size)
 {
     /*get new data block as first data block for new file, which contain inode*/
-    return userfs_get_used_dblock(sb, inode_dblock_nr, 0, dblock_shard_size);
+    userfs_bbuf_t *inode_bbuf = userfs_get_used_dblock(sb, inode_dblock_nr, 0, dblock_shard_size);
+    if (inode_bbuf) {
+        userfs_bbuf_set_state(inode_bbuf, USERFS_BBUF_INODE);
+    }
+    return inode_bbuf;
 }
 
 void userfs_free_used_inode(
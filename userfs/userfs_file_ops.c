@@ -2,9 +2,11 @@
 #include "atomic.h"
 #include "inode.h"
 #include "log.h"
+#include "userfs_bcache.h"
 #include "userfs_dentry_hash.h"
 #include "userfs_file_ctrl.h"
 #include "userfs_heap.h"
+#include "userfs_readahead.h"
 #include "vnode.h"
 #include <string.h>
 #include <sys/time.h>
@@ -57,6 +59,9 @@ userfs_bbuf_t *userfs_file_create(
         LOG_DESC(DBG, "USERFS FILE CREATE", "Insert in dentry hash table failed");
         userfs_free_dentry(dentry_table, dentry_pos);
         userfs_free_used_inode();
+        if (userfs_bcache_forget(new_inode_bbuf) < 0) {
+            userfs_free_dbbuf(new_inode_bbuf);
+        }
         return NULL;
     }
     /*init inode*/
@@ -64,6 +69,7 @@ userfs_bbuf_t *userfs_file_create(
     new_inode->i_ctime            = file_create_tp.tv_sec;
     new_inode->i_v2pnode_table[0] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODEBUF, new_inode_bbuf);
     atomic_add(&(new_inode->ref_count), 1);
+    userfs_bbuf_set_state(new_inode_bbuf, USERFS_BBUF_INODE_DIRTY);
     LOG_DESC(DBG, "USERFS FILE CREATE", "Create file success, file:%s, first block:%u, dblock buf:%p, create time:0x%lx, refcount:%d",
              name, new_inode_bbuf->b_blocknr, new_inode_bbuf, file_create_tp.tv_sec, atomic_get(&(new_inode->ref_count)));
     return new_inode_bbuf;
@@ -117,7 +123,12 @@ userfs_bbuf_t *userfs_file_open(
         if (!new_hash_dentry) {
             LOG_DESC(DBG, "USERFS FILE OPEN", "Update dentry hash failed, file:%s, inode number:%u, dblock buf:%p",
                      name, ff_block, ff_bbuf);
-            userfs_free_dbbuf(ff_bbuf);
+            /*inode buf may come from buffer cache, only private one is freed*/
+            if (userfs_bbuf_test_state(ff_bbuf, USERFS_BBUF_CACHED)) {
+                userfs_bcache_put(ff_bbuf);
+            } else {
+                userfs_free_dbbuf(ff_bbuf);
+            }
             return NULL;
         }
         open_inode = USERFS_DBLOCK(ff_bbuf->b_data)->inode;
@@ -134,9 +145,107 @@ userfs_bbuf_t *userfs_file_open(
                  name, ff_bbuf->b_blocknr, ff_bbuf, file_open_tp.tv_sec, atomic_get(&(open_inode->ref_count)));
     }
     open_inode->i_atime = file_open_tp.tv_sec;
+    userfs_bbuf_set_state(ff_bbuf, USERFS_BBUF_INODE_DIRTY);
     return ff_bbuf;
 }
 
+/*dblocks file spans, inode space at start of first dblock included*/
+static inline uint32_t userfs_file_dblocks(
+    const userfs_inode_t       *inode,
+    const userfs_super_block_t *sb)
+{
+    uint64_t blocks = ((uint64_t)inode->i_size + USERFS_INODE_SIZE + sb->s_data_block_size - 1) / sb->s_data_block_size;
+    return blocks < USERFS_INODE_V2P_COUNT ? blocks : USERFS_INODE_V2P_COUNT;
+}
+
+/*drop shard list of opened dblock of deleted file, cached shards leave buffer cache*/
+static void userfs_file_forget_list(
+    userfs_bbuf_t *buf_list)
+{
+    userfs_bbuf_t *next = buf_list;
+    userfs_bbuf_t *prev = NULL;
+    while (next != NULL) {
+        prev = next;
+        next = prev->b_this_page;
+        if (userfs_bcache_forget(prev) < 0) {
+            userfs_free_dbbuf(prev);
+        }
+    }
+}
+
+/*write dirty shards of every opened dblock of file, first dblock list starts with inode buf*/
+static int userfs_file_sync_dblocks(
+    userfs_bbuf_t        *inodebbuf,
+    userfs_super_block_t *sb)
+{
+    userfs_inode_t *inode  = USERFS_DBLOCK(inodebbuf->b_data)->inode;
+    uint32_t        blocks = userfs_file_dblocks(inode, sb);
+    int             res    = userfs_bcache_sync_list(inodebbuf, inodebbuf->b_list_len, sb->s_first_datablock, sb->s_data_block_size);
+    for (uint32_t i = 1; i < blocks; i++) {
+        unsigned long cur_db_addr = inode->i_v2pnode_table[i];
+        if (USERFS_INODETYPE_GET(cur_db_addr) != USERFS_NAME2INODEBUF) {
+            continue;
+        }
+        userfs_bbuf_t *cur_dbbuf_head = (userfs_bbuf_t *)USERFS_INODEADDR_GET(cur_db_addr);
+        if (userfs_bcache_sync_list(cur_dbbuf_head, cur_dbbuf_head->b_list_len, sb->s_first_datablock, sb->s_data_block_size) < 0) {
+            LOG_DESC(ERR, "USERFS FILE SYNC", "Dblock list flush failed, dblock nr:%u, dblock buf:0x%p, list len:%u",
+                     cur_dbbuf_head->b_blocknr, cur_dbbuf_head, cur_dbbuf_head->b_list_len);
+            res = -1;
+        }
+    }
+    return res;
+}
+
+/*write inode as it must be on disk, opened dblocks referred by block number
+instead of buffer address and nobody referring file*/
+static int userfs_file_sync_inode(
+    userfs_bbuf_t        *inodebbuf,
+    userfs_super_block_t *sb)
+{
+    if (!userfs_bbuf_test_state(inodebbuf, USERFS_BBUF_INODE_DIRTY)) {
+        return 0;
+    }
+    userfs_bbuf_clear_state(inodebbuf, USERFS_BBUF_INODE_DIRTY);
+
+    uint8_t disk_inode_data[USERFS_INODE_SIZE];
+    memcpy(disk_inode_data, inodebbuf->b_data, USERFS_INODE_SIZE);
+    userfs_inode_t *disk_inode = USERFS_DBLOCK(disk_inode_data)->inode;
+    disk_inode->i_blocks       = userfs_file_dblocks(disk_inode, sb);
+    atomic_set(&(disk_inode->ref_count), 0);
+    for (uint32_t i = 0; i < disk_inode->i_blocks; i++) {
+        unsigned long cur_db_addr = disk_inode->i_v2pnode_table[i];
+        if (USERFS_INODETYPE_GET(cur_db_addr) == USERFS_NAME2INODEBUF) {
+            disk_inode->i_v2pnode_table[i] =
+                USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODE, ((userfs_bbuf_t *)USERFS_INODEADDR_GET(cur_db_addr))->b_blocknr);
+        }
+    }
+
+    userfs_bbuf_t disk_inode_bbuf = {
+        .b_blocknr = inodebbuf->b_blocknr,
+        .b_size    = USERFS_INODE_SIZE,
+        .b_data    = disk_inode_data,
+    };
+    if (userfs_dbbuf_list_flush(sb->s_first_datablock, sb->s_data_block_size, &disk_inode_bbuf, 1) < 0) {
+        userfs_bbuf_set_state(inodebbuf, USERFS_BBUF_INODE_DIRTY);
+        return -1;
+    }
+    return 0;
+}
+
+int userfs_file_fsync(
+    userfs_bbuf_t        *inodebbuf,
+    userfs_super_block_t *sb)
+{
+    /*data first, inode on disk must not cover data that isn't there yet*/
+    int res = userfs_file_sync_dblocks(inodebbuf, sb);
+    if (userfs_file_sync_inode(inodebbuf, sb) < 0) {
+        res = -1;
+    }
+    LOG_DESC(DBG, "USERFS FILE SYNC", "Sync file %s, inode nr:%u, file size:%u",
+             res < 0 ? "FAILED" : "success", inodebbuf->b_blocknr, USERFS_DBLOCK(inodebbuf->b_data)->inode->i_size);
+    return res;
+}
+
 int userfs_file_close(
     const char           *name,
     const uint32_t        name_len,
@@ -193,9 +302,16 @@ int userfs_file_close(
                  name, ff_bbuf->b_blocknr, ff_bbuf);
         res = -1;
     }
+    /*readahead must not touch file blocks after close*/
+    userfs_readahead_release(ff_bbuf);
+    /*only shards still dirty are written, write-back thread may already have done the rest*/
+    if (userfs_file_sync_dblocks(ff_bbuf, sb) < 0) {
+        LOG_DESC(ERR, "USERFS FILE CLOSE", "Opened dblock list flush FAILED, file:%s, first block:%u", name, ff_block);
+        res = -1;
+    }
     /*rewrite data block number to inode block buf*/
     /*because of file hole, file blocks count must be set by file size*/
-    close_inode->i_blocks = (close_inode->i_size + sb->s_data_block_size - 1) / sb->s_data_block_size;
+    close_inode->i_blocks = userfs_file_dblocks(close_inode, sb);
     for (int i = 1; i < close_inode->i_blocks; i++) {
         unsigned long cur_db_addr = close_inode->i_v2pnode_table[i];
         /*non-opened data block, skip*/
@@ -204,28 +320,27 @@ int userfs_file_close(
             continue;
         }
 
-        /*opened data block, flush data to disk*/
+        /*opened data block, its shards are on disk now*/
         userfs_bbuf_t *cur_dbbuf_head   = (userfs_bbuf_t *)USERFS_INODEADDR_GET(cur_db_addr);
         close_inode->i_v2pnode_table[i] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODE, cur_dbbuf_head->b_blocknr);
         LOG_DESC(DBG, "USERFS FILE CLOSE", "Opened dblock, dblock nr:%lu, dblock buf:0x%p, list len:%u",
                  USERFS_INODEADDR_GET(close_inode->i_v2pnode_table[i]), cur_dbbuf_head, cur_dbbuf_head->b_list_len);
-
-        if (userfs_dbbuf_list_flush(sb->s_first_datablock, sb->s_data_block_size, cur_dbbuf_head, cur_dbbuf_head->b_list_len) < 0) {
-            LOG_DESC(ERR, "USERFS FILE CLOSE", "Opened dblock list flush FAILED, file:%s, dblock nr:%lu, dblock buf:0x%p, list len:%u",
-                     name, USERFS_INODEADDR_GET(close_inode->i_v2pnode_table[i]), cur_dbbuf_head, cur_dbbuf_head->b_list_len);
-        }
+        /*buffers stay in buffer cache for next open*/
+        userfs_bcache_put_list(cur_dbbuf_head, cur_dbbuf_head->b_list_len);
     }
-    /*because of v2pdblock table update needs, inode buf is last one to be flushed*/
+    /*because of v2pdblock table update needs, inode is last one to be flushed*/
     close_inode->i_v2pnode_table[0] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODE, ff_bbuf->b_blocknr);
-    if (userfs_dbbuf_list_flush(sb->s_first_datablock, sb->s_data_block_size, ff_bbuf, ff_bbuf->b_list_len) < 0) {
-        LOG_DESC(ERR, "USERFS FILE CLOSE", "Opened dblock list flush FAILED, file:%s, dblock nr:%lu, dblock buf:0x%p, list len:%u",
-                 name, USERFS_INODEADDR_GET(close_inode->i_v2pnode_table[0]), ff_bbuf, ff_bbuf->b_list_len);
+    if (userfs_file_sync_inode(ff_bbuf, sb) < 0) {
+        LOG_DESC(ERR, "USERFS FILE CLOSE", "Inode flush FAILED, file:%s, dblock nr:%lu, dblock buf:0x%p",
+                 name, USERFS_INODEADDR_GET(close_inode->i_v2pnode_table[0]), ff_bbuf);
+        res = -1;
     }
     LOG_DESC(DBG, "USERFS FILE CLOSE", "Flush inode dblock, dblock nr:%lu, dblock buf:0x%p, list len:%u",
              USERFS_INODEADDR_GET(close_inode->i_v2pnode_table[0]), ff_bbuf, ff_bbuf->b_list_len);
 
     LOG_DESC(DBG, "USERFS FILE CLOSE", "Close file success, file:%s, first block:%u, dblock buf:%p, close time:0x%lx",
              name, ff_bbuf->b_blocknr, ff_bbuf, file_close_tp.tv_sec);
+    userfs_bcache_put_list(ff_bbuf, ff_bbuf->b_list_len);
     return res;
 }
 
@@ -273,6 +388,8 @@ int userfs_file_delete(
         LOG_DESC(DBG, "USERFS FILE DELETE", "File is opened, file:%s, block buf addr:0x%lx",
                  name, USERFS_INODEADDR_GET(inodeaddr));
         inodebbuf = (userfs_bbuf_t *)USERFS_INODEADDR_GET(inodeaddr);
+        /*readahead must not read blocks being freed, as close does*/
+        userfs_readahead_release(inodebbuf);
     } else {
         /*read inode from disk to free data blocks*/
         uint32_t inode_nr = (uint32_t)USERFS_INODEADDR_GET(inodeaddr);
@@ -298,13 +415,28 @@ int userfs_file_delete(
     for (int i = 0; i < delete_inode->i_blocks; i++) {
         userfs_free_used_dblock();
     }
-    userfs_bbuf_t *next = inodebbuf;
-    userfs_bbuf_t *prev = NULL;
-    while (next != NULL) {
-        prev = next;
-        next = prev->b_this_page;
-        userfs_free_dbbuf(prev);
+    /*blocks of deleted file must not be served from buffer cache again, opened dblocks
+    drop their shard lists, shards cached by earlier opens or readahead go too,
+    inode dblock is last, its list holds v2p table*/
+    uint32_t blocks = userfs_file_dblocks(delete_inode, sb);
+    for (uint32_t i = 1; i < blocks; i++) {
+        unsigned long cur_db_addr = delete_inode->i_v2pnode_table[i];
+        uint32_t      cur_db_nr   = 0;
+        if (!USERFS_INODEADDR_GET(cur_db_addr)) {
+            continue;
+        }
+        if (USERFS_INODETYPE_GET(cur_db_addr) == USERFS_NAME2INODEBUF) {
+            userfs_bbuf_t *cur_dbbuf_head = (userfs_bbuf_t *)USERFS_INODEADDR_GET(cur_db_addr);
+            cur_db_nr                     = cur_dbbuf_head->b_blocknr;
+            userfs_file_forget_list(cur_dbbuf_head);
+        } else {
+            cur_db_nr = (uint32_t)USERFS_INODEADDR_GET(cur_db_addr);
+        }
+        userfs_bcache_forget_dblock(cur_db_nr);
     }
+    uint32_t inode_nr = inodebbuf->b_blocknr;
+    userfs_file_forget_list(inodebbuf);
+    userfs_bcache_forget_dblock(inode_nr);
 
     return 0;
 }
@@ -341,6 +473,7 @@ userfs_bbuf_t *userfs_file_write_off_get(
 
         p_db_nr                     = target_dbbuf->b_blocknr;
         target_dbbuf->b_block_s_off = in_db_shard_off;
+        target_dbbuf                = userfs_bcache_add(target_dbbuf, USERFS_BCACHE_DATA);
         LOG_DESC(DBG, "USERFS FILE WOFF", "Alloc new dblock for file, dblock nr:%u, dblock shard size:0x%x, in dblock offset:0x%x",
                  target_dbbuf->b_blocknr, target_dbbuf->b_size, target_dbbuf->b_block_s_off);
         /*because of file hole, its meaning less to update file blocks count here,
@@ -366,19 +499,22 @@ userfs_bbuf_t *userfs_file_write_off_get(
 
     /*otherwise, this block has been open, but may not be the offset want
     in this case, need to query list to decide whether read or directly referring it*/
-    target_dbbuf        = (userfs_bbuf_t *)USERFS_INODEADDR_GET(p_db_addr);
-    userfs_bbuf_t *head = target_dbbuf;
+    userfs_bbuf_t *head = (userfs_bbuf_t *)USERFS_INODEADDR_GET(p_db_addr);
+    userfs_bbuf_t *cur  = head;
+    p_db_nr             = head->b_blocknr;
     for (int i = 0;
-         i < head->b_list_len;
-         i++, target_dbbuf = target_dbbuf->b_this_page) {
+         i < head->b_list_len && cur;
+         i++, cur = cur->b_this_page) {
         LOG_DESC(DBG, "USERFS FILE WOFF", "Query dblock buf list, dblock buf:0x%p, dblock nr:%u, in dblock offset:0x%x",
-                 target_dbbuf, target_dbbuf->b_blocknr, target_dbbuf->b_block_s_off);
-        if (!is_fileops_in_range(in_db_shard_off, target_dbbuf->b_block_s_off, target_dbbuf->b_size)) {
+                 cur, cur->b_blocknr, cur->b_block_s_off);
+        if (is_fileops_in_range(in_db_shard_off, cur->b_size, cur->b_block_s_off)) {
+            target_dbbuf = cur;
             break;
         }
     }
 
-    /*the offset current write ops want hasn't been read yet, read it*/
+    /*the offset current write ops want hasn't been read yet, read it
+    from buffer cache or disk*/
     if (!target_dbbuf) {
         target_dbbuf = userfs_get_used_dblock(sb, p_db_nr, in_db_shard_off, dblock_shard_size);
         if (!target_dbbuf) {
@@ -396,63 +532,125 @@ userfs_bbuf_t *userfs_file_write_off_get(
     return target_dbbuf;
 }
 
-userfs_bbuf_t *userfs_file_read_off_get(
+/*get buffers of shards [s_off, s_off + count * shard size) of file dblock v_db_nr
+and put them on file's buffer list, shards not on list come from buffer cache or from
+disk in vectored reads, shards of fresh dblock or inside [cover_s, cover_e) are
+overwritten whole by caller and never read*/
+static int userfs_file_shards_get(
+    userfs_inode_t       *inode,
     const uint32_t        v_db_nr,
-    const unsigned long   p_db_addr,
-    const uint32_t        in_db_shard_off,
+    const uint32_t        s_off,
+    const uint32_t        count,
+    const uint32_t        cover_s,
+    const uint32_t        cover_e,
+    const int             fresh,
     const uint32_t        dblock_shard_size,
-    userfs_inode_t       *inode,
-    userfs_super_block_t *sb)
+    userfs_super_block_t *sb,
+    userfs_bbuf_t       **shard_bufs)
 {
-    userfs_bbuf_t *target_dbbuf = NULL;
-    uint32_t       p_db_nr      = 0;
-
-    /*dblock has been allocated, but not been read, read it*/
-    if (USERFS_INODETYPE_GET(p_db_addr) == USERFS_NAME2INODE) {
-        p_db_nr      = USERFS_INODEADDR_GET(p_db_addr);
-        target_dbbuf = userfs_get_used_dblock(sb, p_db_nr, in_db_shard_off, dblock_shard_size);
-        if (!target_dbbuf) {
-            LOG_DESC(ERR, "USERFS FILE ROFF", "Get used dblock of file failed, dblock nr:%u, dblock shard size:0x%x",
-                     p_db_nr, dblock_shard_size);
-            return NULL;
+    unsigned long  p_db_addr = inode->i_v2pnode_table[v_db_nr];
+    userfs_bbuf_t *head      = NULL;
+    uint32_t       p_db_nr   = USERFS_INODEADDR_GET(p_db_addr);
+    if (USERFS_INODETYPE_GET(p_db_addr) == USERFS_NAME2INODEBUF) {
+        head    = (userfs_bbuf_t *)USERFS_INODEADDR_GET(p_db_addr);
+        p_db_nr = head->b_blocknr;
+    }
+
+    uint32_t       read_off[USERFS_DBLOCK_SHARD_BATCH];
+    uint32_t       read_idx[USERFS_DBLOCK_SHARD_BATCH];
+    userfs_bbuf_t *read_bufs[USERFS_DBLOCK_SHARD_BATCH];
+    /*0 on list already, 1 read, 2 blank*/
+    uint8_t        is_new[USERFS_DBLOCK_SHARD_BATCH] = {0};
+    uint32_t       read_count                        = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t off  = s_off + i * dblock_shard_size;
+        shard_bufs[i] = NULL;
+        /*file already holds it*/
+        userfs_bbuf_t *cur = head;
+        for (int j = 0; head && j < head->b_list_len && cur; j++, cur = cur->b_this_page) {
+            if (is_fileops_in_range(off, cur->b_size, cur->b_block_s_off)) {
+                shard_bufs[i] = cur;
+                break;
+            }
         }
-
-        LOG_DESC(DBG, "USERFS FILE ROFF", "Get used dblock of file, dblock nr:%u, dblock shard size:0x%x, in dblock offset:0x%x",
-                 p_db_nr, dblock_shard_size, target_dbbuf->b_block_s_off);
-        inode->i_v2pnode_table[v_db_nr] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODEBUF, target_dbbuf);
-        return target_dbbuf;
+        if (shard_bufs[i]) {
+            continue;
+        }
+        if (fresh || (off >= cover_s && off + dblock_shard_size <= cover_e)) {
+            is_new[i] = 2;
+            continue;
+        }
+        is_new[i]              = 1;
+        read_off[read_count]   = off;
+        read_idx[read_count++] = i;
     }
-
-    /*otherwise, this block has been open, but may not be the offset want
-    in this case, need to query list to decide whether read or directly referring it*/
-    target_dbbuf        = (userfs_bbuf_t *)USERFS_INODEADDR_GET(p_db_addr);
-    userfs_bbuf_t *head = target_dbbuf;
-    for (int i = 0;
-         i < head->b_list_len;
-         i++, target_dbbuf = target_dbbuf->b_this_page) {
-        LOG_DESC(DBG, "USERFS FILE ROFF", "Query dblock buf list, dblock buf:0x%p, dblock nr:%u, in dblock offset:0x%x",
-                 target_dbbuf, target_dbbuf->b_blocknr, target_dbbuf->b_block_s_off);
-        if (!is_fileops_in_range(in_db_shard_off, target_dbbuf->b_block_s_off, target_dbbuf->b_size)) {
-            break;
+    if (read_count && userfs_get_used_dblock_shards(sb, p_db_nr, read_off, read_count, dblock_shard_size, read_bufs) < 0) {
+        LOG_DESC(ERR, "USERFS FILE SHARDS", "Read used dblock shards of file failed, dblock nr:%u, first shard off:0x%x, shards:%u",
+                 p_db_nr, read_off[0], read_count);
+        return -1;
+    }
+    for (uint32_t i = 0; i < read_count; i++) {
+        shard_bufs[read_idx[i]] = read_bufs[i];
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (is_new[i] == 2 && !(shard_bufs[i] = userfs_get_blank_dblock(p_db_nr, s_off + i * dblock_shard_size, dblock_shard_size))) {
+            goto release;
         }
     }
 
-    /*the offset current write ops want hasn't been read yet, read it*/
-    if (!target_dbbuf) {
-        target_dbbuf = userfs_get_used_dblock(sb, p_db_nr, in_db_shard_off, dblock_shard_size);
-        if (!target_dbbuf) {
-            LOG_DESC(ERR, "USERFS FILE ROFF", "Read used dblock of file failed, dblock nr:%u, dblock shard size:0x%x, in dblock offset:0x%x",
-                     p_db_nr, dblock_shard_size, in_db_shard_off);
-            return NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!is_new[i]) {
+            continue;
+        }
+        if (!head) {
+            head                            = shard_bufs[i];
+            head->b_this_page               = NULL;
+            head->b_list_len                = 1;
+            inode->i_v2pnode_table[v_db_nr] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODEBUF, head);
+            continue;
         }
         head->b_list_len          += 1;
-        target_dbbuf->b_this_page  = head->b_this_page;
-        head->b_this_page          = target_dbbuf;
+        shard_bufs[i]->b_this_page = head->b_this_page;
+        head->b_this_page          = shard_bufs[i];
     }
+    LOG_DESC(DBG, "USERFS FILE SHARDS", "Get dblock shards of file, dblock nr:%u, first shard off:0x%x, shards:%u, read:%u, list len:%u",
+             p_db_nr, s_off, count, read_count, head->b_list_len);
+    return 0;
 
-    LOG_DESC(DBG, "USERFS FILE ROFF", "Get used dblock of file, list len:%u dblock buf:0x%p, dblock nr:%u, dblock shard size:0x%x, in dblock offset:0x%x",
-             head->b_list_len, target_dbbuf, target_dbbuf->b_blocknr, dblock_shard_size, target_dbbuf->b_block_s_off);
-    return target_dbbuf;
+release:
+    for (uint32_t i = 0; i < count; i++) {
+        if (!is_new[i] || !shard_bufs[i]) {
+            continue;
+        }
+        if (!userfs_bbuf_test_state(shard_bufs[i], USERFS_BBUF_CACHED)) {
+            userfs_free_dbbuf(shard_bufs[i]);
+        } else if (is_new[i] == 2 && !userfs_bbuf_test_state(shard_bufs[i], USERFS_BBUF_DIRTY)) {
+            /*zero filled blank doesn't match disk, clean cached one is on disk anyway*/
+            userfs_bcache_forget(shard_bufs[i]);
+        } else {
+            userfs_bcache_put(shard_bufs[i]);
+        }
+    }
+    return -1;
+}
+
+/*bytes of one pass at real offset off: stay in one dblock and one batch of shards,
+set shard offset in dblock and shard count of pass*/
+static inline uint32_t userfs_file_pass_size(
+    const uint32_t        off,
+    const uint32_t        left,
+    const uint32_t        dblock_shard_size,
+    userfs_super_block_t *sb,
+    uint32_t             *in_db_shard_off,
+    uint32_t             *shards)
+{
+    uint32_t in_db_off = off % sb->s_data_block_size;
+    *in_db_shard_off   = in_db_off - off % dblock_shard_size;
+    uint64_t pass_end  = (uint64_t)*in_db_shard_off + (uint64_t)USERFS_DBLOCK_SHARD_BATCH * dblock_shard_size;
+    pass_end           = pass_end < sb->s_data_block_size ? pass_end : sb->s_data_block_size;
+    pass_end           = pass_end < (uint64_t)in_db_off + left ? pass_end : (uint64_t)in_db_off + left;
+    *shards            = (pass_end - *in_db_shard_off + dblock_shard_size - 1) / dblock_shard_size;
+    return pass_end - in_db_off;
 }
 
 uint32_t userfs_file_write(
@@ -470,20 +668,9 @@ uint32_t userfs_file_write(
         return 0;
     }
 
-    uint32_t real_woff       = woff + USERFS_INODE_SIZE;
-    uint32_t real_size       = size;
-
-    uint32_t v_db_nr         = real_woff / sb->s_data_block_size;
-    uint32_t in_db_off       = real_woff % sb->s_data_block_size;
-    uint32_t in_shard_off    = real_woff % dblock_shard_size;
-    uint32_t in_db_shard_off = in_db_off - in_shard_off;
-    /*write offset and write size must keep in one data block shard,
-    otherwise must cut into series of write ops*/
-    if ((in_shard_off + size) > dblock_shard_size) {
-        real_size = dblock_shard_size - in_db_off;
-        LOG_DESC(WAR, "USERFS FILE WRITE", "Write size must align to data block shard size, in shard offset:0x%x, expect wlen:0x%x, real wlen:0x%x, dblock shard size:0x%x",
-                 in_shard_off, size, real_size, dblock_shard_size);
-    }
+    uint32_t real_woff = woff + USERFS_INODE_SIZE;
+    /*file size is 32 bits*/
+    uint32_t real_size = size < (UINT32_MAX - real_woff) ? size : (UINT32_MAX - real_woff);
 
     /*get current time as file modify time stamp*/
     struct timeval file_modity_ts = {0};
@@ -493,38 +680,67 @@ uint32_t userfs_file_write(
     }
 
     userfs_inode_t *write_inode = USERFS_DBLOCK(inodebbuf->b_data)->inode;
-    unsigned long   p_db_addr   = write_inode->i_v2pnode_table[v_db_nr];
-    uint32_t        p_db_nr     = 0;
-    LOG_DESC(DBG, "USERFS FILE WRITE", "inode nr:%u, logic dblock nr:%u, in dblock offset:0x%x, in dblock shard offset:0x%x, physical dblock addr:0x%lx",
-             inodebbuf->b_blocknr, v_db_nr, in_db_off, in_db_shard_off, p_db_addr);
-
-    /*get dblock buf from target data block with target offset*/
-    userfs_bbuf_t *target_dbbuf = userfs_file_write_off_get(v_db_nr, p_db_addr, in_db_shard_off,
-                                                            dblock_shard_size, write_inode, bgd_idx_list, sb);
-    if (target_dbbuf == NULL) {
-        LOG_DESC(ERR, "USERFS FILE WRITE", "Read target dblock buf failed");
-        return 0;
-    }
+    userfs_bbuf_t  *shard_bufs[USERFS_DBLOCK_SHARD_BATCH];
+    uint32_t        done        = 0;
+    /*walk shards write covers, each pass gathers shards of one dblock*/
+    while (done < real_size) {
+        uint32_t cur_woff        = real_woff + done;
+        uint32_t v_db_nr         = cur_woff / sb->s_data_block_size;
+        uint32_t in_db_off       = cur_woff % sb->s_data_block_size;
+        uint32_t in_db_shard_off = 0;
+        uint32_t shards          = 0;
+        uint32_t pass_size       = userfs_file_pass_size(cur_woff, real_size - done, dblock_shard_size, sb, &in_db_shard_off, &shards);
+        if (v_db_nr >= USERFS_INODE_V2P_COUNT) {
+            LOG_DESC(ERR, "USERFS FILE WRITE", "File reaches max dblocks, real woff:0x%x, max dblocks:%lu", cur_woff, USERFS_INODE_V2P_COUNT);
+            break;
+        }
 
-    /*write to target data block buf*/
-    char *target_buf = USERFS_DBLOCK(target_dbbuf->b_data)->data;
+        /*current dblock hasn't been allocated yet, first shard comes with new dblock,
+        other shards of it are never read*/
+        unsigned long p_db_addr = write_inode->i_v2pnode_table[v_db_nr];
+        int           fresh     = !USERFS_INODEADDR_GET(p_db_addr);
+        if (fresh) {
+            userfs_bbuf_t *new_dbbuf = userfs_file_write_off_get(v_db_nr, p_db_addr, in_db_shard_off,
+                                                                 dblock_shard_size, write_inode, bgd_idx_list, sb);
+            if (!new_dbbuf) {
+                LOG_DESC(ERR, "USERFS FILE WRITE", "Alloc dblock failed, logic dblock nr:%u", v_db_nr);
+                break;
+            }
+            memset(new_dbbuf->b_data, USERFS_FILE_HOLE_DATA, new_dbbuf->b_size);
+            write_inode->i_v2pnode_table[v_db_nr] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODEBUF, new_dbbuf);
+        }
+        if (userfs_file_shards_get(write_inode, v_db_nr, in_db_shard_off, shards, in_db_off, in_db_off + pass_size,
+                                   fresh, dblock_shard_size, sb, shard_bufs) < 0) {
+            LOG_DESC(ERR, "USERFS FILE WRITE", "Get dblock shards failed, logic dblock nr:%u, in dblock shard offset:0x%x, shards:%u",
+                     v_db_nr, in_db_shard_off, shards);
+            break;
+        }
 
-    memcpy(target_buf + in_shard_off, buf, real_size);
-    /*update inode v2pdblock table and file size(if needed)*/
-    if (USERFS_INODETYPE_GET(p_db_addr) == USERFS_NAME2INODE) {
-        write_inode->i_v2pnode_table[v_db_nr] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODEBUF, target_dbbuf);
+        /*write to target data block bufs*/
+        for (uint32_t i = 0; i < shards; i++) {
+            uint32_t shard_s = in_db_shard_off + i * dblock_shard_size;
+            uint32_t from    = shard_s > in_db_off ? shard_s : in_db_off;
+            uint32_t to      = shard_s + dblock_shard_size < in_db_off + pass_size ? shard_s + dblock_shard_size : in_db_off + pass_size;
+            memcpy(USERFS_DBLOCK(shard_bufs[i]->b_data)->data + (from - shard_s), buf + done + (from - in_db_off), to - from);
+            userfs_bcache_mark_dirty(shard_bufs[i]);
+        }
+        done += pass_size;
     }
-    write_inode->i_size  = write_inode->i_size < (real_woff + real_size - USERFS_INODE_SIZE)
-                               ? (real_woff + real_size - USERFS_INODE_SIZE)
+    if (!done) {
+        return 0;
+    }
+
+    /*update file size(if needed)*/
+    write_inode->i_size  = write_inode->i_size < (real_woff + done - USERFS_INODE_SIZE)
+                               ? (real_woff + done - USERFS_INODE_SIZE)
                                : write_inode->i_size;
 
     write_inode->i_mtime = file_modity_ts.tv_sec;
-    LOG_DESC(DBG, "USERFS FILE WRITE", "Write to file success, write dblock nr:%u, in dblock shard off:0x%x,\
-in shard off:0x%x, shard size:0x%x, real woff:0x%x, real size:%u, file blocks:%u, file size:%u",
-             target_dbbuf->b_blocknr, in_db_shard_off, in_shard_off, dblock_shard_size, real_woff, real_size,
-             write_inode->i_blocks, write_inode->i_size);
+    userfs_bbuf_set_state(inodebbuf, USERFS_BBUF_INODE_DIRTY);
+    LOG_DESC(DBG, "USERFS FILE WRITE", "Write to file success, inode nr:%u, shard size:0x%x, real woff:0x%x, expect size:0x%x, real size:0x%x, file size:%u",
+             inodebbuf->b_blocknr, dblock_shard_size, real_woff, size, done, write_inode->i_size);
 
-    return real_size;
+    return done;
 }
 
 uint32_t userfs_file_read(
@@ -541,39 +757,15 @@ uint32_t userfs_file_read(
         return 0;
     }
 
-    uint32_t real_roff       = roff + USERFS_INODE_SIZE;
-    uint32_t real_size       = size;
-    uint32_t v_db_nr         = real_roff / sb->s_data_block_size;
-    uint32_t in_db_off       = real_roff % sb->s_data_block_size;
-    uint32_t in_shard_off    = real_roff % dblock_shard_size;
-    uint32_t in_db_shard_off = in_db_off - in_shard_off;
-    /*read offset and read size must align to data block shard size,
-    otherwise must cut into series of write ops*/
-    if ((in_shard_off + size) > dblock_shard_size) {
-        real_size = dblock_shard_size - in_db_off;
-        LOG_DESC(WAR, "USERFS FILE READ", "Read size must align to data block shard size, in shard offset:0x%x, expect rsize:0x%x, real rsize:0x%x, dblock shard size:0x%x",
-                 in_shard_off, size, real_size, dblock_shard_size);
-    }
-
+    uint32_t        real_roff  = roff + USERFS_INODE_SIZE;
+    uint32_t        real_size  = size < (UINT32_MAX - real_roff) ? size : (UINT32_MAX - real_roff);
     userfs_inode_t *read_inode = USERFS_DBLOCK(inodebbuf->b_data)->inode;
-    unsigned long   p_db_addr  = read_inode->i_v2pnode_table[v_db_nr];
-    uint32_t        p_db_nr    = 0;
-    LOG_DESC(DBG, "USERFS FILE READ", "inode nr:%u, logic dblock nr:%u, in dblock offset:0x%x, in dblock shard offset:0x%x, physical dblock addr:0x%lx",
-             inodebbuf->b_blocknr, v_db_nr, in_db_off, in_db_shard_off, p_db_addr);
-
     /*read offset and size also must less than file size*/
     if (read_inode->i_size < (real_roff + real_size - USERFS_INODE_SIZE)) {
         LOG_DESC(ERR, "USERFS FILE READ", "Read offset reach out file,file size:0x%x, read start offset:0x%x, read end offset:0x%x",
                  read_inode->i_size, real_roff - USERFS_INODE_SIZE, real_roff + real_size - USERFS_INODE_SIZE);
         return 0;
     }
-    /*if read file hole, directly return all-zero buf*/
-    if (!USERFS_INODEADDR_GET(p_db_addr)) {
-        LOG_DESC(DBG, "USERFS FILE READ", "Read file hole, read start offset:0x%x, read end offset:0x%x",
-                 real_roff - USERFS_INODE_SIZE, real_roff + real_size - USERFS_INODE_SIZE);
-        memset(buf, USERFS_FILE_HOLE_DATA, real_size);
-        return real_size;
-    }
 
     /*get current time as file access time stamp*/
     struct timeval file_access_ts = {0};
@@ -582,27 +774,52 @@ uint32_t userfs_file_read(
         return 0;
     }
 
-    /*get dblock buf from target data block with target offset*/
-    userfs_bbuf_t *target_dbbuf = userfs_file_read_off_get(v_db_nr, p_db_addr, in_db_shard_off,
-                                                           dblock_shard_size, read_inode, sb);
-    if (target_dbbuf == NULL) {
-        LOG_DESC(ERR, "USERFS FILE READ", "Read target dblock buf failed");
-        return 0;
-    }
+    userfs_bbuf_t *shard_bufs[USERFS_DBLOCK_SHARD_BATCH];
+    uint32_t       done = 0;
+    /*walk shards read covers, each pass gathers shards of one dblock*/
+    while (done < real_size) {
+        uint32_t cur_roff        = real_roff + done;
+        uint32_t v_db_nr         = cur_roff / sb->s_data_block_size;
+        uint32_t in_db_off       = cur_roff % sb->s_data_block_size;
+        uint32_t in_db_shard_off = 0;
+        uint32_t shards          = 0;
+        uint32_t pass_size       = userfs_file_pass_size(cur_roff, real_size - done, dblock_shard_size, sb, &in_db_shard_off, &shards);
+        if (v_db_nr >= USERFS_INODE_V2P_COUNT) {
+            LOG_DESC(ERR, "USERFS FILE READ", "File reaches max dblocks, real roff:0x%x, max dblocks:%lu", cur_roff, USERFS_INODE_V2P_COUNT);
+            break;
+        }
+        /*if read file hole, directly return all-zero buf*/
+        if (!USERFS_INODEADDR_GET(read_inode->i_v2pnode_table[v_db_nr])) {
+            LOG_DESC(DBG, "USERFS FILE READ", "Read file hole, read start offset:0x%x, read end offset:0x%x",
+                     cur_roff - USERFS_INODE_SIZE, cur_roff + pass_size - USERFS_INODE_SIZE);
+            memset(buf + done, USERFS_FILE_HOLE_DATA, pass_size);
+            done += pass_size;
+            continue;
+        }
+        if (userfs_file_shards_get(read_inode, v_db_nr, in_db_shard_off, shards, 0, 0, 0, dblock_shard_size, sb, shard_bufs) < 0) {
+            LOG_DESC(ERR, "USERFS FILE READ", "Get dblock shards failed, logic dblock nr:%u, in dblock shard offset:0x%x, shards:%u",
+                     v_db_nr, in_db_shard_off, shards);
+            break;
+        }
 
-    /*write to target data block buf*/
-    char *target_buf = USERFS_DBLOCK(target_dbbuf->b_data)->data;
-    memcpy(buf, target_buf + in_shard_off, real_size);
-    /*update inode v2pdblock table, file dblocks count and file size(if needed)*/
-    if (USERFS_INODETYPE_GET(p_db_addr) == USERFS_NAME2INODE) {
-        read_inode->i_v2pnode_table[v_db_nr] = USERFS_INODEADDRINFO_CAL(USERFS_NAME2INODEBUF, target_dbbuf);
+        /*read from target data block bufs*/
+        for (uint32_t i = 0; i < shards; i++) {
+            uint32_t shard_s = in_db_shard_off + i * dblock_shard_size;
+            uint32_t from    = shard_s > in_db_off ? shard_s : in_db_off;
+            uint32_t to      = shard_s + dblock_shard_size < in_db_off + pass_size ? shard_s + dblock_shard_size : in_db_off + pass_size;
+            memcpy(buf + done + (from - in_db_off), USERFS_DBLOCK(shard_bufs[i]->b_data)->data + (from - shard_s), to - from);
+        }
+        done += pass_size;
+    }
+    if (!done) {
+        return 0;
     }
 
     read_inode->i_atime = file_access_ts.tv_sec;
-    LOG_DESC(DBG, "USERFS FILE READ", "Read from file success, write dblock nr:%u, in dblock shard off:0x%x,\
-in shard off:0x%x, shard size:0x%x, real roff:0x%x, real size:0x%x, file blocks:%u, file size:%u",
-             target_dbbuf->b_blocknr, in_db_shard_off, in_shard_off, dblock_shard_size, real_roff, real_size,
-             read_inode->i_blocks, read_inode->i_size);
+    userfs_bbuf_set_state(inodebbuf, USERFS_BBUF_INODE_DIRTY);
+    userfs_readahead_update(inodebbuf, real_roff, done, dblock_shard_size);
+    LOG_DESC(DBG, "USERFS FILE READ", "Read from file success, inode nr:%u, shard size:0x%x, real roff:0x%x, expect size:0x%x, real size:0x%x, file size:%u",
+             inodebbuf->b_blocknr, dblock_shard_size, real_roff, size, done, read_inode->i_size);
 
-    return real_size;
-}
\ No newline at end of file
+    return done;
+}
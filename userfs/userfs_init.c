@@ -3,6 +3,7 @@
 #include "inode.h"
 #include "log.h"
 #include "pthread_spinlock.h"
+#include "userfs_bcache.h"
 #include "userfs_block_rw.h"
 #include "userfs_dentry_hash.h"
 #include "vnode.h"
@@ -125,7 +126,13 @@ userfs_bbuf_t *userfs_get_used_metadata_block(
     const uint32_t first_mb_id,
     const uint32_t mb_id)
 {
-    userfs_bbuf_t *mb_buf = userfs_alloc_mbbuf(metablock_size);
+    userfs_bbuf_t *mb_buf = userfs_bcache_get(USERFS_BCACHE_META, mb_id, 0, metablock_size);
+    if (mb_buf) {
+        LOG_DESC(DBG, "GET USED METADATA BLOCK", "Cache hit, block id:%u, block type:%u, mbbuf:%p",
+                 mb_buf->b_blocknr, mb_buf->b_type, mb_buf);
+        return mb_buf;
+    }
+    mb_buf = userfs_alloc_mbbuf(metablock_size);
     if (!mb_buf) {
         LOG_DESC(ERR, "GET USED METADATA BLOCK", "Alloc mbbuf failed");
         return NULL;
@@ -137,6 +144,7 @@ userfs_bbuf_t *userfs_get_used_metadata_block(
         userfs_free_mbbuf(mb_buf);
         return NULL;
     }
+    mb_buf = userfs_bcache_add(mb_buf, USERFS_BCACHE_META);
     LOG_DESC(DBG, "GET USED METADATA BLOCK", "Used mblock, block id:%u, block type:%u, mbbuf:%p",
              mb_buf->b_blocknr, mb_buf->b_type, mb_buf);
     return mb_buf;
@@ -152,18 +160,22 @@ uint32_t userfs_get_used_metadata_blocklist(
     *mb_buf_list            = &dummy;
     uint32_t real_get_count = 0;
     for (int i = 0; i < mb_id_count; i++) {
-        userfs_bbuf_t *mb_buf = userfs_alloc_mbbuf(sb->s_metablock_size);
+        uint32_t       target_mb_id = mb_id[i];
+        userfs_bbuf_t *mb_buf       = userfs_bcache_get(USERFS_BCACHE_META, target_mb_id, 0, sb->s_metablock_size);
         if (!mb_buf) {
-            LOG_DESC(ERR, "GET USED METADATA BLOCK LIST", "Alloc mbbuf failed");
-            break;
-        }
-        uint32_t target_mb_id = mb_id[i];
-        mb_buf->b_block_s_off = 0;
-        /*if request used block, then must read from disk to avoid data overwrite*/
-        if (userfs_read_metadata_block(mb_buf, sb->s_first_metablock, sb->s_metablock_size, target_mb_id) < 0) {
-            LOG_DESC(ERR, "GET USED METADATA BLOCK LIST", "Read metadata on disk failed");
-            userfs_free_mbbuf(mb_buf);
-            continue;
+            mb_buf = userfs_alloc_mbbuf(sb->s_metablock_size);
+            if (!mb_buf) {
+                LOG_DESC(ERR, "GET USED METADATA BLOCK LIST", "Alloc mbbuf failed");
+                break;
+            }
+            mb_buf->b_block_s_off = 0;
+            /*if request used block, then must read from disk to avoid data overwrite*/
+            if (userfs_read_metadata_block(mb_buf, sb->s_first_metablock, sb->s_metablock_size, target_mb_id) < 0) {
+                LOG_DESC(ERR, "GET USED METADATA BLOCK LIST", "Read metadata on disk failed");
+                userfs_free_mbbuf(mb_buf);
+                continue;
+            }
+            mb_buf = userfs_bcache_add(mb_buf, USERFS_BCACHE_META);
         }
         LOG_DESC(DBG, "GET USED METADATA BLOCK LIST", "Used mblock, block id:%u, block type:%u, mbbuf:%p",
                  mb_buf->b_blocknr, mb_buf->b_type, mb_buf);
@@ -199,6 +211,7 @@ userfs_super_block_t *userfs_suber_block_alloc(
     /*WARING: because using zero-len bitmap, when alloc super block, must calculate
     bytes that bitmap needs and alloc*/
     userfs_super_block_t *sb    = USERFS_MBLOCK(sb_block_buf->b_data)->sb;
+    sb->s_magic                 = USERFS_SUPER_MAGIC;
     /*data block*/
     sb->s_first_datablock       = 1;
     sb->s_data_block_count      = total_block_count - 1;
@@ -260,7 +273,7 @@ userfs_bbuf_t *userfs_bgroup_desc_table_init(
     /*calculate mblock that bgroup descriptors table needs*/
     userfs_bbuf_t *bgroup_desc_table_list   = NULL;
     userfs_bbuf_t *bgroup_desc_table_lh     = NULL;
-    uint32_t       bitmap_len               = (blocks_per_group + 8) >> 3;
+    uint32_t       bitmap_len               = BITMAP_STORAGE_BYTES(blocks_per_group);
     uint32_t       bgroup_desc_size         = sizeof(userfs_bgroup_desc_t) + bitmap_len;
     uint32_t       bgroup_desc_per_mb_count = (sb->s_metablock_size - sizeof(userfs_mblock_t)) / bgroup_desc_size;
     uint32_t       bgroup_desc_count        = (sb->s_data_block_count + blocks_per_group - 1) / blocks_per_group;
@@ -371,10 +384,23 @@ userfs_bbuf_t *userfs_mount_init(
     userfs_bbuf_t *sb_buf = userfs_get_used_metadata_block(metablock_size, first_metablock_id, 0);
     if (!sb_buf || sb_buf->b_type != USERFS_BTYPE_SUPER) {
         LOG_DESC(ERR, "USERFS MOUNT INIT", "Get super block from disk failed");
-        userfs_free_mbbuf(sb_buf);
+        if (sb_buf && userfs_bcache_forget(sb_buf) < 0) {
+            userfs_free_mbbuf(sb_buf);
+        }
         return NULL;
     }
     userfs_super_block_t *sb = USERFS_MBLOCK(sb_buf->b_data)->sb;
+    /*bitmaps embedded in metadata blocks follow the current layout only,
+    images from an older format are not supported*/
+    if (sb->s_magic != USERFS_SUPER_MAGIC ||
+        sb->s_metadata_block_bitmap.words != BITMAP_WORD_COUNT(sb->s_metadata_block_bitmap.bytes << 3)) {
+        LOG_DESC(ERR, "USERFS MOUNT INIT", "Unsupported on-disk format, magic:0x%x, expect:0x%x",
+                 sb->s_magic, USERFS_SUPER_MAGIC);
+        if (userfs_bcache_forget(sb_buf) < 0) {
+            userfs_free_mbbuf(sb_buf);
+        }
+        return NULL;
+    }
 
     /*read block group descriptors blocks from disk*/
     userfs_bbuf_t  dummy;
@@ -452,6 +478,13 @@ userfs_bgd_index_list_t *userfs_mount_bgdindex_list_init(
             bgroup_idx_count > sb->s_bgroup_desc_per_mb_count ? sb->s_bgroup_desc_per_mb_count : bgroup_idx_count;
         userfs_bgroup_desc_t *cur_bg_desc_table = USERFS_MBLOCK(cur_bg_desc_bbuf->b_data)->bg_desc_table;
         for (int i = 0; i < cur_mb_bgd_count; i++) {
+            // recount free blocks from bitmap in bulk, on-disk counter may be stale after crash
+            int free_count = bitmap_count_free(&(cur_bg_desc_table->block_bm), 0, cur_bg_desc_table->block_bm.bytes << 3);
+            if (free_count >= 0 && free_count != cur_bg_desc_table->bg_free_block_count) {
+                LOG_DESC(WAR, "USERFS BGROUP DESC INDEX LIST INIT", "Bgroup:%u free block count mismatch, desc:%u, bitmap:%d",
+                         bgroup_id, cur_bg_desc_table->bg_free_block_count, free_count);
+                cur_bg_desc_table->bg_free_block_count = free_count;
+            }
             if (userfs_mrheap_insert(bg_index_list->bgi_maxroot_heap, bgroup_id, cur_bg_desc_table->bg_free_block_count, NULL) == NULL) {
                 LOG_DESC(ERR, "USERFS BGROUP DESC INDEX LIST INIT", "Bgroup index heap insert failed, block id:%u, f_block_count:%u",
                          bgroup_id, cur_bg_desc_table->bg_free_block_count);
@@ -0,0 +1,308 @@
+#include "userfs_readahead.h"
+#include "list.h"
+#include "log.h"
+#include "userfs_bcache.h"
+#include "userfs_block_rw.h"
+#include "userfs_file_ctrl.h"
+#include <pthread.h>
+#include <string.h>
+
+/*one shard to be read into buffer cache*/
+typedef struct userfs_ra_req {
+    list_t            r_list;
+    userfs_file_ra_t *r_ra;
+    uint32_t          r_blocknr;
+    uint32_t          r_block_s_off;
+    uint32_t          r_size;
+} userfs_ra_req_t;
+
+typedef struct userfs_readahead {
+    pthread_mutex_t lock;
+    /*signaled when request is queued or workers stop*/
+    pthread_cond_t  wakeup;
+    /*signaled when request finishes*/
+    pthread_cond_t  done;
+    list_t          queue;
+    pthread_t       worker[USERFS_RA_MAX_WORKERS];
+    uint32_t        workers;
+    uint32_t        max_window;
+    int             running;
+    uint32_t        first_dblock;
+    uint32_t        dblock_size;
+} userfs_readahead_t;
+
+static userfs_readahead_t g_ra = {.lock   = PTHREAD_MUTEX_INITIALIZER,
+                                  .wakeup = PTHREAD_COND_INITIALIZER,
+                                  .done   = PTHREAD_COND_INITIALIZER};
+
+static void userfs_readahead_fill(
+    const userfs_ra_req_t *req)
+{
+    userfs_bbuf_t *bbuf = userfs_alloc_dbbuf(req->r_size);
+    if (!bbuf) {
+        LOG_DESC(ERR, "USERFS READAHEAD", "Alloc dblock buf failed, dblock nr:%u", req->r_blocknr);
+        return;
+    }
+    bbuf->b_list_len    = 1;
+    bbuf->b_blocknr     = req->r_blocknr;
+    bbuf->b_block_s_off = req->r_block_s_off;
+    bbuf->b_size        = req->r_size;
+    userfs_bbuf_set_state(bbuf, USERFS_BBUF_READAHEAD);
+    /*shard is cached already, by a reader or an earlier window*/
+    if (userfs_bcache_add_reading(bbuf, USERFS_BCACHE_DATA) < 0) {
+        USERFS_MEM_FREE(bbuf->b_data);
+        USERFS_MEM_FREE(bbuf);
+        return;
+    }
+    int res = userfs_read_data_block(bbuf, g_ra.first_dblock, g_ra.dblock_size);
+    if (res != 0) {
+        LOG_DESC(WAR, "USERFS READAHEAD", "Read dblock failed, dblock nr:%u, in dblock off:0x%x",
+                 req->r_blocknr, req->r_block_s_off);
+    }
+    userfs_bcache_read_done(bbuf, res != 0 ? -1 : 0);
+}
+
+static void *userfs_readahead_worker(
+    void *arg)
+{
+    pthread_mutex_lock(&(g_ra.lock));
+    while (1) {
+        while (g_ra.running && g_ra.queue.next == &(g_ra.queue)) {
+            pthread_cond_wait(&(g_ra.wakeup), &(g_ra.lock));
+        }
+        if (!g_ra.running) {
+            break;
+        }
+        userfs_ra_req_t *req = container_of(g_ra.queue.next, userfs_ra_req_t, r_list);
+        list_remove(&(req->r_list));
+        pthread_mutex_unlock(&(g_ra.lock));
+
+        userfs_readahead_fill(req);
+
+        pthread_mutex_lock(&(g_ra.lock));
+        req->r_ra->inflight--;
+        pthread_cond_broadcast(&(g_ra.done));
+        USERFS_MEM_FREE(req);
+    }
+    pthread_mutex_unlock(&(g_ra.lock));
+    return NULL;
+}
+
+/*lock held, drop queued requests of ra, all of them if ra is NULL*/
+static void userfs_readahead_drop(
+    const userfs_file_ra_t *ra)
+{
+    list_t *cur = g_ra.queue.next;
+    while (cur != &(g_ra.queue)) {
+        userfs_ra_req_t *req = container_of(cur, userfs_ra_req_t, r_list);
+        cur                  = cur->next;
+        if (ra && req->r_ra != ra) {
+            continue;
+        }
+        list_remove(&(req->r_list));
+        req->r_ra->inflight--;
+        USERFS_MEM_FREE(req);
+    }
+    pthread_cond_broadcast(&(g_ra.done));
+}
+
+int userfs_readahead_start(
+    const userfs_super_block_t *sb,
+    const userfs_ra_params_t   *params)
+{
+    pthread_mutex_lock(&(g_ra.lock));
+    if (g_ra.running) {
+        pthread_mutex_unlock(&(g_ra.lock));
+        LOG_DESC(ERR, "USERFS READAHEAD", "Readahead already running");
+        return -1;
+    }
+    uint32_t workers  = params && params->workers ? params->workers : USERFS_RA_DEFAULT_WORKERS;
+    g_ra.workers      = workers < USERFS_RA_MAX_WORKERS ? workers : USERFS_RA_MAX_WORKERS;
+    g_ra.max_window   = params && params->max_window ? params->max_window : USERFS_RA_DEFAULT_MAX_WINDOW;
+    g_ra.first_dblock = sb->s_first_datablock;
+    g_ra.dblock_size  = sb->s_data_block_size;
+    INIT_LIST_HEAD(&(g_ra.queue));
+    g_ra.running = 1;
+    for (uint32_t i = 0; i < g_ra.workers; i++) {
+        if (pthread_create(&(g_ra.worker[i]), NULL, userfs_readahead_worker, NULL) != 0) {
+            LOG_DESC(ERR, "USERFS READAHEAD", "Create readahead worker %u failed", i);
+            g_ra.running = 0;
+            g_ra.workers = i;
+            break;
+        }
+    }
+    if (!g_ra.running) {
+        pthread_cond_broadcast(&(g_ra.wakeup));
+        pthread_mutex_unlock(&(g_ra.lock));
+        for (uint32_t i = 0; i < g_ra.workers; i++) {
+            pthread_join(g_ra.worker[i], NULL);
+        }
+        return -1;
+    }
+    pthread_mutex_unlock(&(g_ra.lock));
+    LOG_DESC(DBG, "USERFS READAHEAD", "Readahead start, workers:%u, max window:%u shards", g_ra.workers, g_ra.max_window);
+    return 0;
+}
+
+void userfs_readahead_stop(void)
+{
+    pthread_mutex_lock(&(g_ra.lock));
+    if (!g_ra.running) {
+        pthread_mutex_unlock(&(g_ra.lock));
+        return;
+    }
+    g_ra.running = 0;
+    userfs_readahead_drop(NULL);
+    pthread_cond_broadcast(&(g_ra.wakeup));
+    pthread_mutex_unlock(&(g_ra.lock));
+    for (uint32_t i = 0; i < g_ra.workers; i++) {
+        pthread_join(g_ra.worker[i], NULL);
+    }
+}
+
+/*locate file shard on disk, 0 if it is a hole, already in file's buffer list or
+past inode table*/
+static int userfs_readahead_locate(
+    const userfs_inode_t *inode,
+    const uint32_t        shard,
+    const uint32_t        dblock_shard_size,
+    userfs_ra_req_t      *req)
+{
+    uint64_t off             = (uint64_t)shard * dblock_shard_size;
+    uint32_t v_db_nr         = off / g_ra.dblock_size;
+    uint32_t in_db_shard_off = off % g_ra.dblock_size;
+    if (v_db_nr >= USERFS_INODE_V2P_COUNT) {
+        return 0;
+    }
+    unsigned long p_db_addr = inode->i_v2pnode_table[v_db_nr];
+    if (!USERFS_INODEADDR_GET(p_db_addr)) {
+        return 0;
+    }
+    if (USERFS_INODETYPE_GET(p_db_addr) == USERFS_NAME2INODE) {
+        req->r_blocknr = USERFS_INODEADDR_GET(p_db_addr);
+    } else {
+        /*shards file holds may be newer than disk*/
+        userfs_bbuf_t *head = (userfs_bbuf_t *)USERFS_INODEADDR_GET(p_db_addr);
+        userfs_bbuf_t *cur  = head;
+        for (int i = 0; i < head->b_list_len && cur; i++, cur = cur->b_this_page) {
+            if (cur->b_block_s_off == in_db_shard_off) {
+                return 0;
+            }
+        }
+        req->r_blocknr = head->b_blocknr;
+    }
+    req->r_block_s_off = in_db_shard_off;
+    req->r_size        = dblock_shard_size;
+    return 1;
+}
+
+void userfs_readahead_update(
+    userfs_bbuf_t *inodebbuf,
+    const uint32_t real_roff,
+    const uint32_t size,
+    const uint32_t dblock_shard_size)
+{
+    if (!size || !__atomic_load_n(&(g_ra.running), __ATOMIC_RELAXED)) {
+        return;
+    }
+    userfs_file_ra_t *ra = inodebbuf->b_ra;
+    if (!ra) {
+        ra = USERFS_MEM_ALLOC(sizeof(userfs_file_ra_t));
+        if (!ra) {
+            LOG_DESC(ERR, "USERFS READAHEAD", "Alloc readahead state failed, inode nr:%u", inodebbuf->b_blocknr);
+            return;
+        }
+        memset(ra, 0, sizeof(userfs_file_ra_t));
+        /*read from file start is sequential already*/
+        ra->next_off    = USERFS_INODE_SIZE;
+        inodebbuf->b_ra = ra;
+    }
+
+    /*read may cover several shards, stream is in last one*/
+    uint32_t shard = (uint32_t)(((uint64_t)real_roff + size - 1) / dblock_shard_size);
+    /*read doesn't go on where last one stopped, stream is broken*/
+    if (real_roff != ra->next_off) {
+        if (ra->window) {
+            LOG_DESC(DBG, "USERFS READAHEAD", "Random read, window collapse, inode nr:%u, real roff:0x%x, expect:0x%lx, window:%u",
+                     inodebbuf->b_blocknr, real_roff, ra->next_off, ra->window);
+        }
+        ra->next_off  = (uint64_t)real_roff + size;
+        ra->cur_shard = shard;
+        ra->ra_end    = 0;
+        ra->window    = 0;
+        return;
+    }
+    ra->next_off = (uint64_t)real_roff + size;
+    if (!ra->window) {
+        ra->window = USERFS_RA_INIT_WINDOW;
+    } else if (shard != ra->cur_shard) {
+        /*stream reached shard read ahead for it*/
+        ra->window = ra->window << 1 < g_ra.max_window ? ra->window << 1 : g_ra.max_window;
+    }
+    ra->cur_shard = shard;
+
+    userfs_inode_t *inode  = USERFS_DBLOCK(inodebbuf->b_data)->inode;
+    uint64_t        shards = ((uint64_t)inode->i_size + USERFS_INODE_SIZE + dblock_shard_size - 1) / dblock_shard_size;
+    uint64_t        end    = (uint64_t)shard + 1 + ra->window;
+    end                    = end < shards ? end : shards;
+    uint32_t start         = ra->ra_end > shard + 1 ? ra->ra_end : shard + 1;
+    if (start >= end) {
+        return;
+    }
+
+    list_t batch;
+    INIT_LIST_HEAD(&batch);
+    uint32_t count = 0;
+    for (uint32_t cur = start; cur < end; cur++) {
+        userfs_ra_req_t req = {.r_ra = ra};
+        if (!userfs_readahead_locate(inode, cur, dblock_shard_size, &req)) {
+            continue;
+        }
+        userfs_ra_req_t *new_req = USERFS_MEM_ALLOC(sizeof(userfs_ra_req_t));
+        if (!new_req) {
+            LOG_DESC(ERR, "USERFS READAHEAD", "Alloc readahead request failed");
+            break;
+        }
+        *new_req = req;
+        list_add_tail(&(new_req->r_list), &batch);
+        count++;
+    }
+    ra->ra_end = end;
+    if (!count) {
+        return;
+    }
+
+    pthread_mutex_lock(&(g_ra.lock));
+    while (batch.next != &batch) {
+        userfs_ra_req_t *req = container_of(batch.next, userfs_ra_req_t, r_list);
+        list_remove(&(req->r_list));
+        if (g_ra.running) {
+            list_add_tail(&(req->r_list), &(g_ra.queue));
+            ra->inflight++;
+        } else {
+            USERFS_MEM_FREE(req);
+        }
+    }
+    pthread_cond_broadcast(&(g_ra.wakeup));
+    pthread_mutex_unlock(&(g_ra.lock));
+    LOG_DESC(DBG, "USERFS READAHEAD", "Queue readahead, inode nr:%u, shard:%u, window:%u, shards:[%u, %lu), requests:%u",
+             inodebbuf->b_blocknr, shard, ra->window, start, end, count);
+}
+
+void userfs_readahead_release(
+    userfs_bbuf_t *inodebbuf)
+{
+    userfs_file_ra_t *ra = inodebbuf->b_ra;
+    if (!ra) {
+        return;
+    }
+    pthread_mutex_lock(&(g_ra.lock));
+    userfs_readahead_drop(ra);
+    /*running requests still look at file's blocks, which may be freed after close*/
+    while (ra->inflight) {
+        pthread_cond_wait(&(g_ra.done), &(g_ra.lock));
+    }
+    pthread_mutex_unlock(&(g_ra.lock));
+    inodebbuf->b_ra = NULL;
+    USERFS_MEM_FREE(ra);
+}